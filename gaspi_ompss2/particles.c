@@ -120,7 +120,6 @@ void spec_inject_particles(t_part_vector *part_vector, const int range[][2],
 							part_vector->data[ip].ux = ufl[0] + uth[0] * rand_norm();
 							part_vector->data[ip].uy = ufl[1] + uth[1] * rand_norm();
 							part_vector->data[ip].uz = ufl[2] + uth[2] * rand_norm();
-							part_vector->data[ip].invalid = false;
 							ip++;
 						}
 					} else
@@ -166,7 +165,6 @@ void spec_inject_particles(t_part_vector *part_vector, const int range[][2],
 					part_vector->data[ip].ux = ufl[0] + uth[0] * rand_norm();
 					part_vector->data[ip].uy = ufl[1] + uth[1] * rand_norm();
 					part_vector->data[ip].uz = ufl[2] + uth[2] * rand_norm();
-					part_vector->data[ip].invalid = false;
 					ip++;
 				}
 			}
@@ -406,10 +404,10 @@ void spec_merge_vectors(t_part_vector *dest, t_part_vector *source)
 
 	for (int j = 0; j < size_temp; j++)   // Loop through all elements in the input vector
 	{
-		if (!source->data[j].invalid)
+		if (source->data[j].ix != PART_INVALID)
 		{
 			// Find "holes" left by an invalid particle in the output vector
-			while (i < size && !dest->data[i].invalid) i++;
+			while (i < size && dest->data[i].ix != PART_INVALID) i++;
 
 			if (i < size) dest->data[i] = source->data[j];
 			else dest->data[dest->size++] = source->data[j];
@@ -594,7 +592,7 @@ void spec_receive_particles(t_species *spec, const int region_id, const int spec
 
 	// Remove invalid particles
 	for (int i = 0; i < spec->main_vector.size; ++i)
-		if (spec->main_vector.data[i].invalid)
+		if (spec->main_vector.data[i].ix == PART_INVALID)
 			spec->main_vector.data[i--] = spec->main_vector.data[--spec->main_vector.size];
 }
 
@@ -898,7 +896,7 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
 	// Advance particles
 	for (int i = 0; i < spec->main_vector.size; i++)
 	{
-		if (spec->main_vector.data[i].invalid) continue;
+		if (spec->main_vector.data[i].ix == PART_INVALID) continue;
 
 		t_vfld Ep, Bp;
 		t_part_data utx, uty, utz;
@@ -998,7 +996,7 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
 
 			if ((spec->main_vector.data[i].ix < 0) || (spec->main_vector.data[i].ix >= sim_nx[0]))
 			{
-				spec->main_vector.data[i].invalid = true;
+				spec->main_vector.data[i].ix = PART_INVALID;
 				continue;
 			}
 		}
@@ -1031,7 +1029,7 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
 
 			t_part_vector *out = spec->outgoing_part[target];
 			out->data[out->size++] = spec->main_vector.data[i];
-			spec->main_vector.data[i].invalid = true;
+			spec->main_vector.data[i].ix = PART_INVALID;
 		}
 	}
 
@@ -1059,7 +1057,7 @@ void spec_deposit_charge(const t_species *spec, t_part_data *charge, const int n
 
 	for (int i = 0; i < spec->main_vector.size; i++)
 	{
-		if (spec->main_vector.data[i].invalid) continue;
+		if (spec->main_vector.data[i].ix == PART_INVALID) continue;
 
 		int ix = spec->main_vector.data[i].ix;
 		int iy = spec->main_vector.data[i].iy;
@@ -14,6 +14,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <limits.h>
 #include <GASPI.h>
 
 #include "zpic.h"
@@ -25,14 +26,13 @@
 
 #define LTRIM(x) (x >= 1.0f) - (x < 0.0f)
 
+// Particles that exited the region are marked as invalid by setting ix to this value
+#define PART_INVALID INT_MIN
+
 typedef struct {
 	int ix, iy;
 	t_part_data x, y;
 	t_part_data ux, uy, uz;
-
-	// Mark the particle as invalid (the particle exited the region)
-	bool invalid;
-
 } t_part;
 
 enum density_type {
@@ -36,6 +36,9 @@ void sim_init(t_simulation *sim, int n_regions)
 	// Initialize Simulation data
 	sim_new(sim, nx, box, dt, tmax, ndump, species, n_species, "warm-500-67M-512-512", n_regions);
 
+	// Sort the particles by tile every 20 iterations (this must come after sim_new)
+	sim_set_sort(sim, 20);
+
 	free(species);
 }
 
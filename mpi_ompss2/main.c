@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "zpic.h"
 #include "utilities.h"
@@ -61,7 +62,7 @@ int main(int argc, const char *argv[])
 {
 	if(argc != 2)
 	{
-		fprintf(stderr, "Please specify the number of regions");
+		fprintf(stderr, "Please specify the number of regions (or --autotune)");
 		exit(1);
 	}
 
@@ -80,7 +81,8 @@ int main(int argc, const char *argv[])
 
 	// Initialize simulation
 	t_simulation sim;
-	sim_init(&sim, atoi(argv[1]));
+	if (strcmp(argv[1], "--autotune") == 0) sim_autotune(&sim);
+	else sim_init(&sim, atoi(argv[1]));
 	CHECK_MPI_ERROR(MPI_Barrier(MPI_COMM_WORLD));
 
 	// Run simulation
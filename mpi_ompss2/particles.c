@@ -143,7 +143,6 @@ void spec_inject_particles(t_part_vector *part_vector, const int range[][2],
 							part_vector->data[ip].ux = ufl[0] + uth[0] * rand_norm();
 							part_vector->data[ip].uy = ufl[1] + uth[1] * rand_norm();
 							part_vector->data[ip].uz = ufl[2] + uth[2] * rand_norm();
-							part_vector->data[ip].invalid = false;
 							ip++;
 						}
 					} else
@@ -189,7 +188,6 @@ void spec_inject_particles(t_part_vector *part_vector, const int range[][2],
 					part_vector->data[ip].ux = ufl[0] + uth[0] * rand_norm();
 					part_vector->data[ip].uy = ufl[1] + uth[1] * rand_norm();
 					part_vector->data[ip].uz = ufl[2] + uth[2] * rand_norm();
-					part_vector->data[ip].invalid = false;
 					ip++;
 				}
 			}
@@ -280,21 +278,35 @@ void spec_new(t_species *spec, char name[], const t_part_data m_q, const int ppc
 	spec->moving_window = false;
 	spec->n_move = 0;
 
+	// Reset sorting information
+	spec->n_sorts = 0;
+	spec->sort_time = 0.0;
+	spec->push_time = 0.0;
+	spec->push_time_saved = 0.0;
+	spec->push_rate = 0.0;
+	spec->push_rate_unsorted = 0.0;
+
+	spec->sort_vector.data = NULL;
+	spec->sort_vector.size = 0;
+	spec->sort_vector.size_max = 0;
+	spec->sort_pos = NULL;
+	spec->sort_pos_max = 0;
+	spec->sort_tile_offset = NULL;
+	spec->sort_n_tiles_max = 0;
+
 	if(MPI_PART == MPI_DATATYPE_NULL)
 	{
-		const int block_length[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+		const int block_length[7] = {1, 1, 1, 1, 1, 1, 1};
 
-		const MPI_Aint disp[8] = {offsetof(t_part, ix), offsetof(t_part, iy),
+		const MPI_Aint disp[7] = {offsetof(t_part, ix), offsetof(t_part, iy),
 		                          offsetof(t_part, x), offsetof(t_part, y),
-		                          offsetof(t_part, ux), offsetof(t_part, uy), offsetof(t_part, uz),
-		                          offsetof(t_part, invalid)};
+		                          offsetof(t_part, ux), offsetof(t_part, uy), offsetof(t_part, uz)};
 
-		const MPI_Datatype types[8] = {MPI_INT, MPI_INT,
+		const MPI_Datatype types[7] = {MPI_INT, MPI_INT,
 		                               MPI_FLOAT, MPI_FLOAT,
-		                               MPI_FLOAT, MPI_FLOAT, MPI_FLOAT,
-		                               MPI_C_BOOL};
+		                               MPI_FLOAT, MPI_FLOAT, MPI_FLOAT};
 
-		CHECK_MPI_ERROR(MPI_Type_create_struct(8, block_length, disp, types, &MPI_PART));
+		CHECK_MPI_ERROR(MPI_Type_create_struct(7, block_length, disp, types, &MPI_PART));
 		CHECK_MPI_ERROR(MPI_Type_commit(&MPI_PART));
 	}
 
@@ -316,6 +328,10 @@ void spec_delete(t_species *spec)
 	free(spec->main_vector.data);
 	spec->main_vector.size = -1;
 
+	free(spec->sort_vector.data);
+	free(spec->sort_pos);
+	free(spec->sort_tile_offset);
+
 	for (int i = 0; i < NUM_ADJ_PART; i++)
 	{
 		free(spec->incoming_part[i].data);
@@ -408,10 +424,10 @@ void spec_merge_vectors(t_part_vector *dest, t_part_vector *source)
 
 	for (int j = 0; j < size_temp; j++)   // Loop through all elements in the input vector
 	{
-		if (!source->data[j].invalid)
+		if (source->data[j].ix != PART_INVALID)
 		{
 			// Find "holes" left by an invalid particle in the output vector
-			while (i < size && !dest->data[i].invalid) i++;
+			while (i < size && dest->data[i].ix != PART_INVALID) i++;
 
 			if (i < size) dest->data[i] = source->data[j];
 			else dest->data[dest->size++] = source->data[j];
@@ -568,10 +584,88 @@ void spec_receive_particles(t_species *spec)
 
 	// Remove invalid particles
 	for (int i = 0; i < spec->main_vector.size; ++i)
-		if (spec->main_vector.data[i].invalid)
+		if (spec->main_vector.data[i].ix == PART_INVALID)
 			spec->main_vector.data[i--] = spec->main_vector.data[--spec->main_vector.size];
 }
 
+/*********************************************************************************************
+ Sorting
+ *********************************************************************************************/
+// Sort the particles by tile (counting sort). Particles in the same tile are kept in
+// their original order. All the particles must be valid and inside the region
+void spec_sort(t_species *spec, const int region_limits[2][2])
+{
+	uint64_t t0 = timer_ticks();
+
+	const int size = spec->main_vector.size;
+	const int n_tiles_x = (region_limits[0][1] - region_limits[0][0] + TILE_SIZE - 1) / TILE_SIZE;
+	const int n_tiles_y = (region_limits[1][1] - region_limits[1][0] + TILE_SIZE - 1) / TILE_SIZE;
+	const int n_tiles = n_tiles_x * n_tiles_y;
+
+	// The sorting buffers are only reallocated when the particle buffer or the region grows
+	if (spec->sort_vector.size_max < spec->main_vector.size_max)
+	{
+		free(spec->sort_vector.data);
+		spec->sort_vector.size_max = spec->main_vector.size_max;
+		spec->sort_vector.data = malloc(spec->sort_vector.size_max * sizeof(t_part));
+	}
+
+	if (spec->sort_pos_max < size)
+	{
+		free(spec->sort_pos);
+		spec->sort_pos_max = spec->main_vector.size_max;
+		spec->sort_pos = malloc(spec->sort_pos_max * sizeof(int));
+	}
+
+	if (spec->sort_n_tiles_max < n_tiles)
+	{
+		free(spec->sort_tile_offset);
+		spec->sort_n_tiles_max = n_tiles;
+		spec->sort_tile_offset = malloc((n_tiles + 1) * sizeof(int));
+	}
+
+	if (!spec->sort_vector.data || !spec->sort_pos || !spec->sort_tile_offset)
+	{
+		fprintf(stderr, "Error in allocating the sorting buffers. Exiting...\n");
+		exit(1);
+	}
+
+	int *restrict tile_offset = spec->sort_tile_offset;
+	int *restrict pos = spec->sort_pos;
+	t_part *restrict sorted = spec->sort_vector.data;
+
+	memset(tile_offset, 0, (n_tiles + 1) * sizeof(int));
+
+	// Calculate the histogram (number of particles per tile)
+	for (int i = 0; i < size; i++)
+	{
+		int ix = (spec->main_vector.data[i].ix - region_limits[0][0]) / TILE_SIZE;
+		int iy = (spec->main_vector.data[i].iy - region_limits[1][0]) / TILE_SIZE;
+
+		pos[i] = ix + iy * n_tiles_x;
+		tile_offset[pos[i] + 1]++;
+	}
+
+	// Prefix sum to find the initial idx of each tile in the particle vector
+	for (int k = 0; k < n_tiles; k++)
+		tile_offset[k + 1] += tile_offset[k];
+
+	// Organize the particles in tiles
+	for (int i = 0; i < size; i++)
+		sorted[tile_offset[pos[i]]++] = spec->main_vector.data[i];
+
+	// Swap the buffers (the old particle buffer is reused in the next sort)
+	t_part_vector tmp = spec->main_vector;
+	spec->main_vector.data = sorted;
+	spec->main_vector.size_max = spec->sort_vector.size_max;
+	spec->sort_vector = tmp;
+
+	// The push time after this point is compared with the one before sorting
+	spec->push_rate_unsorted = spec->push_rate;
+	spec->sort_time += timer_interval_seconds(t0, timer_ticks());
+	spec->n_sorts++;
+}
+
 /*********************************************************************************************
  Current deposition
  *********************************************************************************************/
@@ -857,6 +951,9 @@ void interpolate_fld(const t_vfld *restrict const E, const t_vfld *restrict cons
 void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
                   const int region_limits[2][2], const int sim_nx[2])
 {
+	uint64_t t0 = timer_ticks();
+	const int np_push = spec->main_vector.size;
+
 	const t_part_data tem = 0.5 * spec->dt / spec->m_q;
 	const t_part_data dt_dx = spec->dt / spec->dx[0];
 	const t_part_data dt_dy = spec->dt / spec->dx[1];
@@ -872,7 +969,7 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
 	// Advance particles
 	for (int i = 0; i < spec->main_vector.size; i++)
 	{
-		if (spec->main_vector.data[i].invalid) continue;
+		if (spec->main_vector.data[i].ix == PART_INVALID) continue;
 
 		t_vfld Ep, Bp;
 		t_part_data utx, uty, utz;
@@ -972,7 +1069,7 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
 
 			if ((spec->main_vector.data[i].ix < 0) || (spec->main_vector.data[i].ix >= sim_nx[0]))
 			{
-				spec->main_vector.data[i].invalid = true;
+				spec->main_vector.data[i].ix = PART_INVALID;
 				continue;
 			}
 		}
@@ -1005,7 +1102,7 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
 
 			t_part_vector *out = spec->outgoing_part[target];
 			out->data[out->size++] = spec->main_vector.data[i];
-			spec->main_vector.data[i].invalid = true;
+			spec->main_vector.data[i].ix = PART_INVALID;
 		}
 	}
 
@@ -1020,6 +1117,18 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current,
 		spec_inject_particles(&spec->main_vector, range, region_limits, spec->ppc, &spec->density,
 		                      spec->dx, spec->n_move, spec->ufl, spec->uth);
 	}
+
+	const double push_time = timer_interval_seconds(t0, timer_ticks());
+	spec->push_time += push_time;
+
+	if (np_push > 0)
+	{
+		spec->push_rate = push_time / np_push;
+
+		// Compare with the push rate measured before the last sorting
+		if (spec->n_sorts > 0)
+			spec->push_time_saved += spec->push_rate_unsorted * np_push - push_time;
+	}
 }
 
 /*********************************************************************************************
@@ -1033,7 +1142,7 @@ void spec_deposit_charge(const t_species *spec, t_part_data *charge, const int n
 
 	for (int i = 0; i < spec->main_vector.size; i++)
 	{
-		if (spec->main_vector.data[i].invalid) continue;
+		if (spec->main_vector.data[i].ix == PART_INVALID) continue;
 
 		int ix = spec->main_vector.data[i].ix;
 		int iy = spec->main_vector.data[i].iy;
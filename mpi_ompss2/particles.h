@@ -14,6 +14,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <limits.h>
 #include <mpi.h>
 
 #include "zpic.h"
@@ -25,14 +26,13 @@
 
 #define LTRIM(x) (x >= 1.0f) - (x < 0.0f)
 
+// Particles that exited the region are marked as invalid by setting ix to this value
+#define PART_INVALID INT_MIN
+
 typedef struct {
 	int ix, iy;
 	t_part_data x, y;
 	t_part_data ux, uy, uz;
-
-	// Mark the particle as invalid (the particle exited the region)
-	bool invalid;
-
 } t_part;
 
 enum density_type {
@@ -100,6 +100,21 @@ typedef struct {
 	bool moving_window;
 	int n_move;
 
+	// Particle sorting
+	int n_sorts;
+	double sort_time;
+	double push_time;
+	double push_time_saved;		// Estimated push time saved by the sorting
+	double push_rate;			// Push time per particle in the last iteration
+	double push_rate_unsorted;	// Push time per particle before the last sorting
+
+	// Sorting buffers, kept between sorts (the particle buffer is swapped with sort_vector)
+	t_part_vector sort_vector;
+	int *sort_pos;
+	int sort_pos_max;
+	int *sort_tile_offset;
+	int sort_n_tiles_max;
+
 } t_species;
 
 // Setup
@@ -160,6 +175,9 @@ void spec_send_particles(t_species *spec, const int region_id, const int spec_id
 		in(spec->incoming_part[PART_UP_RIGHT])
 void spec_receive_particles(t_species *spec);
 
+#pragma oss task label("Spec Sort") inout(spec->main_vector)
+void spec_sort(t_species *spec, const int region_limits[2][2]);
+
 /*********************************************************************************************
  Diagnostics
  *********************************************************************************************/
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <assert.h>
 
 #include "utilities.h"
@@ -28,6 +29,14 @@
 #include "task_management.h"
 #endif
 
+// Auto-tuning: cache file, number of iterations discarded and measured for each configuration,
+// maximum number of regions per thread and minimum number of cells of a region in y
+#define AUTOTUNE_CACHE "output/autotune.cache"
+#define AUTOTUNE_WARMUP 2
+#define AUTOTUNE_ITER 5
+#define AUTOTUNE_MAX_REGIONS_PER_THREAD 8
+#define AUTOTUNE_MIN_CELLS 2
+
 /*********************************************************************************************
  Initialisation
  *********************************************************************************************/
@@ -95,6 +104,7 @@ void sim_new(t_simulation *sim, int nx[2], float box[2], float dt, float tmax, i
 	// Simulation parameters
 	strncpy(sim->name, name, 64);
 	sim->iter = 0;
+	sim->n_sort = 0;
 	sim->moving_window = false;
 	sim->dt = dt;
 	sim->tmax = tmax;
@@ -254,6 +264,151 @@ void sim_set_moving_window(t_simulation *sim)
 		region_set_moving_window(&sim->regions[i]);
 }
 
+// Set the particle sorting frequency (in iterations)
+void sim_set_sort(t_simulation *sim, const int n_sort)
+{
+	sim->n_sort = n_sort;
+}
+
+/*********************************************************************************************
+ Auto-tuning
+ *********************************************************************************************/
+static int sim_num_threads()
+{
+#ifdef ENABLE_TASKING
+	return nanos6_get_num_cpus();
+#else
+	return 1;
+#endif
+}
+
+// Key of the configurations saved in the cache: input deck, machine (of the root process),
+// number of processes and number of threads per process
+static void sim_autotune_key(const t_simulation *sim, char key[256])
+{
+	struct utsname host;
+	if (uname(&host) != 0) strcpy(host.nodename, "unknown");
+
+	snprintf(key, 256, "%s %s %d %d", sim->name, host.nodename, sim->num_procs, sim_num_threads());
+}
+
+// Read the number of regions saved for the key (the last entry is used)
+static bool sim_autotune_load(const char *key, int *n_regions)
+{
+	FILE *file = fopen(AUTOTUNE_CACHE, "r");
+	if (!file) return false;
+
+	char line[512];
+	bool found = false;
+	const size_t len = strlen(key);
+
+	while (fgets(line, sizeof(line), file))
+		if (strncmp(line, key, len) == 0 && line[len] == ' ')
+			if (sscanf(line + len, "%d", n_regions) == 1) found = true;
+
+	fclose(file);
+	return found;
+}
+
+static void sim_autotune_save(const char *key, const int n_regions)
+{
+	FILE *file = fopen(AUTOTUNE_CACHE, "a");
+	if (!file)
+	{
+		fprintf(stderr, "Could not write the autotuning cache (%s)\n", AUTOTUNE_CACHE);
+		return;
+	}
+
+	fprintf(file, "%s %d\n", key, n_regions);
+	fclose(file);
+}
+
+// Average time per iteration of the current configuration (slowest process)
+static double sim_autotune_measure(t_simulation *sim)
+{
+	for (int k = 0; k < AUTOTUNE_WARMUP; k++)
+		sim_iter(sim);
+
+#ifdef ENABLE_TASKING
+	#pragma oss taskwait
+#endif
+	CHECK_MPI_ERROR(MPI_Barrier(MPI_COMM_WORLD));
+	uint64_t t0 = timer_ticks();
+
+	for (int k = 0; k < AUTOTUNE_ITER; k++)
+		sim_iter(sim);
+
+#ifdef ENABLE_TASKING
+	#pragma oss taskwait
+#endif
+	double time = timer_interval_seconds(t0, timer_ticks()) / AUTOTUNE_ITER;
+	CHECK_MPI_ERROR(MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD));
+	return time;
+}
+
+// Initialise the simulation with the number of regions per process with the lowest time per
+// iteration (the candidates are 1, n_threads, 2 * n_threads, ... regions). The root process saves
+// the choice in AUTOTUNE_CACHE, so the next runs skip the calibration
+void sim_autotune(t_simulation *sim)
+{
+	const int n_threads = sim_num_threads();
+	char key[256];
+	int best_regions = 1, found = 0;
+	double best_time = -1;
+
+	// A single region is always valid (the simulation name and size are only known afterwards)
+	sim_init(sim, 1);
+	sim_autotune_key(sim, key);
+
+	if (sim->proc_rank == ROOT) found = sim_autotune_load(key, &best_regions);
+	CHECK_MPI_ERROR(MPI_Bcast(&found, 1, MPI_INT, ROOT, MPI_COMM_WORLD));
+	CHECK_MPI_ERROR(MPI_Bcast(&best_regions, 1, MPI_INT, ROOT, MPI_COMM_WORLD));
+
+	if (!found)
+	{
+		// The processes with the smallest number of rows limit the number of regions
+		int min_ny = sim->proc_nx[1];
+		CHECK_MPI_ERROR(MPI_Allreduce(MPI_IN_PLACE, &min_ny, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD));
+
+		for (int n = 1; n <= AUTOTUNE_MAX_REGIONS_PER_THREAD * n_threads;
+				n = (n < n_threads) ? n_threads : 2 * n)
+		{
+			if (min_ny / n < AUTOTUNE_MIN_CELLS) break;
+
+			if (n > 1)
+			{
+				sim_delete(sim);
+				sim_init(sim, n);
+			}
+
+			const double time = sim_autotune_measure(sim);
+#ifndef TEST
+			if (sim->proc_rank == ROOT)
+				fprintf(stderr, "Autotune: %d regions per process: %f s/iteration\n", n, time);
+#endif
+			if (best_time < 0 || time < best_time)
+			{
+				best_time = time;
+				best_regions = n;
+			}
+		}
+
+		if (sim->proc_rank == ROOT) sim_autotune_save(key, best_regions);
+	}
+#ifndef TEST
+	else if (sim->proc_rank == ROOT)
+		fprintf(stderr, "Autotune: %d regions per process (from %s)\n", best_regions,
+				AUTOTUNE_CACHE);
+#endif
+
+	// Rebuild the simulation with the chosen configuration
+	if (sim->iter > 0 || sim->n_regions != best_regions)
+	{
+		sim_delete(sim);
+		sim_init(sim, best_regions);
+	}
+}
+
 /*********************************************************************************************
  Iteration
  *********************************************************************************************/
@@ -358,12 +513,18 @@ void sim_iter(t_simulation *sim)
 			emf_exchange_gc_y(&regions[i].local_emf, sim->adj_ranks_grid);
 	}
 
+	// Sort the particles every n_sort iterations
+	const bool sort = sim->n_sort > 0 && sim->iter % sim->n_sort == 0;
+
 	for (int i = 0; i < n_regions; i++)
 	{
 		emf_update_gc_y(&regions[i].local_emf);
 
 		for (int k = 0; k < regions[i].n_species; k++)
+		{
 			spec_receive_particles(&regions[i].species[k]);
+			if (sort) spec_sort(&regions[i].species[k], regions[i].limits);
+		}
 	}
 }
 
@@ -404,6 +565,30 @@ void sim_timings(t_simulation *sim, uint64_t t0, uint64_t t1)
 //	fprintf(stdout, "Time for spec. advance = %f s\n", spec_time() / n_threads); // Disable due to compatibility issues
 //	fprintf(stdout, "Time for emf   advance = %f s\n", emf_time() / n_threads); // Disable due to compatibility issues
 	fprintf(stdout, "Total simulation time  = %f s\n", timer_interval_seconds(t0, t1));
+
+	if (sim->n_sort > 0)
+	{
+		int n_sorts = 0;
+		double push_time = 0, sort_time = 0, push_time_saved = 0;
+
+		for (int j = 0; j < sim->n_regions; j++)
+		{
+			for (int i = 0; i < sim->regions[j].n_species; i++)
+			{
+				n_sorts += sim->regions[j].species[i].n_sorts;
+				push_time += sim->regions[j].species[i].push_time;
+				sort_time += sim->regions[j].species[i].sort_time;
+				push_time_saved += sim->regions[j].species[i].push_time_saved;
+			}
+		}
+
+		// Time accumulated over all the tasks of this process
+		fprintf(stdout, "Particle sort: every %d iterations (%d sorts)\n", sim->n_sort, n_sorts);
+		fprintf(stdout, "Time for spec. push = %f s\n", push_time);
+		fprintf(stdout, "Time for spec. sort = %f s\n", sort_time);
+		fprintf(stdout, "Estimated push time saved by sorting = %f s\n", push_time_saved);
+	}
+
 	fprintf(stdout, "\n");
 
 	// Disable due to compatibility issues
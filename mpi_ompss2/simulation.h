@@ -61,6 +61,9 @@ typedef struct {
 
 	int iter;
 
+	// Particle sorting frequency (0 - disabled)
+	int n_sort;
+
 } t_simulation;
 
 // Setup
@@ -68,10 +71,14 @@ void sim_new(t_simulation *sim, int nx[2], float box[2], float dt, float tmax, i
 		int n_species, char name[64], int n_regions);
 void sim_init(t_simulation *sim, int n_regions);
 void sim_set_moving_window(t_simulation *sim);
+void sim_set_sort(t_simulation *sim, const int n_sort);
 void sim_set_smooth(t_simulation *sim, t_smooth *smooth);
 void sim_add_laser(t_simulation *sim, t_emf_laser *laser);
 void sim_delete(t_simulation *sim);
 
+// Auto-tuning (number of regions)
+void sim_autotune(t_simulation *sim);
+
 // Iteration
 void sim_iter(t_simulation *sim);
 
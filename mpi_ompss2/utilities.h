@@ -11,6 +11,7 @@
 #define ROOT 0
 #define NUM_ADJ_PART 8
 #define NUM_ADJ_GRID 4
+#define TILE_SIZE 16
 
 // Direction in the 2D space (full, particles)
 enum part_direction {
@@ -16,38 +16,51 @@
 #include <string.h>
 
 #include "zdf.h"
+#include "timer.h"
+#include "memory.h"
+#include "simd.h"
 
 /*********************************************************************************************
  Constructor / Destructor
  *********************************************************************************************/
-void current_new(t_current *current, int nx[], t_fld box[], float dt)
+// Allocate the current buffer with the given number of guard cells (the rows are padded so that
+// each row starts aligned)
+static void current_alloc(t_current *current, const int gc[2][2])
 {
-	int i;
-
-	// Number of guard cells for linear interpolation
-	int gc[2][2] = { { 1, 2 }, { 1, 2 } };
-
-	// Allocate global array
-	size_t size;
-
-	size = (gc[0][0] + nx[0] + gc[0][1]) * (gc[1][0] + nx[1] + gc[1][1]);
-	current->total_size = size;
-	current->overlap_zone = (gc[0][0] + nx[0] + gc[0][1]) * (gc[1][0] + gc[1][1]);
+	current->nrow = mem_row_pitch(gc[0][0] + current->nx[0] + gc[0][1], sizeof(t_vfld));
+	current->total_size = current->nrow * (gc[1][0] + current->nx[1] + gc[1][1]);
+	current->overlap_zone = current->nrow * (gc[1][0] + gc[1][1]);
 
-	current->J_buf = calloc(size, sizeof(t_vfld));
-	assert(current->J_buf);
+	current->J_buf = mem_alloc_node(current->total_size * sizeof(t_vfld), MEM_CURRENT,
+			current->numa_node);
 
-	// store nx and gc values
-	for (i = 0; i < 2; i++)
+	// store gc values
+	for (int i = 0; i < 2; i++)
 	{
-		current->nx[i] = nx[i];
 		current->gc[i][0] = gc[i][0];
 		current->gc[i][1] = gc[i][1];
 	}
-	current->nrow = gc[0][0] + nx[0] + gc[0][1];
 
 	// Make J point to cell [0][0]
-	current->J = current->J_buf + gc[0][0] + gc[1][0] * current->nrow;
+	current->J = (t_fld*) current->J_buf + FLD_CELL(gc[0][0], gc[1][0], current->nrow);
+}
+
+void current_new(t_current *current, int nx[], t_fld box[], float dt, const int numa_node)
+{
+	int i;
+
+	// Number of guard cells for linear interpolation
+	int gc[2][2] = { { 1, 2 }, { 1, 2 } };
+
+	// store nx values and allocate global array
+	for (i = 0; i < 2; i++)
+		current->nx[i] = nx[i];
+
+	current->numa_node = numa_node;
+	current_alloc(current, gc);
+
+	// Filter kernels for the CPU
+	current_select_kernels();
 
 	// Set cell sizes and box limits
 	for (i = 0; i < 2; i++)
@@ -58,6 +71,8 @@ void current_new(t_current *current, int nx[], t_fld box[], float dt)
 
 	// Clear smoothing options
 	current->smooth = (t_smooth ) { .xtype = NONE, .ytype = NONE, .xlevel = 0, .ylevel = 0 };
+	current->smooth_time = 0.0;
+	current->smooth_buf = NULL;
 
 	// Initialize time information
 	current->iter = 0;
@@ -66,28 +81,59 @@ void current_new(t_current *current, int nx[], t_fld box[], float dt)
 	current->moving_window = 0;
 }
 
+// Set the smoothing options. The filter needs one guard cell for each pass on the left and bottom
+// edges (plus the 2 cells used by the field solver on the right and top edges), so the current
+// buffer is allocated again. The overlap zones must be updated afterwards
+void current_set_smooth(t_current *current, const t_smooth *smooth)
+{
+	const int passes[2] = {current_smooth_passes(smooth->xtype, smooth->xlevel),
+						   current_smooth_passes(smooth->ytype, smooth->ylevel)};
+	int gc[2][2];
+
+	for (int i = 0; i < 2; i++)
+	{
+		gc[i][0] = (passes[i] > 1) ? passes[i] : 1;
+		gc[i][1] = passes[i] + 2;
+	}
+
+	current->smooth = *smooth;
+
+	// Buffer for the lower row of each pass in y (with the guard cells used by the field solver)
+	mem_free(current->smooth_buf);
+	current->smooth_buf = (passes[1] > 0) ? mem_alloc_node(passes[1] * 3 * (current->nx[0] + 2)
+			* sizeof(t_fld), MEM_CURRENT, current->numa_node) : NULL;
+
+	if (gc[0][0] != current->gc[0][0] || gc[0][1] != current->gc[0][1]
+			|| gc[1][0] != current->gc[1][0] || gc[1][1] != current->gc[1][1])
+	{
+		mem_free(current->J_buf);
+		current_alloc(current, gc);
+	}
+}
+
 void current_delete(t_current *current)
 {
-	free(current->J_buf);
+	mem_free(current->J_buf);
 	current->J_buf = NULL;
+
+	mem_free(current->smooth_buf);
+	current->smooth_buf = NULL;
 }
 
 // Set the current buffer to zero
 void current_zero(t_current *current)
 {
 	// zero fields
-	size_t size;
-	size = (current->gc[0][0] + current->nx[0] + current->gc[0][1])
-			* (current->gc[1][0] + current->nx[1] + current->gc[1][1]) * sizeof(t_vfld);
-	memset(current->J_buf, 0, size);
+	memset(current->J_buf, 0, current->total_size * sizeof(t_vfld));
 
 }
 
-// Set the overlap zone between adjacent regions (only the below zone)
-void current_overlap_zone(t_current *current, t_current *current_below)
+// Set the overlap zone between adjacent regions (only the below and left zones). The overlap zone
+// below takes the rows [ny - gc[1][0], ny + gc[1][1]) of its buffer
+void current_overlap_zone(t_current *current, t_current *current_below, t_current *current_left)
 {
-	current->J_below = current_below->J
-			+ (current_below->nx[1] - current_below->gc[1][0]) * current_below->nrow;
+	current->J_below = current_below->J_buf + current_below->nx[1] * current_below->nrow;
+	current->left = current_left;
 }
 
 /*********************************************************************************************
@@ -98,68 +144,51 @@ void current_overlap_zone(t_current *current, t_current *current_below)
 void current_reduction_y(t_current *current)
 {
 	const int nrow = current->nrow;
-	t_vfld *restrict const J = current->J;
-	t_vfld *restrict const J_overlap = current->J_below;
 
-	for (int j = -current->gc[1][0]; j < current->gc[1][1]; j++)
+	// Cell [0][0] of the overlap zone below
+	const int offset = FLD_CELL(current->gc[0][0], 0, nrow);
+
+	for (int c = 0; c < 3; c++)
 	{
-		for (int i = -current->gc[0][0]; i < current->nx[0] + current->gc[0][1]; i++)
-		{
-			J[i + j * nrow].x += J_overlap[i + (j + current->gc[1][0]) * nrow].x;
-			J[i + j * nrow].y += J_overlap[i + (j + current->gc[1][0]) * nrow].y;
-			J[i + j * nrow].z += J_overlap[i + (j + current->gc[1][0]) * nrow].z;
+		t_fld *restrict const J = current->J + FLD_COMP(c, nrow);
+		t_fld *restrict const J_overlap = (t_fld*) current->J_below + offset + FLD_COMP(c, nrow);
 
-			J_overlap[i + (j + current->gc[1][0]) * nrow] = J[i + j * nrow];
+		for (int j = -current->gc[1][0]; j < current->gc[1][1]; j++)
+		{
+			for (int i = -current->gc[0][0]; i < current->nx[0] + current->gc[0][1]; i++)
+			{
+				J[FLD_CELL(i, j, nrow)] += J_overlap[FLD_CELL(i, j + current->gc[1][0], nrow)];
+				J_overlap[FLD_CELL(i, j + current->gc[1][0], nrow)] = J[FLD_CELL(i, j, nrow)];
+			}
 		}
 	}
 }
 
-// Current reduction between ghost cells in the x direction
+// Current reduction between ghost cells in the x direction. Each region is only responsible to do
+// the reduction operation in its left edge (the region on the left is the region itself if the
+// simulation box is not split along x)
 void current_reduction_x(t_current *current)
 {
-	if (current->moving_window) return;
-
 	const int nrow = current->nrow;
-	t_vfld *restrict const J = current->J;
-	t_vfld *restrict const J_overlap = &current->J[current->nx[0]];
+	const int nrow_left = current->left->nrow;
 
-	for (int j = -current->gc[1][0]; j < current->nx[1] + current->gc[1][1]; j++)
+	for (int c = 0; c < 3; c++)
 	{
-		for (int i = -current->gc[0][0]; i < current->gc[0][1]; i++)
-		{
-			J[i + j * nrow].x += J_overlap[i + j * nrow].x;
-			J[i + j * nrow].y += J_overlap[i + j * nrow].y;
-			J[i + j * nrow].z += J_overlap[i + j * nrow].z;
-
-			J_overlap[i + j * nrow] = J[i + j * nrow];
-		}
-	}
+		t_fld *const J = current->J + FLD_COMP(c, nrow);
+		t_fld *const J_overlap = current->left->J + FLD_CELL(current->left->nx[0], 0, nrow_left)
+				+ FLD_COMP(c, nrow_left);
 
-	current->iter++;
-}
-
-// Update the ghost cells in the y direction (only the bottom edge)
-void current_gc_update_y(t_current *current)
-{
-	const int nrow = current->nrow;
-	t_vfld *restrict const J = current->J;
-	t_vfld *restrict const J_overlap = current->J_below;
-
-	for (int j = -current->gc[1][0]; j < 0; j++)
-	{
-		for (int i = -current->gc[0][0]; i < current->nx[0] + current->gc[0][1]; i++)
+		for (int j = -current->gc[1][0]; j < current->nx[1] + current->gc[1][1]; j++)
 		{
-			J[i + j * nrow] = J_overlap[i + (j + current->gc[1][0]) * nrow];
+			for (int i = -current->gc[0][0]; i < current->gc[0][1]; i++)
+			{
+				J[FLD_CELL(i, j, nrow)] += J_overlap[FLD_CELL(i, j, nrow_left)];
+				J_overlap[FLD_CELL(i, j, nrow_left)] = J[FLD_CELL(i, j, nrow)];
+			}
 		}
 	}
 
-	for (int j = 0; j < current->gc[1][1]; j++)
-	{
-		for (int i = -current->gc[0][0]; i < current->nx[0] + current->gc[0][1]; i++)
-		{
-			J_overlap[i + (j + current->gc[1][0]) * nrow] = J[i + j * nrow];
-		}
-	}
+	current->iter++;
 }
 
 /*********************************************************************************************
@@ -179,131 +208,327 @@ void get_smooth_comp(int n, t_fld *sa, t_fld *sb)
 	*sb = b / total;
 }
 
-// Apply the filter in the x direction
-void kernel_x(t_current *const current, const t_fld sa, const t_fld sb)
+// Number of passes of the filter along one direction (binomial passes plus the compensator)
+int current_smooth_passes(const enum smooth_type type, const int level)
 {
-	int i, j;
-	t_vfld *restrict const J = current->J;
-	const int nrow = current->nrow;
-
-	for (j = 0; j < current->nx[1]; j++)
+	switch (type)
 	{
-		int idx = j * nrow;
-
-		t_vfld fl = J[idx - 1];
-		t_vfld f0 = J[idx];
+		case BINOMIAL:
+			return level;
+		case COMPENSATED:
+			return level + 1;
+		default:
+			return 0;
+	}
+}
 
-		for (i = 0; i < current->nx[0]; i++)
-		{
+// Kernel [sa, sb, sa] of the pass k of the filter along one direction (the last pass is the
+// compensator if the number of passes is larger than the level)
+static void smooth_kernel(const int level, const int k, t_fld *sa, t_fld *sb)
+{
+	if (k < level)
+	{
+		*sa = 0.25;
+		*sb = 0.5;
+	} else get_smooth_comp(level, sa, sb);
+}
 
-			t_vfld fu = J[idx + i + 1];
+// Apply a pass of the filter in the x direction to the cells [i0, i1) of a row
+static void smooth_pass_x_scalar(t_fld *restrict const row, const int nrow, const int i0,
+		const int i1, const t_fld sa, const t_fld sb)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		t_fld *restrict const f = row + FLD_COMP(c, nrow);
 
-			t_vfld fs;
+		t_fld fl = f[(i0 - 1) * FLD_STRIDE];
+		t_fld f0 = f[i0 * FLD_STRIDE];
 
-			fs.x = sa * fl.x + sb * f0.x + sa * fu.x;
-			fs.y = sa * fl.y + sb * f0.y + sa * fu.y;
-			fs.z = sa * fl.z + sb * f0.z + sa * fu.z;
+		for (int i = i0; i < i1; i++)
+		{
+			const t_fld fu = f[(i + 1) * FLD_STRIDE];
 
-			J[idx + i] = fs;
+			f[i * FLD_STRIDE] = sa * fl + sb * f0 + sa * fu;
 
 			fl = f0;
 			f0 = fu;
-
 		}
+	}
+}
+
+// Apply a pass of the filter in the y direction to the first n cells of a row. flbuf holds the
+// lower row before this pass (same layout as a row of n cells) and is updated with the current row
+static void smooth_pass_y_scalar(t_fld *restrict const row, const int nrow,
+		t_fld *restrict const flbuf, const int n, const t_fld sa, const t_fld sb)
+{
+	const int up = FLD_CELL(0, 1, nrow);
+
+	for (int c = 0; c < 3; c++)
+	{
+		t_fld *restrict const f = row + FLD_COMP(c, nrow);
+		t_fld *restrict const fl = flbuf + FLD_COMP(c, n);
 
-		// Update x boundaries unless we are using a moving window
-		if (!current->moving_window)
+		for (int i = 0; i < n * FLD_STRIDE; i += FLD_STRIDE)
 		{
-			for (i = -current->gc[0][0]; i < 0; i++)
-				J[idx + i] = J[idx + current->nx[0] + i];
+			// Get lower, central and upper values
+			const t_fld f_l = fl[i];
+			const t_fld f_0 = f[i];
+			const t_fld f_u = f[i + up];
+
+			// Store the value that will be overwritten for use in the next row
+			fl[i] = f_0;
 
-			for (i = 0; i < current->gc[0][1]; i++)
-				J[idx + current->nx[0] + i] = J[idx + i];
+			// Convolution with kernel
+			f[i] = sa * f_l + sb * f_0 + sa * f_u;
 		}
 	}
 }
 
-// Apply the filter in the y direction
-void kernel_y(t_current *const current, const t_fld sa, const t_fld sb)
-{
-	t_vfld flbuf[current->nx[0]];
-	t_vfld *restrict const J = current->J;
-	const int nrow = current->nrow;
+#ifdef SIMD_X86
 
-	int i, j;
+// AVX2 versions (8 values per iteration). A row is handled as 3 / FLD_STRIDE contiguous planes of
+// values (all the components of the cells in the default layout, one component in the planar
+// layout) and all the values of a plane are filtered in the same way: the neighbours of a value in
+// x are FLD_STRIDE positions away. The operations are the same as in the scalar kernels (no FMA),
+// so the results are bit-identical
+__attribute__((target("avx2")))
+static void smooth_pass_x_avx2(t_fld *restrict const row, const int nrow, const int i0,
+		const int i1, const t_fld sa, const t_fld sb)
+{
+	const __m256 va = _mm256_set1_ps(sa);
+	const __m256 vb = _mm256_set1_ps(sb);
+	const int s = FLD_STRIDE;
 
-	// buffer lower row
-	for (i = 0; i < current->nx[0]; i++)
+	for (int p = 0; p < 3 / FLD_STRIDE; p++)
 	{
-		flbuf[i] = J[i - nrow];
+		t_fld *restrict const f = row + FLD_COMP(p, nrow);
+		const int end = i1 * FLD_STRIDE;
+
+		// The filtered values of [k - 8, k) are stored after loading the values of the next
+		// iteration, which include the original values of [k - s, k)
+		__m256 pending = _mm256_setzero_ps();
+		bool has_pending = false;
+
+		int k = i0 * FLD_STRIDE;
+		for (; k + 8 <= end; k += 8)
+		{
+			const __m256 fl = _mm256_loadu_ps(f + k - s);
+			const __m256 f0 = _mm256_loadu_ps(f + k);
+			const __m256 fu = _mm256_loadu_ps(f + k + s);
+
+			if (has_pending) _mm256_storeu_ps(f + k - 8, pending);
+
+			pending = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(va, fl), _mm256_mul_ps(vb, f0)),
+					_mm256_mul_ps(va, fu));
+			has_pending = true;
+		}
+
+		// Remaining values, filtered from a copy of their original neighbours
+		const int n = end - k;
+		t_fld old[8 + 2 * FLD_STRIDE];
+		for (int t = 0; t < n + 2 * s; t++)
+			old[t] = f[k - s + t];
+
+		if (has_pending) _mm256_storeu_ps(f + k - 8, pending);
+
+		for (int t = 0; t < n; t++)
+			f[k + t] = sa * old[t] + sb * old[t + s] + sa * old[t + 2 * s];
 	}
+}
 
-	for (j = 0; j < current->nx[1]; j++)
-	{
+__attribute__((target("avx2")))
+static void smooth_pass_y_avx2(t_fld *restrict const row, const int nrow,
+		t_fld *restrict const flbuf, const int n, const t_fld sa, const t_fld sb)
+{
+	const __m256 va = _mm256_set1_ps(sa);
+	const __m256 vb = _mm256_set1_ps(sb);
+	const int up = FLD_CELL(0, 1, nrow);
+	const int size = n * FLD_STRIDE;
 
-		int idx = j * nrow;
+	for (int p = 0; p < 3 / FLD_STRIDE; p++)
+	{
+		t_fld *restrict const f = row + FLD_COMP(p, nrow);
+		t_fld *restrict const fl = flbuf + FLD_COMP(p, n);
 
-		for (i = 0; i < current->nx[0]; i++)
+		int k = 0;
+		for (; k + 8 <= size; k += 8)
 		{
+			const __m256 f_l = _mm256_loadu_ps(fl + k);
+			const __m256 f_0 = _mm256_loadu_ps(f + k);
+			const __m256 f_u = _mm256_loadu_ps(f + k + up);
 
-			// Get lower, central and below values
-			t_vfld fl = flbuf[i];
-			t_vfld f0 = J[idx + i];
-			t_vfld fu = J[idx + i + nrow];
-
-			// Store the value that will be overritten for use in the next row
-			flbuf[i] = f0;
+			_mm256_storeu_ps(fl + k, f_0);
+			_mm256_storeu_ps(f + k, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(va, f_l),
+					_mm256_mul_ps(vb, f_0)), _mm256_mul_ps(va, f_u)));
+		}
 
-			// Convolution with kernel
-			t_vfld fs;
-			fs.x = sa * fl.x + sb * f0.x + sa * fu.x;
-			fs.y = sa * fl.y + sb * f0.y + sa * fu.y;
-			fs.z = sa * fl.z + sb * f0.z + sa * fu.z;
+		for (; k < size; k++)
+		{
+			const t_fld f_l = fl[k];
+			const t_fld f_0 = f[k];
+			const t_fld f_u = f[k + up];
 
-			// Store result
-			J[idx + i] = fs;
+			fl[k] = f_0;
+			f[k] = sa * f_l + sb * f_0 + sa * f_u;
 		}
 	}
 }
 
-// Apply multiple passes of a binomial filter to reduce noise (X direction).
-// Then, pass a compensation filter (if applicable)
-void current_smooth_x(t_current *current)
+#endif
+
+// Filter kernels, selected for the CPU (see current_select_kernels)
+typedef void (*t_smooth_x_kernel)(t_fld *restrict const row, const int nrow, const int i0,
+		const int i1, const t_fld sa, const t_fld sb);
+typedef void (*t_smooth_y_kernel)(t_fld *restrict const row, const int nrow,
+		t_fld *restrict const flbuf, const int n, const t_fld sa, const t_fld sb);
+
+static t_smooth_x_kernel smooth_pass_x = smooth_pass_x_scalar;
+static t_smooth_y_kernel smooth_pass_y = smooth_pass_y_scalar;
+static const char *smooth_kernel_name = "scalar";
+
+// Select the filter kernels for the current CPU (can be overridden with ZPIC_SIMD=scalar)
+void current_select_kernels(void)
 {
-	// filter kernel [sa, sb, sa]
-	t_fld sa, sb;
+	smooth_pass_x = smooth_pass_x_scalar;
+	smooth_pass_y = smooth_pass_y_scalar;
+	smooth_kernel_name = "scalar";
 
-	// binomial filter
-	for (int i = 0; i < current->smooth.xlevel; i++)
-		kernel_x(current, 0.25, 0.5);
+#ifdef SIMD_X86
+	if (simd_select_isa() != SIMD_SCALAR)
+	{
+		smooth_pass_x = smooth_pass_x_avx2;
+		smooth_pass_y = smooth_pass_y_avx2;
+		smooth_kernel_name = "AVX2 (8 values/iteration)";
+	}
+#endif
+}
+
+// Name of the filter kernels in use
+const char* current_kernel_name(void)
+{
+	return smooth_kernel_name;
+}
 
-	// Compensator
-	if (current->smooth.xtype == COMPENSATED)
+// Apply all the passes of the filter in the x direction to a row. Each pass updates one cell less
+// on each side, so the last pass updates the cells [begin, end)
+static void smooth_row_x(t_fld *restrict const row, const int nrow, const t_smooth *smooth,
+		const int n_passes, const int begin, const int end, const bool left_gc, const bool right_gc)
+{
+	for (int k = 0; k < n_passes; k++)
 	{
-		get_smooth_comp(current->smooth.xlevel, &sa, &sb);
-		kernel_x(current, sa, sb);
+		t_fld sa, sb;
+		smooth_kernel(smooth->xlevel, k, &sa, &sb);
+
+		// Without a neighbour region the ghost cells are not filtered
+		const int i0 = left_gc ? begin - (n_passes - 1 - k) : begin;
+		const int i1 = right_gc ? end + (n_passes - 1 - k) : end;
+
+		smooth_pass_x(row, nrow, i0, i1, sa, sb);
 	}
 }
 
-// Apply a binomial filter to reduce noise (Y direction).
-// Or, apply a compensation filter (if applicable)
-void current_smooth_y(t_current *current, enum smooth_type type)
+// Copy n cells of a row to the buffer of the lower row of a pass in y (see smooth_pass_y)
+static void smooth_load_row(const t_fld *restrict const row, const int nrow,
+		t_fld *restrict const flbuf, const int n)
+{
+	for (int p = 0; p < 3 / FLD_STRIDE; p++)
+		memcpy(flbuf + FLD_COMP(p, n), row + FLD_COMP(p, nrow), n * FLD_STRIDE * sizeof(t_fld));
+}
+
+// Filter benchmark: one pass of a kernel (binomial) over the rows of a copy of the region current
+typedef struct {
+	t_fld *J, *flbuf;
+	int nrow, nx, ny;
+} t_smooth_bench;
+
+static void smooth_bench_x(void *arg)
 {
-	// filter kernel [sa, sb, sa]
-	t_fld sa, sb;
+	const t_smooth_bench *bench = arg;
 
-	switch (type)
+	for (int j = 0; j < bench->ny; j++)
+		smooth_pass_x(bench->J + FLD_CELL(0, j, bench->nrow), bench->nrow, 0, bench->nx, 0.25f,
+				0.5f);
+}
+
+static void smooth_bench_y(void *arg)
+{
+	const t_smooth_bench *bench = arg;
+
+	smooth_load_row(bench->J + FLD_CELL(0, -1, bench->nrow), bench->nrow, bench->flbuf, bench->nx);
+	for (int j = 0; j < bench->ny; j++)
+		smooth_pass_y(bench->J + FLD_CELL(0, j, bench->nrow), bench->nrow, bench->flbuf, bench->nx,
+				0.25f, 0.5f);
+}
+
+void current_bench_kernels(const t_current *current, double bandwidth[2])
+{
+	const size_t size = current->total_size * sizeof(t_vfld);
+
+	t_vfld *J_buf = mem_alloc(size, MEM_CURRENT);
+	memcpy(J_buf, current->J_buf, size);
+
+	t_smooth_bench bench;
+	bench.J = (t_fld*) J_buf + (current->J - (t_fld*) current->J_buf);
+	bench.flbuf = malloc(3 * current->nx[0] * sizeof(t_fld));
+	bench.nrow = current->nrow;
+	bench.nx = current->nx[0];
+	bench.ny = current->nx[1];
+
+	// Each value is loaded and stored once (the lower row buffer and the upper row are in cache)
+	const double bytes = (double) bench.nx * bench.ny * 6 * sizeof(t_fld);
+
+	bandwidth[0] = bytes / timer_bench(smooth_bench_x, &bench) / 1E9;
+	bandwidth[1] = bytes / timer_bench(smooth_bench_y, &bench) / 1E9;
+
+	free(bench.flbuf);
+	mem_free(J_buf);
+}
+
+// Apply all the passes of the filter (binomial passes and compensator in x and then in y) in a
+// single sweep over the rows. Row r is filtered in x and then pass k in y is applied to row r - k,
+// so only a window of n_passes_y + 2 rows is in use at any time. The guard cells, updated by the
+// current reduction, hold one cell for each pass and the filter is also applied to them, so the
+// result is valid in the cells used by the field solver ([0, nx + 2) in each direction) without
+// updating the guard cells between passes. left_gc / right_gc are false if the guard cells in that
+// edge do not belong to other region (moving window)
+void current_smooth(t_current *current, const bool left_gc, const bool right_gc)
+{
+	const uint64_t t0 = timer_ticks();
+
+	const t_smooth *smooth = &current->smooth;
+	const int nrow = current->nrow;
+	const int n_passes_x = current_smooth_passes(smooth->xtype, smooth->xlevel);
+	const int n_passes_y = current_smooth_passes(smooth->ytype, smooth->ylevel);
+	t_fld *restrict const J = current->J;
+
+	// Cells needed by the field solver
+	const int nx = right_gc ? current->nx[0] + 2 : current->nx[0];
+	const int ny = current->nx[1] + 2;
+
+	// Lower row of each pass in y (allocated in current_set_smooth)
+	t_fld *restrict const flbuf = current->smooth_buf;
+
+	for (int r = -n_passes_y; r < ny + n_passes_y; r++)
 	{
-		case BINOMIAL:
-			kernel_y(current, 0.25, 0.5);
-			break;
-		case COMPENSATED:
-			get_smooth_comp(current->smooth.ylevel, &sa, &sb);
-			kernel_y(current, sa, sb);
-			break;
-		default:
-			break;
+		smooth_row_x(J + FLD_CELL(0, r, nrow), nrow, smooth, n_passes_x, 0, nx, left_gc, right_gc);
+
+		for (int k = 0; k < n_passes_y; k++)
+		{
+			// Rows updated by this pass
+			const int j = r - k - 1;
+			const int j0 = -(n_passes_y - 1 - k);
+			const int j1 = ny + (n_passes_y - 1 - k);
+			if (j < j0 || j >= j1) continue;
+
+			t_fld sa, sb;
+			smooth_kernel(smooth->ylevel, k, &sa, &sb);
+
+			if (j == j0) smooth_load_row(J + FLD_CELL(0, j - 1, nrow), nrow, flbuf + 3 * k * nx, nx);
+			smooth_pass_y(J + FLD_CELL(0, j, nrow), nrow, flbuf + 3 * k * nx, nx, sa, sb);
+		}
 	}
+
+	current->smooth_time += timer_interval_seconds(t0, timer_ticks());
 }
 
 /*********************************************************************************************
@@ -311,47 +536,20 @@ void current_smooth_y(t_current *current, enum smooth_type type)
  *********************************************************************************************/
 
 // Reconstruct the simulation grid from all the regions (electric current for a given coordinate)
-void current_reconstruct_global_buffer(t_current *current, float *global_buffer, const int offset,
-		const int jc)
+void current_reconstruct_global_buffer(t_current *current, float *global_buffer, const int offset_x,
+		const int offset_y, const int global_nx, const int jc)
 {
-	t_vfld *restrict f = current->J;
-	float *restrict p = global_buffer + offset * current->nx[0];
+	if (jc < 0 || jc > 2) return;
 
-	switch (jc)
+	const t_fld *restrict f = current->J + FLD_COMP(jc, current->nrow);
+	float *restrict p = global_buffer + offset_x + offset_y * global_nx;
+
+	for (int j = 0; j < current->nx[1]; j++)
 	{
-		case 0:
-			for (int j = 0; j < current->nx[1]; j++)
-			{
-				for (int i = 0; i < current->nx[0]; i++)
-				{
-					p[i] = f[i].x;
-				}
-				p += current->nx[0];
-				f += current->nrow;
-			}
-			break;
-		case 1:
-			for (int j = 0; j < current->nx[1]; j++)
-			{
-				for (int i = 0; i < current->nx[0]; i++)
-				{
-					p[i] = f[i].y;
-				}
-				p += current->nx[0];
-				f += current->nrow;
-			}
-			break;
-		case 2:
-			for (int j = 0; j < current->nx[1]; j++)
-			{
-				for (int i = 0; i < current->nx[0]; i++)
-				{
-					p[i] = f[i].z;
-				}
-				p += current->nx[0];
-				f += current->nrow;
-			}
-			break;
+		for (int i = 0; i < current->nx[0]; i++)
+			p[i] = f[FLD_CELL(i, j, current->nrow)];
+
+		p += global_nx;
 	}
 }
 
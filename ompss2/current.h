@@ -25,9 +25,10 @@ typedef struct {
 	int xlevel, ylevel;
 } t_smooth;
 
-typedef struct {
+typedef struct Current {
 
-	t_vfld *J;
+	// Cell [0][0] of J (see FLD_CELL)
+	t_fld *J;
 
 	t_vfld *J_buf;
 
@@ -38,14 +39,19 @@ typedef struct {
 	int total_size;
 	int overlap_zone;
 
+	// NUMA node where the buffer is allocated
+	int numa_node;
+
 	// Box size
 	t_fld box[2];
 
 	// Cell size
 	t_fld dx[2];
 
-	// Current smoothing
+	// Current smoothing (and time spent in the filter)
 	t_smooth smooth;
+	double smooth_time;
+	t_fld *smooth_buf;	// Lower row of each pass in y (see current_smooth)
 
 	// Time step
 	float dt;
@@ -56,20 +62,33 @@ typedef struct {
 	// Moving window
 	bool moving_window;
 
-	// Pointer to the overlap zone (in the current buffer) in the region below
+	// Overlap zone in the current buffer of the region below (its first row, including the padding)
 	// overlap zone = ghost cells (DOWN) + ghost cells (UP from below region)
 	t_vfld *J_below;
 
+	// Current of the region on the left (overlap zone in x)
+	struct Current *left;
+
 } t_current;
 
 // Setup
-void current_new(t_current *current, int nx[], t_fld box[], float dt);
+void current_new(t_current *current, int nx[], t_fld box[], float dt, const int numa_node);
 void current_delete(t_current *current);
-void current_overlap_zone(t_current *current, t_current *upper_current);
+void current_overlap_zone(t_current *current, t_current *current_below, t_current *current_left);
+void current_set_smooth(t_current *current, const t_smooth *smooth);
+int current_smooth_passes(const enum smooth_type type, const int level);
+
+// Filter kernels (AVX2 with ENABLE_SIMD, otherwise scalar)
+void current_select_kernels(void);
+const char* current_kernel_name(void);
+
+// Bandwidth (GB/s) of one pass of the filter in x [0] and in y [1], in one thread over a copy of
+// the region current
+void current_bench_kernels(const t_current *current, double bandwidth[2]);
 
 // Report ZDF
-void current_reconstruct_global_buffer(t_current *current, float *global_buffer, const int offset,
-		const int jc);
+void current_reconstruct_global_buffer(t_current *current, float *global_buffer, const int offset_x,
+		const int offset_y, const int global_nx, const int jc);
 void current_report(const float *restrict global_buffer, const int iter_num, const int true_nx[2],
 		const float box[2], const float dt, const char jc, const char path[128]);
 
@@ -78,22 +97,16 @@ void current_report(const float *restrict global_buffer, const int iter_num, con
 void current_zero(t_current *current);
 
 #pragma oss task inout(current->J_buf[0; current->overlap_zone]) \
-inout(current->J_below[-current->gc[0][0]; current->overlap_zone]) \
+inout(current->J_below[0; current->overlap_zone]) \
 label("Current Reduction Y")
 void current_reduction_y(t_current *current); // Each region only update the zone in the top edge
 
-#pragma oss task inout(current->J_buf[0; current->total_size]) label("Current Reduction X")
-void current_reduction_x(t_current *current);
-
-#pragma oss task inout(current->J_buf[0; current->overlap_zone]) \
-inout(current->J_below[-current->gc[0][0]; current->overlap_zone]) \
-label("Current Update GC")
-void current_gc_update_y(t_current *current); // Each region only update the zone in the top edge
-
-#pragma oss task inout(current->J_buf[0; current->total_size]) label("Current Smooth X")
-void current_smooth_x(t_current *current);
+#pragma oss task inout(current->J_buf[0; current->total_size]) \
+inout(current->left->J_buf[0; current->left->total_size]) \
+label("Current Reduction X")
+void current_reduction_x(t_current *current); // Each region only update the zone in the left edge
 
-#pragma oss task inout(current->J_buf[0; current->total_size]) label("Current Smooth Y")
-void current_smooth_y(t_current *current, enum smooth_type type);
+#pragma oss task inout(current->J_buf[0; current->total_size]) label("Current Smooth")
+void current_smooth(t_current *current, const bool left_gc, const bool right_gc);
 
 #endif
@@ -18,32 +18,31 @@
 #include "emf.h"
 #include "zdf.h"
 #include "timer.h"
+#include "memory.h"
+#include "simd.h"
 
 /*********************************************************************************************
  Constructor / Destructor
  *********************************************************************************************/
-void emf_new(t_emf *emf, int nx[], t_fld box[], const float dt)
+void emf_new(t_emf *emf, int nx[], t_fld box[], const float dt, const int numa_node)
 {
 	int i;
 
 	// Number of guard cells for linear interpolation
 	int gc[2][2] = { { 1, 2 }, { 1, 2 } };
 
-	// Allocate global arrays
+	// Allocate global arrays (the rows are padded so that each row starts aligned)
 	size_t size;
 
-	size = (gc[0][0] + nx[0] + gc[0][1]) * (gc[1][0] + nx[1] + gc[1][1]) * sizeof(t_vfld);
-	emf->total_size = (gc[0][0] + nx[0] + gc[0][1]) * (gc[1][0] + nx[1] + gc[1][1]);
-	emf->overlap = (gc[0][0] + nx[0] + gc[0][1]) * (gc[1][0] + gc[1][1]);
+	emf->nrow = mem_row_pitch(gc[0][0] + nx[0] + gc[0][1], sizeof(t_vfld));
+	emf->total_size = emf->nrow * (gc[1][0] + nx[1] + gc[1][1]);
+	emf->overlap = emf->nrow * (gc[1][0] + gc[1][1]);
+	size = emf->total_size * sizeof(t_vfld);
 
-	emf->E_buf = malloc(size);
-	emf->B_buf = malloc(size);
-
-	assert(emf->E_buf && emf->B_buf);
-
-	// zero fields
-	memset(emf->E_buf, 0, size);
-	memset(emf->B_buf, 0, size);
+	// Zeroed fields, placed in the NUMA node of the region
+	emf->E_buf = mem_alloc_node(size, MEM_FIELDS, numa_node);
+	emf->B_buf = mem_alloc_node(size, MEM_FIELDS, numa_node);
+	emf->numa_node = numa_node;
 
 	// store nx and gc values
 	for (i = 0; i < 2; i++)
@@ -52,14 +51,16 @@ void emf_new(t_emf *emf, int nx[], t_fld box[], const float dt)
 		emf->gc[i][0] = gc[i][0];
 		emf->gc[i][1] = gc[i][1];
 	}
-	emf->nrow = gc[0][0] + nx[0] + gc[0][1];
 
 	// store time step values
 	emf->dt = dt;
 
 	// Make E and B point to cell [0][0]
-	emf->E = emf->E_buf + gc[0][0] + gc[1][0] * emf->nrow;
-	emf->B = emf->B_buf + gc[0][0] + gc[1][0] * emf->nrow;
+	emf->E = (t_fld*) emf->E_buf + FLD_CELL(gc[0][0], gc[1][0], emf->nrow);
+	emf->B = (t_fld*) emf->B_buf + FLD_CELL(gc[0][0], gc[1][0], emf->nrow);
+
+	// Field solver kernels for the CPU
+	emf_select_kernels();
 
 	// Set cell sizes and box limits
 	for (i = 0; i < 2; i++)
@@ -77,19 +78,82 @@ void emf_new(t_emf *emf, int nx[], t_fld box[], const float dt)
 	// Reset moving window information
 	emf->moving_window = false;
 	emf->n_move = 0;
+	emf->window_shift = 0;
+	emf->window_slack = 0;
+}
+
+// Set the overlap zone between regions (below and left zones only). The overlap zone below is
+// given by the rows [ny - gc[1][0], ny + gc[1][1]) of the buffers, which do not change when the
+// window moves, so it can be used in the dependencies of the tasks
+void emf_overlap_zone(t_emf *emf, t_emf *below, t_emf *left)
+{
+	emf->B_below = below->B_buf + below->nx[1] * below->nrow;
+	emf->E_below = below->E_buf + below->nx[1] * below->nrow;
+	emf->left = left;
 }
 
-// Set the overlap zone between regions (below zone only)
-void emf_overlap_zone(t_emf *emf, t_emf *below)
+// Copy n_rows rows of E and B (including the guard cells in x) between two regions
+void emf_copy_rows(t_emf *dst, const int dst_row, const t_emf *src, const int src_row,
+		const int n_rows)
 {
-	emf->B_below = below->B + (below->nx[1] - below->gc[1][0]) * below->nrow;
-	emf->E_below = below->E + (below->nx[1] - below->gc[1][0]) * below->nrow;
+	assert(dst->nx[0] == src->nx[0]);
+
+	for (int j = 0; j < n_rows; j++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			t_fld *restrict const dst_E = dst->E + FLD_CELL(0, dst_row + j, dst->nrow)
+					+ FLD_COMP(c, dst->nrow);
+			t_fld *restrict const dst_B = dst->B + FLD_CELL(0, dst_row + j, dst->nrow)
+					+ FLD_COMP(c, dst->nrow);
+			const t_fld *restrict const src_E = src->E + FLD_CELL(0, src_row + j, src->nrow)
+					+ FLD_COMP(c, src->nrow);
+			const t_fld *restrict const src_B = src->B + FLD_CELL(0, src_row + j, src->nrow)
+					+ FLD_COMP(c, src->nrow);
+
+			for (int i = -dst->gc[0][0]; i < dst->nx[0] + dst->gc[0][1]; i++)
+			{
+				dst_E[i * FLD_STRIDE] = src_E[i * FLD_STRIDE];
+				dst_B[i * FLD_STRIDE] = src_B[i * FLD_STRIDE];
+			}
+		}
+	}
+}
+
+// Set the moving window. The rows are padded with (at least) slack cells, so the window can move
+// slack cells by moving the origin of E and B instead of the fields (see emf_move_window). All the
+// regions must use the same slack. The fields are copied to new buffers if the rows are too short
+void emf_set_moving_window(t_emf *emf, const int slack)
+{
+	emf->moving_window = true;
+	emf->window_slack = slack;
+
+	const int nrow = mem_row_pitch(emf->gc[0][0] + emf->nx[0] + emf->gc[0][1] + slack,
+			sizeof(t_vfld));
+	if (nrow == emf->nrow) return;
+
+	t_emf old = *emf;
+
+	emf->nrow = nrow;
+	emf->total_size = nrow * (emf->gc[1][0] + emf->nx[1] + emf->gc[1][1]);
+	emf->overlap = nrow * (emf->gc[1][0] + emf->gc[1][1]);
+
+	const size_t size = emf->total_size * sizeof(t_vfld);
+	emf->E_buf = mem_alloc_node(size, MEM_FIELDS, emf->numa_node);
+	emf->B_buf = mem_alloc_node(size, MEM_FIELDS, emf->numa_node);
+	emf->E = (t_fld*) emf->E_buf + FLD_CELL(emf->gc[0][0], emf->gc[1][0], nrow);
+	emf->B = (t_fld*) emf->B_buf + FLD_CELL(emf->gc[0][0], emf->gc[1][0], nrow);
+	emf->window_shift = 0;
+
+	emf_copy_rows(emf, -emf->gc[1][0], &old, -old.gc[1][0],
+			emf->gc[1][0] + emf->nx[1] + emf->gc[1][1]);
+	emf_delete(&old);
 }
 
 void emf_delete(t_emf *emf)
 {
-	free(emf->E_buf);
-	free(emf->B_buf);
+	mem_free(emf->E_buf);
+	mem_free(emf->B_buf);
 
 	emf->E_buf = NULL;
 	emf->B_buf = NULL;
@@ -140,33 +204,38 @@ t_fld lon_env(const t_emf_laser *const laser, const t_fld z)
 	return 0.0;
 }
 
-void div_corr_x(t_emf *emf)
+// Set the x component of E and B from the divergence of the other components (integrated from
+// the right edge of the simulation box). The integral continues from the first column of the
+// region on the right (NULL for the right edge)
+void div_corr_x(t_emf *emf, const t_emf *right)
 {
 	int i, j;
 
 	double ex, bx;
 
-	t_vfld *restrict E = emf->E;
-	t_vfld *restrict B = emf->B;
 	const int nrow = emf->nrow;
+	t_fld *restrict const Ex = emf->E;
+	t_fld *restrict const Bx = emf->B;
+	const t_fld *restrict const Ey = emf->E + FLD_COMP(1, nrow);
+	const t_fld *restrict const By = emf->B + FLD_COMP(1, nrow);
 	const double dx_dy = emf->dx[0] / emf->dx[1];
 
 	for (j = 0; j < emf->nx[1]; j++)
 	{
-		ex = 0.0;
-		bx = 0.0;
+		ex = right ? right->E[FLD_CELL(0, j, right->nrow)] : 0.0;
+		bx = right ? right->B[FLD_CELL(0, j, right->nrow)] : 0.0;
 		for (i = emf->nx[0] - 1; i >= 0; i--)
 		{
-			ex += dx_dy * (E[i + 1 + j * nrow].y - E[i + 1 + (j - 1) * nrow].y);
-			E[i + j * nrow].x = ex;
+			ex += dx_dy * (Ey[FLD_CELL(i + 1, j, nrow)] - Ey[FLD_CELL(i + 1, j - 1, nrow)]);
+			Ex[FLD_CELL(i, j, nrow)] = ex;
 
-			bx += dx_dy * (B[i + (j + 1) * nrow].y - B[i + j * nrow].y);
-			B[i + j * nrow].x = bx;
+			bx += dx_dy * (By[FLD_CELL(i, j + 1, nrow)] - By[FLD_CELL(i, j, nrow)]);
+			Bx[FLD_CELL(i, j, nrow)] = bx;
 		}
 	}
 }
 
-void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y)
+void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_x, int offset_y)
 {
 	// Validate laser parameters
 	if (laser->fwhm != 0)
@@ -208,10 +277,13 @@ void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y)
 	t_fld dx, dy;
 	t_fld cos_pol, sin_pol;
 
-	t_vfld *restrict E = emf->E;
-	t_vfld *restrict B = emf->B;
-
 	nrow = emf->nrow;
+
+	t_fld *restrict const Ey = emf->E + FLD_COMP(1, nrow);
+	t_fld *restrict const Ez = emf->E + FLD_COMP(2, nrow);
+	t_fld *restrict const By = emf->B + FLD_COMP(1, nrow);
+	t_fld *restrict const Bz = emf->B + FLD_COMP(2, nrow);
+
 	dx = emf->dx[0];
 	dy = emf->dx[1];
 
@@ -228,7 +300,7 @@ void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y)
 
 			for (i = 0; i < emf->nx[0]; i++)
 			{
-				z = i * dx;
+				z = (i + offset_x) * dx;
 				z_2 = z + dx / 2;
 
 				lenv = amp * lon_env(laser, z);
@@ -236,13 +308,13 @@ void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y)
 
 				for (j = 0; j < emf->nx[1]; j++)
 				{
-					// E[i + j*nrow].x += 0.0
-					E[i + j * nrow].y += +lenv * cos(k * z) * cos_pol;
-					E[i + j * nrow].z += +lenv * cos(k * z) * sin_pol;
+					// Ex[FLD_CELL(i, j, nrow)] += 0.0
+					Ey[FLD_CELL(i, j, nrow)] += +lenv * cos(k * z) * cos_pol;
+					Ez[FLD_CELL(i, j, nrow)] += +lenv * cos(k * z) * sin_pol;
 
-					// E[i + j*nrow].x += 0.0
-					B[i + j * nrow].y += -lenv_2 * cos(k * z_2) * sin_pol;
-					B[i + j * nrow].z += +lenv_2 * cos(k * z_2) * cos_pol;
+					// Bx[FLD_CELL(i, j, nrow)] += 0.0
+					By[FLD_CELL(i, j, nrow)] += -lenv_2 * cos(k * z_2) * sin_pol;
+					Bz[FLD_CELL(i, j, nrow)] += +lenv_2 * cos(k * z_2) * cos_pol;
 				}
 			}
 			break;
@@ -251,7 +323,7 @@ void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y)
 
 			for (i = 0; i < emf->nx[0]; i++)
 			{
-				z = i * dx;
+				z = (i + offset_x) * dx;
 				z_2 = z + dx / 2;
 
 				lenv = amp * lon_env(laser, z);
@@ -262,13 +334,13 @@ void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y)
 					r = (j + offset_y) * dy - r_center;
 					r_2 = r + dy / 2;
 
-					// E[i + j*nrow].x += 0.0
-					E[i + j * nrow].y += +lenv * gauss_phase(laser, z, r_2) * cos_pol;
-					E[i + j * nrow].z += +lenv * gauss_phase(laser, z, r) * sin_pol;
+					// Ex[FLD_CELL(i, j, nrow)] += 0.0
+					Ey[FLD_CELL(i, j, nrow)] += +lenv * gauss_phase(laser, z, r_2) * cos_pol;
+					Ez[FLD_CELL(i, j, nrow)] += +lenv * gauss_phase(laser, z, r) * sin_pol;
 
-					// B[i + j*nrow].x += 0.0
-					B[i + j * nrow].y += -lenv_2 * gauss_phase(laser, z_2, r) * sin_pol;
-					B[i + j * nrow].z += +lenv_2 * gauss_phase(laser, z_2, r_2) * cos_pol;
+					// Bx[FLD_CELL(i, j, nrow)] += 0.0
+					By[FLD_CELL(i, j, nrow)] += -lenv_2 * gauss_phase(laser, z_2, r) * sin_pol;
+					Bz[FLD_CELL(i, j, nrow)] += +lenv_2 * gauss_phase(laser, z_2, r_2) * cos_pol;
 
 				}
 			}
@@ -283,10 +355,10 @@ void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y)
  *********************************************************************************************/
 
 // Reconstruct the simulation grid from all regions (eletric/magnetic field for a given direction)
-void emf_reconstruct_global_buffer(const t_emf *emf, float *global_buffer, const int offset,
-		const char field, const char fc)
+void emf_reconstruct_global_buffer(const t_emf *emf, float *global_buffer, const int offset_x,
+		const int offset_y, const int global_nx, const char field, const char fc)
 {
-	t_vfld *restrict f = NULL;
+	const t_fld *restrict f = NULL;
 
 	switch (field)
 	{
@@ -298,49 +370,24 @@ void emf_reconstruct_global_buffer(const t_emf *emf, float *global_buffer, const
 			break;
 		default:
 			fprintf(stderr, "Invalid field type selected, returning\n");
-			break;
+			return;
 	}
 
-	float *restrict p = global_buffer + offset * emf->nx[0];
+	if (fc < 0 || fc > 2)
+	{
+		fprintf(stderr, "Invalid field component selected, returning\n");
+		return;
+	}
 
-	switch (fc)
+	f += FLD_COMP(fc, emf->nrow);
+	float *restrict p = global_buffer + offset_x + offset_y * global_nx;
+
+	for (int j = 0; j < emf->nx[1]; j++)
 	{
-		case 0:
-			for (int j = 0; j < emf->nx[1]; j++)
-			{
-				for (int i = 0; i < emf->nx[0]; i++)
-				{
-					p[i] = f[i].x;
-				}
-				p += emf->nx[0];
-				f += emf->nrow;
-			}
-			break;
-		case 1:
-			for (int j = 0; j < emf->nx[1]; j++)
-			{
-				for (int i = 0; i < emf->nx[0]; i++)
-				{
-					p[i] = f[i].y;
-				}
-				p += emf->nx[0];
-				f += emf->nrow;
-			}
-			break;
-		case 2:
-			for (int j = 0; j < emf->nx[1]; j++)
-			{
-				for (int i = 0; i < emf->nx[0]; i++)
-				{
-					p[i] = f[i].z;
-				}
-				p += emf->nx[0];
-				f += emf->nrow;
-			}
-			break;
-		default:
-			fprintf(stderr, "Invalid field component selected, returning\n");
-			return;
+		for (int i = 0; i < emf->nx[0]; i++)
+			p[i] = f[FLD_CELL(i, j, emf->nrow)];
+
+		p += global_nx;
 	}
 }
 
@@ -401,18 +448,27 @@ void emf_report(const float *restrict global_buffer, const float box[2], const i
 // Calculate the EMF energy
 double emf_get_energy(t_emf *emf)
 {
-	t_vfld *const restrict E = emf->E;
-	t_vfld *const restrict B = emf->B;
+	const int nrow = emf->nrow;
+	const t_fld *const restrict Ex = emf->E;
+	const t_fld *const restrict Ey = emf->E + FLD_COMP(1, nrow);
+	const t_fld *const restrict Ez = emf->E + FLD_COMP(2, nrow);
+	const t_fld *const restrict Bx = emf->B;
+	const t_fld *const restrict By = emf->B + FLD_COMP(1, nrow);
+	const t_fld *const restrict Bz = emf->B + FLD_COMP(2, nrow);
 	double result = 0;
 
-	for (unsigned int i = 0; i < emf->nx[0] * emf->nx[1]; i++)
+	// Only the cells inside the region (the ghost cells belong to the adjacent regions)
+	for (int j = 0; j < emf->nx[1]; j++)
 	{
-		result += 2 * E[i].x * E[i].x;
-		result += E[i].y * E[i].y;
-		result += E[i].z * E[i].z;
-		result += B[i].x * B[i].x;
-		result += B[i].y * B[i].y;
-		result += B[i].z * B[i].z;
+		for (int i = FLD_CELL(0, j, nrow); i < FLD_CELL(emf->nx[0], j, nrow); i += FLD_STRIDE)
+		{
+			result += 2 * Ex[i] * Ex[i];
+			result += Ey[i] * Ey[i];
+			result += Ez[i] * Ez[i];
+			result += Bx[i] * Bx[i];
+			result += By[i] * By[i];
+			result += Bz[i] * Bz[i];
+		}
 	}
 
 	return result * 0.5 * emf->dx[0] * emf->dx[1];
@@ -422,107 +478,312 @@ double emf_get_energy(t_emf *emf)
  Field solver
  *********************************************************************************************/
 
-void yee_b(t_emf *emf, const float dt)
+// Advance B in the cells [begin, end) of a row. The x stride of the components is FLD_STRIDE, so
+// the loop has unit stride loads and stores with ENABLE_PLANAR_FIELDS
+static void yee_b_row_scalar(t_fld *restrict const B, const t_fld *restrict const E,
+		const int nrow, const int begin, const int end, const t_fld dt_dx, const t_fld dt_dy)
 {
-	// these must not be unsigned because we access negative cell indexes
-	int i, j;
-	t_fld dt_dx, dt_dy;
+	t_fld *restrict const Bx = B;
+	t_fld *restrict const By = B + FLD_COMP(1, nrow);
+	t_fld *restrict const Bz = B + FLD_COMP(2, nrow);
+	const t_fld *restrict const Ex = E;
+	const t_fld *restrict const Ey = E + FLD_COMP(1, nrow);
+	const t_fld *restrict const Ez = E + FLD_COMP(2, nrow);
+	const int up = FLD_CELL(0, 1, nrow);
+
+	for (int i = begin * FLD_STRIDE; i < end * FLD_STRIDE; i += FLD_STRIDE)
+	{
+		Bx[i] += (-dt_dy * (Ez[i + up] - Ez[i]));
+		By[i] += (dt_dx * (Ez[i + FLD_STRIDE] - Ez[i]));
+		Bz[i] += (-dt_dx * (Ey[i + FLD_STRIDE] - Ey[i]) + dt_dy * (Ex[i + up] - Ex[i]));
+	}
+}
 
-	t_vfld *const restrict B = emf->B;
-	const t_vfld *const restrict E = emf->E;
+// Advance E in the cells [begin, end) of a row
+static void yee_e_row_scalar(t_fld *restrict const E, const t_fld *restrict const B,
+		const int nrow, const t_fld *restrict const J, const int nrow_j, const int begin,
+		const int end, const t_fld dt_dx, const t_fld dt_dy, const float dt)
+{
+	t_fld *restrict const Ex = E;
+	t_fld *restrict const Ey = E + FLD_COMP(1, nrow);
+	t_fld *restrict const Ez = E + FLD_COMP(2, nrow);
+	const t_fld *restrict const Bx = B;
+	const t_fld *restrict const By = B + FLD_COMP(1, nrow);
+	const t_fld *restrict const Bz = B + FLD_COMP(2, nrow);
+	const t_fld *restrict const Jx = J;
+	const t_fld *restrict const Jy = J + FLD_COMP(1, nrow_j);
+	const t_fld *restrict const Jz = J + FLD_COMP(2, nrow_j);
+	const int down = FLD_CELL(0, 1, nrow);
+
+	for (int i = begin * FLD_STRIDE; i < end * FLD_STRIDE; i += FLD_STRIDE)
+	{
+		Ex[i] += (+dt_dy * (Bz[i] - Bz[i - down])) - dt * Jx[i];
 
-	dt_dx = dt / emf->dx[0];
-	dt_dy = dt / emf->dx[1];
+		Ey[i] += (-dt_dx * (Bz[i] - Bz[i - FLD_STRIDE])) - dt * Jy[i];
 
-	// Canonical implementation
-	const int nrow = emf->nrow;
-	for (j = -1; j <= emf->nx[1]; j++)
+		Ez[i] += (+dt_dx * (By[i] - By[i - FLD_STRIDE]) - dt_dy * (Bx[i] - Bx[i - down]))
+				- dt * Jz[i];
+	}
+}
+
+#if defined(SIMD_X86) && defined(ENABLE_PLANAR_FIELDS)
+
+// AVX2 versions (8 cells per iteration, the remaining cells use the scalar kernel). The operations
+// are the same as in the scalar kernels (no FMA), so the results are bit-identical. Only the planar
+// layout is supported: in the default layout the components of each cell are interleaved and the
+// three updates of a cell mix different components
+__attribute__((target("avx2")))
+static void yee_b_row_avx2(t_fld *restrict const B, const t_fld *restrict const E, const int nrow,
+		const int begin, const int end, const t_fld dt_dx, const t_fld dt_dy)
+{
+	t_fld *restrict const Bx = B;
+	t_fld *restrict const By = B + FLD_COMP(1, nrow);
+	t_fld *restrict const Bz = B + FLD_COMP(2, nrow);
+	const t_fld *restrict const Ex = E;
+	const t_fld *restrict const Ey = E + FLD_COMP(1, nrow);
+	const t_fld *restrict const Ez = E + FLD_COMP(2, nrow);
+	const int up = FLD_CELL(0, 1, nrow);
+
+	const __m256 v_dt_dx = _mm256_set1_ps(dt_dx);
+	const __m256 v_dt_dy = _mm256_set1_ps(dt_dy);
+	const __m256 v_mdt_dx = _mm256_set1_ps(-dt_dx);
+	const __m256 v_mdt_dy = _mm256_set1_ps(-dt_dy);
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8)
 	{
-		for (i = -1; i <= emf->nx[0]; i++)
-		{
-			B[i + j * nrow].x += (-dt_dy * (E[i + (j + 1) * nrow].z - E[i + j * nrow].z));
-			B[i + j * nrow].y += (dt_dx * (E[(i + 1) + j * nrow].z - E[i + j * nrow].z));
-			B[i + j * nrow].z += (-dt_dx * (E[(i + 1) + j * nrow].y - E[i + j * nrow].y)
-					+ dt_dy * (E[i + (j + 1) * nrow].x - E[i + j * nrow].x));
-		}
+		const __m256 ex = _mm256_loadu_ps(Ex + i);
+		const __m256 ey = _mm256_loadu_ps(Ey + i);
+		const __m256 ez = _mm256_loadu_ps(Ez + i);
+
+		const __m256 dez_y = _mm256_sub_ps(_mm256_loadu_ps(Ez + i + up), ez);
+		const __m256 dez_x = _mm256_sub_ps(_mm256_loadu_ps(Ez + i + 1), ez);
+		const __m256 dey_x = _mm256_sub_ps(_mm256_loadu_ps(Ey + i + 1), ey);
+		const __m256 dex_y = _mm256_sub_ps(_mm256_loadu_ps(Ex + i + up), ex);
+
+		_mm256_storeu_ps(Bx + i, _mm256_add_ps(_mm256_loadu_ps(Bx + i),
+				_mm256_mul_ps(v_mdt_dy, dez_y)));
+		_mm256_storeu_ps(By + i, _mm256_add_ps(_mm256_loadu_ps(By + i),
+				_mm256_mul_ps(v_dt_dx, dez_x)));
+		_mm256_storeu_ps(Bz + i, _mm256_add_ps(_mm256_loadu_ps(Bz + i),
+				_mm256_add_ps(_mm256_mul_ps(v_mdt_dx, dey_x), _mm256_mul_ps(v_dt_dy, dex_y))));
 	}
+
+	yee_b_row_scalar(B, E, nrow, i, end, dt_dx, dt_dy);
 }
 
-void yee_e(t_emf *emf, const t_current *current, const float dt)
+__attribute__((target("avx2")))
+static void yee_e_row_avx2(t_fld *restrict const E, const t_fld *restrict const B, const int nrow,
+		const t_fld *restrict const J, const int nrow_j, const int begin, const int end,
+		const t_fld dt_dx, const t_fld dt_dy, const float dt)
 {
-	// these must not be unsigned because we access negative cell indexes
-	int i, j;
-	t_fld dt_dx, dt_dy;
+	t_fld *restrict const Ex = E;
+	t_fld *restrict const Ey = E + FLD_COMP(1, nrow);
+	t_fld *restrict const Ez = E + FLD_COMP(2, nrow);
+	const t_fld *restrict const Bx = B;
+	const t_fld *restrict const By = B + FLD_COMP(1, nrow);
+	const t_fld *restrict const Bz = B + FLD_COMP(2, nrow);
+	const t_fld *restrict const Jx = J;
+	const t_fld *restrict const Jy = J + FLD_COMP(1, nrow_j);
+	const t_fld *restrict const Jz = J + FLD_COMP(2, nrow_j);
+	const int down = FLD_CELL(0, 1, nrow);
+
+	const __m256 v_dt = _mm256_set1_ps(dt);
+	const __m256 v_dt_dx = _mm256_set1_ps(dt_dx);
+	const __m256 v_dt_dy = _mm256_set1_ps(dt_dy);
+	const __m256 v_mdt_dx = _mm256_set1_ps(-dt_dx);
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		const __m256 bx = _mm256_loadu_ps(Bx + i);
+		const __m256 by = _mm256_loadu_ps(By + i);
+		const __m256 bz = _mm256_loadu_ps(Bz + i);
+
+		const __m256 dbz_y = _mm256_sub_ps(bz, _mm256_loadu_ps(Bz + i - down));
+		const __m256 dbz_x = _mm256_sub_ps(bz, _mm256_loadu_ps(Bz + i - 1));
+		const __m256 dby_x = _mm256_sub_ps(by, _mm256_loadu_ps(By + i - 1));
+		const __m256 dbx_y = _mm256_sub_ps(bx, _mm256_loadu_ps(Bx + i - down));
+
+		const __m256 ex = _mm256_sub_ps(_mm256_mul_ps(v_dt_dy, dbz_y),
+				_mm256_mul_ps(v_dt, _mm256_loadu_ps(Jx + i)));
+		const __m256 ey = _mm256_sub_ps(_mm256_mul_ps(v_mdt_dx, dbz_x),
+				_mm256_mul_ps(v_dt, _mm256_loadu_ps(Jy + i)));
+		const __m256 ez = _mm256_sub_ps(
+				_mm256_sub_ps(_mm256_mul_ps(v_dt_dx, dby_x), _mm256_mul_ps(v_dt_dy, dbx_y)),
+				_mm256_mul_ps(v_dt, _mm256_loadu_ps(Jz + i)));
+
+		_mm256_storeu_ps(Ex + i, _mm256_add_ps(_mm256_loadu_ps(Ex + i), ex));
+		_mm256_storeu_ps(Ey + i, _mm256_add_ps(_mm256_loadu_ps(Ey + i), ey));
+		_mm256_storeu_ps(Ez + i, _mm256_add_ps(_mm256_loadu_ps(Ez + i), ez));
+	}
 
-	dt_dx = dt / emf->dx[0];
-	dt_dy = dt / emf->dx[1];
+	yee_e_row_scalar(E, B, nrow, J, nrow_j, i, end, dt_dx, dt_dy, dt);
+}
 
-	t_vfld *const restrict E = emf->E;
-	const t_vfld *const restrict B = emf->B;
-	const t_vfld *const restrict J = current->J;
+#endif
 
-	// Canonical implementation
-	const int nrow_e = emf->nrow;
-	const int nrow_j = current->nrow;
+// Row kernels of the field solver, selected for the CPU (see emf_select_kernels)
+typedef void (*t_yee_b_kernel)(t_fld *restrict const B, const t_fld *restrict const E,
+		const int nrow, const int begin, const int end, const t_fld dt_dx, const t_fld dt_dy);
+typedef void (*t_yee_e_kernel)(t_fld *restrict const E, const t_fld *restrict const B,
+		const int nrow, const t_fld *restrict const J, const int nrow_j, const int begin,
+		const int end, const t_fld dt_dx, const t_fld dt_dy, const float dt);
 
-	for (j = 0; j <= emf->nx[1] + 1; j++)
+static t_yee_b_kernel yee_b_row = yee_b_row_scalar;
+static t_yee_e_kernel yee_e_row = yee_e_row_scalar;
+static const char *yee_kernel_name = "scalar";
+
+// Select the field solver kernels for the current CPU (can be overridden with ZPIC_SIMD=scalar)
+void emf_select_kernels(void)
+{
+	yee_b_row = yee_b_row_scalar;
+	yee_e_row = yee_e_row_scalar;
+	yee_kernel_name = "scalar";
+
+#if defined(SIMD_X86) && defined(ENABLE_PLANAR_FIELDS)
+	if (simd_select_isa() != SIMD_SCALAR)
 	{
-		for (i = 0; i <= emf->nx[0] + 1; i++)
-		{
-			E[i + j * nrow_e].x += (+dt_dy * (B[i + j * nrow_e].z - B[i + (j - 1) * nrow_e].z))
-					- dt * J[i + j * nrow_j].x;
+		yee_b_row = yee_b_row_avx2;
+		yee_e_row = yee_e_row_avx2;
+		yee_kernel_name = "AVX2 (8 cells/iteration)";
+	}
+#endif
+}
+
+// Name of the field solver kernels in use
+const char* emf_kernel_name(void)
+{
+	return yee_kernel_name;
+}
 
-			E[i + j * nrow_e].y += (-dt_dx * (B[i + j * nrow_e].z - B[(i - 1) + j * nrow_e].z))
-					- dt * J[i + j * nrow_j].y;
+// Field solver benchmark: one sweep of a row kernel over a copy of the region fields
+typedef struct {
+	t_fld *E, *B;
+	const t_fld *J;
+	int nrow, nrow_j, nx, ny;
+	t_fld dt_dx, dt_dy;
+	float dt;
+} t_yee_bench;
 
-			E[i + j * nrow_e].z += (+dt_dx * (B[i + j * nrow_e].y - B[(i - 1) + j * nrow_e].y)
-					- dt_dy * (B[i + j * nrow_e].x - B[i + (j - 1) * nrow_e].x))
-					- dt * J[i + j * nrow_j].z;
+static void yee_bench_b(void *arg)
+{
+	const t_yee_bench *bench = arg;
 
+	for (int j = 0; j < bench->ny; j++)
+		yee_b_row(bench->B + FLD_CELL(0, j, bench->nrow), bench->E + FLD_CELL(0, j, bench->nrow),
+				bench->nrow, -1, bench->nx + 1, bench->dt_dx, bench->dt_dy);
+}
+
+static void yee_bench_e(void *arg)
+{
+	const t_yee_bench *bench = arg;
+
+	for (int j = 0; j < bench->ny; j++)
+		yee_e_row(bench->E + FLD_CELL(0, j, bench->nrow), bench->B + FLD_CELL(0, j, bench->nrow),
+				bench->nrow, bench->J + FLD_CELL(0, j, bench->nrow_j), bench->nrow_j, 0,
+				bench->nx + 2, bench->dt_dx, bench->dt_dy, bench->dt);
+}
+
+void emf_bench_kernels(const t_emf *emf, const t_current *current, double bandwidth[2])
+{
+	const size_t size = emf->total_size * sizeof(t_vfld);
+	const size_t size_j = current->total_size * sizeof(t_vfld);
+
+	t_vfld *E_buf = mem_alloc(size, MEM_FIELDS);
+	t_vfld *B_buf = mem_alloc(size, MEM_FIELDS);
+	t_vfld *J_buf = mem_alloc(size_j, MEM_CURRENT);
+	memcpy(E_buf, emf->E_buf, size);
+	memcpy(B_buf, emf->B_buf, size);
+	memcpy(J_buf, current->J_buf, size_j);
+
+	// Same offsets of the cell [0][0] as the region fields
+	t_yee_bench bench;
+	bench.E = (t_fld*) E_buf + (emf->E - (t_fld*) emf->E_buf);
+	bench.B = (t_fld*) B_buf + (emf->B - (t_fld*) emf->B_buf);
+	bench.J = (t_fld*) J_buf + (current->J - (t_fld*) current->J_buf);
+	bench.nrow = emf->nrow;
+	bench.nrow_j = current->nrow;
+	bench.nx = emf->nx[0];
+	bench.ny = emf->nx[1];
+	bench.dt = emf->dt;
+	bench.dt_dx = emf->dt / emf->dx[0];
+	bench.dt_dy = emf->dt / emf->dx[1];
+
+	// Both kernels update nx + 2 cells per row. Each value is loaded and stored once (the rows above
+	// or below are in cache): E and B loaded and B stored (B advance), E, B and J loaded and E
+	// stored (E advance)
+	const double cells = (double) bench.ny * (bench.nx + 2);
+
+	bandwidth[0] = cells * 9 * sizeof(t_fld) / timer_bench(yee_bench_b, &bench) / 1E9;
+	bandwidth[1] = cells * 12 * sizeof(t_fld) / timer_bench(yee_bench_e, &bench) / 1E9;
+
+	mem_free(E_buf);
+	mem_free(B_buf);
+	mem_free(J_buf);
+}
+
+// Copy the ghost cells in x of one row when the region is its own left neighbour
+static void emf_update_gc_x_row(t_emf *emf, const int j)
+{
+	const int nrow = emf->nrow;
+	const int nx = emf->nx[0];
+
+	for (int c = 0; c < 3; c++)
+	{
+		t_fld *const E = emf->E + FLD_CELL(0, j, nrow) + FLD_COMP(c, nrow);
+		t_fld *const B = emf->B + FLD_CELL(0, j, nrow) + FLD_COMP(c, nrow);
+
+		for (int i = -emf->gc[0][0]; i < 0; i++)
+		{
+			E[i * FLD_STRIDE] = E[(i + nx) * FLD_STRIDE];
+			B[i * FLD_STRIDE] = B[(i + nx) * FLD_STRIDE];
+		}
+
+		for (int i = 0; i < emf->gc[0][1]; i++)
+		{
+			E[(i + nx) * FLD_STRIDE] = E[i * FLD_STRIDE];
+			B[(i + nx) * FLD_STRIDE] = B[i * FLD_STRIDE];
 		}
 	}
 }
 
-// Update the ghost cells in the X direction
+// Update the ghost cells in the left overlap zone (X direction). The region on the left is the
+// region itself if the simulation box is not split along x (periodic boundaries)
 void emf_update_gc_x(t_emf *emf)
+{
+	emf_update_gc_x_serial(emf);
+}
+
+void emf_update_gc_x_serial(t_emf *emf)
 {
 	int i, j;
 	const int nrow = emf->nrow;
+	const int nrow_left = emf->left->nrow;
 
-	t_vfld *const restrict E = emf->E;
-	t_vfld *const restrict B = emf->B;
-
-	// For moving window don't update x boundaries
-	if (!emf->moving_window)
+	// x
+	for (int c = 0; c < 3; c++)
 	{
-		// x
+		t_fld *const E = emf->E + FLD_COMP(c, nrow);
+		t_fld *const B = emf->B + FLD_COMP(c, nrow);
+		t_fld *const E_overlap = emf->left->E + FLD_CELL(emf->left->nx[0], 0, nrow_left)
+				+ FLD_COMP(c, nrow_left);
+		t_fld *const B_overlap = emf->left->B + FLD_CELL(emf->left->nx[0], 0, nrow_left)
+				+ FLD_COMP(c, nrow_left);
+
 		for (j = -emf->gc[1][0]; j < emf->nx[1] + emf->gc[1][1]; j++)
 		{
-
-			// lower
 			for (i = -emf->gc[0][0]; i < 0; i++)
 			{
-				E[i + j * nrow].x = E[emf->nx[0] + i + j * nrow].x;
-				E[i + j * nrow].y = E[emf->nx[0] + i + j * nrow].y;
-				E[i + j * nrow].z = E[emf->nx[0] + i + j * nrow].z;
-
-				B[i + j * nrow].x = B[emf->nx[0] + i + j * nrow].x;
-				B[i + j * nrow].y = B[emf->nx[0] + i + j * nrow].y;
-				B[i + j * nrow].z = B[emf->nx[0] + i + j * nrow].z;
+				E[FLD_CELL(i, j, nrow)] = E_overlap[FLD_CELL(i, j, nrow_left)];
+				B[FLD_CELL(i, j, nrow)] = B_overlap[FLD_CELL(i, j, nrow_left)];
 			}
 
-			// below
 			for (i = 0; i < emf->gc[0][1]; i++)
 			{
-				E[emf->nx[0] + i + j * nrow].x = E[i + j * nrow].x;
-				E[emf->nx[0] + i + j * nrow].y = E[i + j * nrow].y;
-				E[emf->nx[0] + i + j * nrow].z = E[i + j * nrow].z;
-
-				B[emf->nx[0] + i + j * nrow].x = B[i + j * nrow].x;
-				B[emf->nx[0] + i + j * nrow].y = B[i + j * nrow].y;
-				B[emf->nx[0] + i + j * nrow].z = B[i + j * nrow].z;
+				E_overlap[FLD_CELL(i, j, nrow_left)] = E[FLD_CELL(i, j, nrow)];
+				B_overlap[FLD_CELL(i, j, nrow_left)] = B[FLD_CELL(i, j, nrow)];
 			}
-
 		}
 	}
 }
@@ -530,90 +791,89 @@ void emf_update_gc_x(t_emf *emf)
 // Update ghost cells in the below overlap zone (Y direction)
 void emf_update_gc_y(t_emf *emf)
 {
-//	uint64_t t0 = timer_ticks();
-	int i, j;
-	const int nrow = emf->nrow;
-
-	t_vfld *const restrict E = emf->E;
-	t_vfld *const restrict B = emf->B;
-	t_vfld *const restrict E_overlap = emf->E_below;
-	t_vfld *const restrict B_overlap = emf->B_below;
-
-	// y
-	for (i = -emf->gc[0][0]; i < emf->nx[0] + emf->gc[0][1]; i++)
-	{
-		for (j = -emf->gc[1][0]; j < 0; j++)
-		{
-			B[i + j * nrow] = B_overlap[i + (j + emf->gc[1][0]) * nrow];
-			E[i + j * nrow] = E_overlap[i + (j + emf->gc[1][0]) * nrow];
-		}
-
-		for (j = 0; j < emf->gc[1][1]; j++)
-		{
-			B_overlap[i + (j + emf->gc[1][0]) * nrow] = B[i + j * nrow];
-			E_overlap[i + (j + emf->gc[1][0]) * nrow] = E[i + j * nrow];
-		}
-	}
-
-	// Cannot be used with the PGI compiler
-	//#pragma oss atomic
-	//_emf_time += timer_interval_seconds(t0, timer_ticks());
+	emf_update_gc_y_serial(emf);
 }
 
 void emf_update_gc_y_serial(t_emf *emf)
 {
-//	uint64_t t0 = timer_ticks();
 	int i, j;
 	const int nrow = emf->nrow;
 
-	t_vfld *const restrict E = emf->E;
-	t_vfld *const restrict B = emf->B;
-	t_vfld *const restrict E_overlap = emf->E_below;
-	t_vfld *const restrict B_overlap = emf->B_below;
+	// Cell [0][0] of the overlap zone below. All the regions move the window at the same time
+	const int offset = FLD_CELL(emf->gc[0][0] + emf->window_shift, 0, nrow);
 
 	// y
-	for (i = -emf->gc[0][0]; i < emf->nx[0] + emf->gc[0][1]; i++)
+	for (int c = 0; c < 3; c++)
 	{
+		t_fld *const restrict E = emf->E + FLD_COMP(c, nrow);
+		t_fld *const restrict B = emf->B + FLD_COMP(c, nrow);
+		t_fld *const restrict E_overlap = (t_fld*) emf->E_below + offset + FLD_COMP(c, nrow);
+		t_fld *const restrict B_overlap = (t_fld*) emf->B_below + offset + FLD_COMP(c, nrow);
+
 		for (j = -emf->gc[1][0]; j < 0; j++)
 		{
-			B[i + j * nrow] = B_overlap[i + (j + emf->gc[1][0]) * nrow];
-			E[i + j * nrow] = E_overlap[i + (j + emf->gc[1][0]) * nrow];
+			for (i = -emf->gc[0][0]; i < emf->nx[0] + emf->gc[0][1]; i++)
+			{
+				B[FLD_CELL(i, j, nrow)] = B_overlap[FLD_CELL(i, j + emf->gc[1][0], nrow)];
+				E[FLD_CELL(i, j, nrow)] = E_overlap[FLD_CELL(i, j + emf->gc[1][0], nrow)];
+			}
 		}
 
 		for (j = 0; j < emf->gc[1][1]; j++)
 		{
-			B_overlap[i + (j + emf->gc[1][0]) * nrow] = B[i + j * nrow];
-			E_overlap[i + (j + emf->gc[1][0]) * nrow] = E[i + j * nrow];
+			for (i = -emf->gc[0][0]; i < emf->nx[0] + emf->gc[0][1]; i++)
+			{
+				B_overlap[FLD_CELL(i, j + emf->gc[1][0], nrow)] = B[FLD_CELL(i, j, nrow)];
+				E_overlap[FLD_CELL(i, j + emf->gc[1][0], nrow)] = E[FLD_CELL(i, j, nrow)];
+			}
 		}
 	}
 }
 
-// Move the simulation window
-void emf_move_window(t_emf *emf)
+// Move the simulation window. The fields are shifted left 1 cell, taking the values of the region on
+// the right from the ghost cells. The rightmost cells of the simulation box (right_edge) are set
+// to zero, while the remaining ghost cells must be updated afterwards (emf_update_gc_x).
+// The fields are not copied: the origin of E and B moves 1 cell to the right inside the padding of
+// the rows and only the new column is set. When the padding is used up (window_slack moves), the
+// fields are moved back to the start of the rows, so a move costs O(ny) cells on average
+void emf_move_window(t_emf *emf, const bool right_edge)
 {
 	if ((emf->iter * emf->dt) > emf->dx[0] * (emf->n_move + 1))
 	{
 		int i, j;
 		const int nrow = emf->nrow;
 
-		t_vfld *const restrict E = emf->E;
-		t_vfld *const restrict B = emf->B;
+		if (emf->window_shift == emf->window_slack)
+		{
+			const int shift = FLD_CELL(emf->window_shift, 0, nrow);
+			const size_t size = (3 * emf->total_size - shift) * sizeof(t_fld);
+
+			memmove(emf->E_buf, (t_fld*) emf->E_buf + shift, size);
+			memmove(emf->B_buf, (t_fld*) emf->B_buf + shift, size);
+			emf->E -= shift;
+			emf->B -= shift;
+			emf->window_shift = 0;
+		}
+
+		emf->E += FLD_CELL(1, 0, nrow);
+		emf->B += FLD_CELL(1, 0, nrow);
+		emf->window_shift++;
 
-		const t_vfld zero_fld = { 0., 0., 0. };
+		// Zero the new column (the ghost cells are updated afterwards) and the rightmost cells
+		const int first = right_edge ? emf->nx[0] - 1 : emf->nx[0] + emf->gc[0][1] - 1;
 
-		// Shift data left 1 cell and zero rightmost cells
-		for (j = 0; j < emf->nx[1]; j++)
+		for (int c = 0; c < 3; c++)
 		{
-			for (i = -emf->gc[0][0]; i < emf->nx[0] - 1; i++)
-			{
-				E[i + j * nrow] = E[i + j * nrow + 1];
-				B[i + j * nrow] = B[i + j * nrow + 1];
-			}
+			t_fld *const restrict E = emf->E + FLD_COMP(c, nrow);
+			t_fld *const restrict B = emf->B + FLD_COMP(c, nrow);
 
-			for (i = emf->nx[0] - 1; i < emf->nx[0] + emf->gc[0][1]; i++)
+			for (j = -emf->gc[1][0]; j < emf->nx[1] + emf->gc[1][1]; j++)
 			{
-				E[i + j * nrow] = zero_fld;
-				B[i + j * nrow] = zero_fld;
+				for (i = first; i < emf->nx[0] + emf->gc[0][1]; i++)
+				{
+					E[FLD_CELL(i, j, nrow)] = 0;
+					B[FLD_CELL(i, j, nrow)] = 0;
+				}
 			}
 		}
 
@@ -622,22 +882,104 @@ void emf_move_window(t_emf *emf)
 	}
 }
 
-// Perform the local integration of the fields (and post processing)
-void emf_advance(t_emf *emf, const t_current *current)
+// Advance the fields in the steps [r0, r1) of the sweep over the rows (see emf_advance). The step r
+// advances B in the row r, E in the row r and B again in the row r - 1, so the blocks of steps must
+// be executed in order. The dependencies are declared over the rows [first, last) of E, B and J:
+// the rows updated by the block plus the rows read from the adjacent blocks
+#pragma oss task in(J_rows[0; size_j]) inout(E_rows[0; size]) inout(B_rows[0; size]) \
+	label("EMF Advance")
+static void emf_advance_rows(t_emf *emf, const t_current *current, const int r0, const int r1,
+		const bool update_gc_x, t_vfld *E_rows, t_vfld *B_rows, const t_vfld *J_rows,
+		const int size, const int size_j)
 {
 	const float dt = emf->dt;
+	const int nrow = emf->nrow;
+	const int nrow_j = current->nrow;
+	const int nx = emf->nx[0];
+	const int ny = emf->nx[1];
+
+	const t_fld dt_dx = dt / emf->dx[0];
+	const t_fld dt_dy = dt / emf->dx[1];
+	const t_fld dt_dx_2 = (dt / 2.0f) / emf->dx[0];
+	const t_fld dt_dy_2 = (dt / 2.0f) / emf->dx[1];
+
+	t_fld *const E = emf->E;
+	t_fld *const B = emf->B;
+	const t_fld *const J = current->J;
+
+	for (int r = r0; r < r1; r++)
+	{
+		const int row = FLD_CELL(0, r, nrow);
+		const int row_below = FLD_CELL(0, r - 1, nrow);
 
-	// Advance EM field using Yee algorithm modified for having E and B time centered
-	yee_b(emf, dt / 2.0f);
-	yee_e(emf, current, dt);
-	yee_b(emf, dt / 2.0f);
+		// B in the cells [-1, nx] and E in the cells [0, nx + 1]
+		if (r <= ny) yee_b_row(B + row, E + row, nrow, -1, nx + 1, dt_dx_2, dt_dy_2);
+
+		if (r >= 0)
+		{
+			yee_e_row(E + row, B + row, nrow, J + FLD_CELL(0, r, nrow_j), nrow_j, 0, nx + 2, dt_dx,
+					dt_dy, dt);
+
+			yee_b_row(B + row_below, E + row_below, nrow, -1, nx + 1, dt_dx_2, dt_dy_2);
+			if (update_gc_x) emf_update_gc_x_row(emf, r - 1);
+		}
+	}
 
-	emf_update_gc_x(emf);
+	// Last block: the last row (ghost cells) is only updated by E
+	if (r1 == ny + 2)
+	{
+		if (update_gc_x)
+			for (int j = ny + 1; j < ny + emf->gc[1][1]; j++)
+				emf_update_gc_x_row(emf, j);
 
-	// Advance internal iteration number
-	emf->iter += 1;
+		// Advance internal iteration number
+		emf->iter += 1;
+	}
+}
 
-	// Move simulation window if needed
-	if (emf->moving_window) emf_move_window(emf);
+// Create the task of one block of steps of the sweep
+static void emf_advance_block(t_emf *emf, const t_current *current, const int r0, const int r1,
+		const bool update_gc_x)
+{
+	// Rows read or updated by the steps [r0, r1), limited to the rows of the buffers (the moving
+	// window does not change the position of the rows in the buffers)
+	const int first = (r0 - 1 > -emf->gc[1][0]) ? r0 - 1 : -emf->gc[1][0];
+	const int last = (r1 + 1 < emf->nx[1] + emf->gc[1][1]) ? r1 + 1 : emf->nx[1] + emf->gc[1][1];
+	const int row0 = (first + emf->gc[1][0]) * emf->nrow;
+	const int row0_j = (first + current->gc[1][0]) * current->nrow;
+
+	emf_advance_rows(emf, current, r0, r1, update_gc_x, emf->E_buf + row0, emf->B_buf + row0,
+			current->J_buf + row0_j, (last - first) * emf->nrow, (last - first) * current->nrow);
 }
 
+// Perform the local integration of the fields with the Yee algorithm modified for having E and B
+// time centered (B is advanced dt / 2, E is advanced dt and B is advanced dt / 2 again). The three
+// updates are done in a single sweep over the rows: at step r, B is advanced in the row r, E in
+// the row r and B again in the row r - 1, which only uses rows already updated by the previous
+// steps. The result is the same as three sweeps over the region, but each row of E, B and J is
+// only loaded from memory once. If update_gc_x is true, the region must be its own left neighbour
+// and the ghost cells in x of each row are also updated as soon as the row is complete (otherwise,
+// they are updated afterwards).
+// The sweep is split in three tasks: the bottom and top blocks contain the rows exchanged with the
+// regions below and above (emf_update_gc_y), while the interior block only depends on the rows of
+// the region. The ghost cell update with one neighbour can then start before the other blocks end
+void emf_advance(t_emf *emf, const t_current *current, const bool update_gc_x)
+{
+	assert(!update_gc_x || emf->left == emf);
+
+	const int ny = emf->nx[1];
+
+	// Steps of the interior block (its rows are not in the overlap zones of E, B and J, which take
+	// the rows [-gc[1][0], gc[1][1]) and [ny - gc[1][0], ny + gc[1][1]))
+	const int zone_bottom = (emf->gc[1][1] > current->gc[1][1]) ? emf->gc[1][1] : current->gc[1][1];
+	const int zone_top = (emf->gc[1][0] > current->gc[1][0]) ? emf->gc[1][0] : current->gc[1][0];
+	const int b0 = zone_bottom + 1;
+	const int t0 = ny - zone_top - 1;
+
+	if (b0 < t0)
+	{
+		emf_advance_block(emf, current, -1, b0, update_gc_x);
+		emf_advance_block(emf, current, b0, t0, update_gc_x);
+		emf_advance_block(emf, current, t0, ny + 2, update_gc_x);
+	} else emf_advance_block(emf, current, -1, ny + 2, update_gc_x);
+}
@@ -20,10 +20,11 @@ enum emf_diag {
 	EFLD, BFLD
 };
 
-typedef struct {
+typedef struct Emf {
 
-	t_vfld *E;
-	t_vfld *B;
+	// Cell [0][0] of E and B (see FLD_CELL)
+	t_fld *E;
+	t_fld *B;
 
 	t_vfld *E_buf;
 	t_vfld *B_buf;
@@ -37,6 +38,7 @@ typedef struct {
 
 	int total_size; // Total size of the buffer
 	int overlap; // Size of the overlap
+	int numa_node; // NUMA node where the buffers are allocated
 
 	// Time step
 	float dt;
@@ -44,13 +46,19 @@ typedef struct {
 	// Iteration number
 	int iter;
 
-	// Moving window
+	// Moving window. The origin of E and B is moved window_shift cells to the right inside the
+	// padding of the rows (at most window_slack cells, see emf_move_window)
 	bool moving_window;
 	int n_move;
+	int window_shift;
+	int window_slack;
 
-	// Pointer to the overlap zone (in the E/B buffer) in the region above
+	// Overlap zone in the buffers of the region below (its first row, including the padding)
 	t_vfld *B_below, *E_below;
 
+	// Fields of the region on the left (overlap zone in x)
+	struct Emf *left;
+
 } t_emf;
 
 enum emf_laser_type {
@@ -77,37 +85,57 @@ typedef struct {
 } t_emf_laser;
 
 // Setup
-void emf_new(t_emf *emf, int nx[], t_fld box[], const float dt);
+void emf_new(t_emf *emf, int nx[], t_fld box[], const float dt, const int numa_node);
 void emf_delete(t_emf *emf);
-void emf_overlap_zone(t_emf *emf, t_emf *upper);
-void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_y);
-void div_corr_x(t_emf *emf);
+void emf_overlap_zone(t_emf *emf, t_emf *below, t_emf *left);
+void emf_copy_rows(t_emf *dst, const int dst_row, const t_emf *src, const int src_row,
+		const int n_rows);
+void emf_set_moving_window(t_emf *emf, const int slack);
+void emf_add_laser(t_emf *const emf, t_emf_laser *laser, int offset_x, int offset_y);
+void div_corr_x(t_emf *emf, const t_emf *right);
 
 // General Report
 double emf_time(void);
 double emf_get_energy(t_emf *emf);
 
+// Field solver kernels (AVX2 with ENABLE_SIMD and ENABLE_PLANAR_FIELDS, otherwise scalar)
+void emf_select_kernels(void);
+const char* emf_kernel_name(void);
+
+// Bandwidth (GB/s) of the row kernels of the field solver, B advance [0] and E advance [1], in
+// one thread over a copy of the region fields
+void emf_bench_kernels(const t_emf *emf, const t_current *current, double bandwidth[2]);
+
 // ZDF Report
-void emf_reconstruct_global_buffer(const t_emf *emf, float *global_buffer, const int offset,
-		const char field, const char fc);
+void emf_reconstruct_global_buffer(const t_emf *emf, float *global_buffer, const int offset_x,
+		const int offset_y, const int global_nx, const char field, const char fc);
 void emf_report(const float *restrict global_buffer, const float box[2], const int true_nx[2],
 		const int iter, const float dt, const char field, const char fc, const char path[128]);
 
 // CPU Tasks
-#pragma oss task in(current->J_buf[0; current->total_size]) \
-inout(emf->E_buf[0; emf->total_size]) \
-inout(emf->B_buf[0; emf->total_size]) \
-label("EMF Advance")
-void emf_advance(t_emf *emf, const t_current *current);
+// Creates one task for the rows at the bottom edge, one for the interior and one for the top edge
+void emf_advance(t_emf *emf, const t_current *current, const bool update_gc_x);
 
 #pragma oss task inout(emf->B_buf[0; emf->overlap]) \
-inout(emf->B_below[-emf->gc[0][0]; emf->overlap]) \
+inout(emf->B_below[0; emf->overlap]) \
 inout(emf->E_buf[0; emf->overlap]) \
-inout(emf->E_below[-emf->gc[0][0]; emf->overlap]) \
+inout(emf->E_below[0; emf->overlap]) \
 label("EMF Update GC")
 void emf_update_gc_y(t_emf *emf); // Each region is update the ghost cells in the top edge
 
+#pragma oss task inout(emf->B_buf[0; emf->total_size]) \
+inout(emf->left->B_buf[0; emf->left->total_size]) \
+inout(emf->E_buf[0; emf->total_size]) \
+inout(emf->left->E_buf[0; emf->left->total_size]) \
+label("EMF Update GC X")
+void emf_update_gc_x(t_emf *emf); // Each region is update the ghost cells in the left edge
+
+#pragma oss task inout(emf->E_buf[0; emf->total_size]) \
+inout(emf->B_buf[0; emf->total_size]) \
+label("EMF Move Window")
+void emf_move_window(t_emf *emf, const bool right_edge);
+
 void emf_update_gc_y_serial(t_emf *emf);
-void emf_update_gc_x(t_emf *emf);
+void emf_update_gc_x_serial(t_emf *emf);
 
 #endif
@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "zpic.h"
 #include "simulation.h"
@@ -39,16 +40,17 @@ int main(int argc, const char *argv[])
 {
 	if(argc != 2)
 	{
-		fprintf(stderr, "Please specify the number of regions");
+		fprintf(stderr, "Please specify the number of regions (or --autotune)");
 		exit(1);
 	}
 
 	// Initialize simulation
 	t_simulation sim;
-	sim_init(&sim, atoi(argv[1]));
+	if (strcmp(argv[1], "--autotune") == 0) sim_autotune(&sim);
+	else sim_init(&sim, atoi(argv[1]));
 
 	// Run simulation
-	int n;
+	int n, n_iter;
 	float t;
 	uint64_t t0, t1;
 	
@@ -58,7 +60,7 @@ int main(int argc, const char *argv[])
 	
 	t0 = timer_ticks();
 
-	for (n = 0, t = 0.0; t <= sim.tmax; n++, t = n * sim.dt)
+	for (n = 0, t = 0.0; t <= sim.tmax; n += n_iter, t = n * sim.dt)
 	{
 #ifndef TEST
 		fprintf(stderr, "n = %i, t = %f\n", n, t);
@@ -69,7 +71,16 @@ int main(int argc, const char *argv[])
 			sim_report(&sim);
 		}
 #endif
+
+#ifdef ENABLE_TASKITER
+		// Advance all the iterations until the next report with the same task graph
+		n_iter = 1;
+		while ((n + n_iter) * sim.dt <= sim.tmax && !report(n + n_iter, sim.ndump)) n_iter++;
+		n_iter = sim_iter_graph(&sim, n_iter);
+#else
 		sim_iter(&sim);
+		n_iter = 1;
+#endif
 	}
 
 	#pragma oss taskwait
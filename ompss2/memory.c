@@ -0,0 +1,311 @@
+/*
+ *  memory.c
+ *  zpic
+ *
+ *  Allocation of the field, current and particle buffers
+ *
+ */
+
+// syscall (page location), madvise and mmap flags
+#define _GNU_SOURCE
+
+#include "memory.h"
+#include "timer.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef ENABLE_NUMA
+#include <nanos6.h>
+#endif
+
+// Maximum number of pages of a buffer queried for their location
+#define NUMA_SAMPLE_PAGES 256
+
+#define ROUND_UP(x, a) ((((x) + (a) - 1) / (a)) * (a))
+
+// Huge page modes
+enum huge_mode {
+	HUGE_THP, HUGE_EXPLICIT, HUGE_OFF
+};
+
+// How the buffer was allocated
+enum mem_kind {
+	KIND_ALIGNED, KIND_HUGETLB, KIND_NUMA
+};
+
+// Header stored before each buffer (the buffer starts MEM_ALIGN bytes after the allocation)
+typedef struct {
+	size_t capacity;	// Usable bytes
+	size_t reserved;	// Allocated bytes (including the header)
+	enum mem_type type;
+	enum mem_kind kind;
+} t_mem_header;
+
+static size_t usage[MEM_NUM_TYPES];
+static size_t peak_usage[MEM_NUM_TYPES];
+
+static enum huge_mode huge_pages(void)
+{
+	static int mode = -1;
+
+	if (mode < 0)
+	{
+		const char *env = getenv("ZPIC_HUGE_PAGES");
+		if (env && !strcmp(env, "explicit")) mode = HUGE_EXPLICIT;
+		else if (env && !strcmp(env, "off")) mode = HUGE_OFF;
+		else mode = HUGE_THP;
+	}
+
+	return mode;
+}
+
+const char *mem_huge_pages_name(void)
+{
+	const char *name[] = {"transparent", "explicit (hugetlbfs)", "off"};
+	return name[huge_pages()];
+}
+
+static void mem_track(const enum mem_type type, const size_t size, const bool add)
+{
+	if (!add)
+	{
+		__atomic_sub_fetch(&usage[type], size, __ATOMIC_RELAXED);
+		return;
+	}
+
+	const size_t current = __atomic_add_fetch(&usage[type], size, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&peak_usage[type], __ATOMIC_RELAXED);
+
+	while (current > peak && !__atomic_compare_exchange_n(&peak_usage[type], &peak, current, true,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void *mem_alloc_kind(const size_t size, const enum mem_type type, const int numa_node)
+{
+	const size_t total = size + MEM_ALIGN;
+	const bool huge = total >= MEM_HUGE_PAGE && huge_pages() != HUGE_OFF;
+	t_mem_header header = {.capacity = size, .reserved = total, .type = type, .kind = KIND_ALIGNED};
+	void *base = NULL;
+
+#ifdef ENABLE_NUMA
+	if (numa_node >= 0)
+	{
+		nanos6_bitmask_t mask;
+		nanos6_bitmask_clearall(&mask);
+		nanos6_bitmask_setbit(&mask, numa_node);
+
+		// A single block in the node (only its first page is tracked by the runtime)
+		base = nanos6_numa_alloc_sentinels(total, &mask, total);
+		assert(((uintptr_t) base % MEM_ALIGN) == 0);
+		header.kind = KIND_NUMA;
+	}
+#endif
+
+#ifdef MAP_HUGETLB
+	// Explicit huge pages (reserved by the system administrator). Falls back to transparent huge
+	// pages if there are not enough free huge pages
+	if (!base && huge && huge_pages() == HUGE_EXPLICIT)
+	{
+		const size_t length = ROUND_UP(total, MEM_HUGE_PAGE);
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if (base == MAP_FAILED) base = NULL;
+		else header = (t_mem_header) {.capacity = length - MEM_ALIGN, .reserved = length,
+				.type = type, .kind = KIND_HUGETLB};
+	}
+#endif
+
+	if (!base)
+	{
+		if (posix_memalign(&base, huge ? MEM_HUGE_PAGE : MEM_ALIGN, total))
+		{
+			fprintf(stderr, "Error allocating %zu bytes. Exiting...\n", size);
+			exit(1);
+		}
+
+#ifdef MADV_HUGEPAGE
+		if (huge) madvise(base, ROUND_UP(total, sysconf(_SC_PAGESIZE)), MADV_HUGEPAGE);
+#endif
+	}
+
+	*(t_mem_header*) base = header;
+	mem_track(type, header.reserved, true);
+
+	return (char*) base + MEM_ALIGN;
+}
+
+static inline t_mem_header *mem_header(void *ptr)
+{
+	return (t_mem_header*) ((char*) ptr - MEM_ALIGN);
+}
+
+void *mem_alloc(const size_t size, const enum mem_type type)
+{
+	return mem_alloc_kind(size, type, -1);
+}
+
+void *mem_alloc_node(const size_t size, const enum mem_type type, const int numa_node)
+{
+	void *ptr = mem_alloc_kind(size, type, numa_node);
+
+	// First touch (the caller should be a task running in the node of the region)
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+void *mem_realloc(void *ptr, const size_t copy_size, const size_t size, const enum mem_type type)
+{
+	if (ptr && mem_header(ptr)->capacity >= size) return ptr;
+
+	void *new_ptr = mem_alloc(size, type);
+	if (ptr)
+	{
+		memcpy(new_ptr, ptr, copy_size);
+		mem_free(ptr);
+	}
+
+	return new_ptr;
+}
+
+void mem_free(void *ptr)
+{
+	if (!ptr) return;
+
+	t_mem_header *header = mem_header(ptr);
+	mem_track(header->type, header->reserved, false);
+
+	switch (header->kind)
+	{
+#ifdef ENABLE_NUMA
+		case KIND_NUMA:
+			nanos6_numa_free(header);
+			break;
+#endif
+		case KIND_HUGETLB:
+			munmap(header, header->reserved);
+			break;
+		default:
+			free(header);
+			break;
+	}
+}
+
+int mem_row_pitch(const int n, const size_t elem_size)
+{
+	// Smallest number of elements whose size is a multiple of MEM_ALIGN
+	int step = 1;
+	while ((step * elem_size) % MEM_ALIGN) step++;
+
+	return ROUND_UP(n, step);
+}
+
+size_t mem_usage(const enum mem_type type)
+{
+	return __atomic_load_n(&usage[type], __ATOMIC_RELAXED);
+}
+
+size_t mem_peak_usage(const enum mem_type type)
+{
+	return __atomic_load_n(&peak_usage[type], __ATOMIC_RELAXED);
+}
+
+const char *mem_type_name(const enum mem_type type)
+{
+	const char *name[MEM_NUM_TYPES] = {"fields", "current", "particles"};
+	return name[type];
+}
+
+// Arrays of the STREAM triad (a = b + s * c)
+typedef struct {
+	float *a, *b, *c;
+	size_t n;
+} t_stream;
+
+static void stream_triad(void *arg)
+{
+	const t_stream *st = arg;
+	float *restrict const a = st->a;
+	const float *restrict const b = st->b;
+	const float *restrict const c = st->c;
+	const float s = 3.0f;
+
+	for (size_t i = 0; i < st->n; i++)
+		a[i] = b[i] + s * c[i];
+}
+
+double mem_stream_bandwidth(const size_t size)
+{
+	t_stream st;
+	st.n = size / sizeof(float);
+	st.a = mem_alloc(st.n * sizeof(float), MEM_FIELDS);
+	st.b = mem_alloc(st.n * sizeof(float), MEM_FIELDS);
+	st.c = mem_alloc(st.n * sizeof(float), MEM_FIELDS);
+
+	for (size_t i = 0; i < st.n; i++)
+	{
+		st.a[i] = 0.0f;
+		st.b[i] = 1.0f;
+		st.c[i] = 2.0f;
+	}
+
+	const double time = timer_bench(stream_triad, &st);
+
+	mem_free(st.a);
+	mem_free(st.b);
+	mem_free(st.c);
+
+	return 3.0 * st.n * sizeof(float) / time / 1E9;
+}
+
+int numa_num_nodes(void)
+{
+#ifdef ENABLE_NUMA
+	nanos6_bitmask_t mask;
+	nanos6_bitmask_set_wildcard(&mask, NUMA_ALL_ACTIVE);
+
+	const int n = nanos6_count_setbits(&mask);
+	return n > 0 ? n : 1;
+#else
+	return 1;
+#endif
+}
+
+bool numa_page_count(const void *ptr, const size_t size, const int numa_node, long *total,
+		long *local)
+{
+#ifdef SYS_move_pages
+	const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+	const uintptr_t first = (uintptr_t) ptr & ~(page_size - 1);
+	const long n_pages = ((uintptr_t) ptr + size - first + page_size - 1) / page_size;
+	const long n = (n_pages < NUMA_SAMPLE_PAGES) ? n_pages : NUMA_SAMPLE_PAGES;
+
+	void *pages[NUMA_SAMPLE_PAGES];
+	int status[NUMA_SAMPLE_PAGES];
+
+	for (long k = 0; k < n; k++)
+		pages[k] = (void*) (first + (k * n_pages / n) * page_size);
+
+	// Query the node of each page (move_pages without target nodes)
+	if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0) return false;
+
+	for (long k = 0; k < n; k++)
+	{
+		if (status[k] < 0) continue;	// Page not allocated yet
+
+		(*total)++;
+		if (status[k] == numa_node) (*local)++;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
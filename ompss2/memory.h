@@ -0,0 +1,58 @@
+/*
+ *  memory.h
+ *  zpic
+ *
+ *  Allocation of the field, current and particle buffers
+ *
+ */
+
+#ifndef __MEMORY__
+#define __MEMORY__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Alignment of all the buffers (cache line) and size of the huge pages. Buffers of at least one
+// huge page are backed by huge pages (transparent by default, see mem_huge_pages_name)
+#define MEM_ALIGN 64
+#define MEM_HUGE_PAGE (2 * 1024 * 1024)
+
+// Subsystems (memory usage is tracked for each one)
+enum mem_type {
+	MEM_FIELDS, MEM_CURRENT, MEM_PARTICLES, MEM_NUM_TYPES
+};
+
+// Allocate a buffer aligned to MEM_ALIGN
+void *mem_alloc(const size_t size, const enum mem_type type);
+
+// Allocate a zeroed buffer. With ENABLE_NUMA, the buffer is placed in the given NUMA node and
+// tracked by the runtime (the tasks that access it are scheduled in that node)
+void *mem_alloc_node(const size_t size, const enum mem_type type, const int numa_node);
+
+// Resize a buffer, keeping the first copy_size bytes (the buffer is reused if it is large enough)
+void *mem_realloc(void *ptr, const size_t copy_size, const size_t size, const enum mem_type type);
+void mem_free(void *ptr);
+
+// Row pitch (in elements) of a grid with n elements per row, so that each row starts aligned
+int mem_row_pitch(const int n, const size_t elem_size);
+
+// Current and peak memory usage of each subsystem (in bytes)
+size_t mem_usage(const enum mem_type type);
+size_t mem_peak_usage(const enum mem_type type);
+const char *mem_type_name(const enum mem_type type);
+
+// Bandwidth (GB/s) of the STREAM triad in one thread, with three arrays of the given size (in bytes)
+double mem_stream_bandwidth(const size_t size);
+
+// Huge page mode (environment variable ZPIC_HUGE_PAGES=thp|explicit|off)
+const char *mem_huge_pages_name(void);
+
+// Number of NUMA nodes used by the runtime (1 without ENABLE_NUMA)
+int numa_num_nodes(void);
+
+// Number of pages of the buffer (sampled) and how many of them are in the NUMA node. Returns false
+// if the page location is not available
+bool numa_page_count(const void *ptr, const size_t size, const int numa_node, long *total,
+		long *local);
+
+#endif
@@ -13,6 +13,8 @@
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
+#include <assert.h>
+#include <nanos6.h>
 
 #include "particles.h"
 
@@ -22,109 +24,578 @@
 
 #include "zdf.h"
 #include "timer.h"
+#include "simd.h"
+
+// Number of particles pushed by each call of the push kernel
+#define PUSH_BATCH 256
+
+// Compact the particle buffer when more than 1 / HOLE_COMPACT_RATIO of it are holes
+#define HOLE_COMPACT_RATIO 8
+
+// The exchange buffers (incoming queues and hole list) are kept EXCHANGE_HEADROOM times larger
+// than the high-water mark of the particles (or holes) in one iteration
+#define EXCHANGE_HEADROOM 2
+
+// Number of particles initialised by each task
+#define SET_U_BLOCK 65536
+
+#ifdef ENABLE_TILE_CACHE
+// Tile cache: the window around each tile (TILE_HALO extra cells in each direction) and the
+// minimum number of consecutive particles in a window to use the cache
+#define TILE_HALO 2
+#define TILE_WINDOW (TILE_SIZE + 2 * TILE_HALO)
+#define TILE_MIN_PART 64
+#define TILE_FLD_NROW (TILE_WINDOW + 2)
+#define TILE_J_NROW (TILE_WINDOW + 3)
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
 
 /*********************************************************************************************
  Vector Handling
  *********************************************************************************************/
-// Manual reallocation of buffers
-void realloc_vector(void **restrict ptr, const int old_size, const int new_size, const size_t type_size)
+// Manual reallocation of buffers (only the first old_size elements are copied)
+void realloc_vector(void **restrict ptr, const int old_size, const int new_size, const size_t type_size,
+		const enum mem_type type)
+{
+	*ptr = mem_realloc(*ptr, old_size * type_size, new_size * type_size, type);
+}
+
+void part_vector_alloc(t_part_vector *vector, const int size_max)
+{
+	vector->ix = mem_alloc(size_max * sizeof(int), MEM_PARTICLES);
+	vector->iy = mem_alloc(size_max * sizeof(int), MEM_PARTICLES);
+	vector->x = mem_alloc(size_max * sizeof(t_part_data), MEM_PARTICLES);
+	vector->y = mem_alloc(size_max * sizeof(t_part_data), MEM_PARTICLES);
+	vector->ux = mem_alloc(size_max * sizeof(t_part_data), MEM_PARTICLES);
+	vector->uy = mem_alloc(size_max * sizeof(t_part_data), MEM_PARTICLES);
+	vector->uz = mem_alloc(size_max * sizeof(t_part_data), MEM_PARTICLES);
+
+	vector->size_max = size_max;
+	vector->size = 0;
+	vector->n_grow = 0;
+}
+
+void part_vector_free(t_part_vector *vector)
+{
+	mem_free(vector->ix);
+	mem_free(vector->iy);
+	mem_free(vector->x);
+	mem_free(vector->y);
+	mem_free(vector->ux);
+	mem_free(vector->uy);
+	mem_free(vector->uz);
+}
+
+// Grow the buffer to at least new_size particles. The capacity grows geometrically, so a buffer
+// that grows a few particles at a time is not copied in every call
+void part_vector_realloc(t_part_vector *vector, const int new_size)
+{
+	const int size_max = vector->size_max + vector->size_max / 2;
+	vector->size_max = (new_size > size_max) ? new_size : size_max;
+	vector->n_grow++;
+
+	realloc_vector((void**) &vector->ix, vector->size, vector->size_max, sizeof(int), MEM_PARTICLES);
+	realloc_vector((void**) &vector->iy, vector->size, vector->size_max, sizeof(int), MEM_PARTICLES);
+	realloc_vector((void**) &vector->x, vector->size, vector->size_max, sizeof(t_part_data),
+			MEM_PARTICLES);
+	realloc_vector((void**) &vector->y, vector->size, vector->size_max, sizeof(t_part_data),
+			MEM_PARTICLES);
+	realloc_vector((void**) &vector->ux, vector->size, vector->size_max, sizeof(t_part_data),
+			MEM_PARTICLES);
+	realloc_vector((void**) &vector->uy, vector->size, vector->size_max, sizeof(t_part_data),
+			MEM_PARTICLES);
+	realloc_vector((void**) &vector->uz, vector->size, vector->size_max, sizeof(t_part_data),
+			MEM_PARTICLES);
+}
+
+void part_vector_assign_valid_part(const t_part_vector *source, const int source_idx,
+		t_part_vector *target, const int target_idx)
+{
+	target->ix[target_idx] = source->ix[source_idx];
+	target->iy[target_idx] = source->iy[source_idx];
+	target->x[target_idx] = source->x[source_idx];
+	target->y[target_idx] = source->y[source_idx];
+	target->ux[target_idx] = source->ux[source_idx];
+	target->uy[target_idx] = source->uy[source_idx];
+	target->uz[target_idx] = source->uz[source_idx];
+}
+
+void part_vector_memcpy(const t_part_vector *source, t_part_vector *target, const int begin,
+		const int size)
+{
+	memcpy(target->ix, source->ix + begin, size * sizeof(int));
+	memcpy(target->iy, source->iy + begin, size * sizeof(int));
+	memcpy(target->x, source->x + begin, size * sizeof(t_part_data));
+	memcpy(target->y, source->y + begin, size * sizeof(t_part_data));
+	memcpy(target->ux, source->ux + begin, size * sizeof(t_part_data));
+	memcpy(target->uy, source->uy + begin, size * sizeof(t_part_data));
+	memcpy(target->uz, source->uz + begin, size * sizeof(t_part_data));
+}
+
+// Remove the invalid particles, keeping the order of the remaining ones (stream compaction)
+static void part_vector_compact(t_part_vector *vector, const int begin)
+{
+	int size = begin;
+
+	for (int i = begin; i < vector->size; i++)
+		if (vector->ix[i] != PART_INVALID)
+			part_vector_assign_valid_part(vector, i, vector, size++);
+
+	vector->size = size;
+}
+
+// Allocate an empty queue (the capacity is rounded up to a power of 2)
+static void part_queue_alloc(t_part_queue *queue, const int size)
+{
+	int capacity = 1;
+	while (capacity < size) capacity *= 2;
+
+	part_vector_alloc(&queue->buf, capacity);
+	part_vector_alloc(&queue->overflow[0], 0);
+	part_vector_alloc(&queue->overflow[1], 0);
+
+	queue->head = 0;
+	queue->tail = 0;
+	queue->head_cache = 0;
+	queue->overflow_on = false;
+
+	queue->has_producer = true;
+
+	// Nothing was sent before the first iteration (see spec_merge_vectors)
+	queue->mark[0] = queue->mark[1] = 0;
+	queue->published = 0;
+	queue->consumed = -1;
+	queue->waiter = NULL;
+}
+
+static void part_queue_free(t_part_queue *queue)
 {
-	if(*ptr == NULL) *ptr = malloc(new_size * type_size);
-	else
+	part_vector_free(&queue->buf);
+	part_vector_free(&queue->overflow[0]);
+	part_vector_free(&queue->overflow[1]);
+}
+
+// Append a particle to the queue (producer). Once the queue is full, the particles of the rest of
+// the iteration go to the overflow buffer, so the consumer reads them in the order they were sent
+static inline void part_queue_push(t_part_queue *queue, const t_part_vector *source, const int idx,
+		const int iter)
+{
+	const unsigned int capacity = queue->buf.size_max;
+
+	// The queue looks full, read the consumer position again
+	if (!queue->overflow_on && queue->tail - queue->head_cache == capacity)
 	{
-		void *restrict temp = malloc(new_size * type_size);
+		queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+		queue->overflow_on = queue->tail - queue->head_cache == capacity;
+	}
 
-		if(temp)
-		{
-			memcpy(temp, *ptr, old_size * type_size);
-			free(*ptr);
-			*ptr = temp;
-		}else
+	if (queue->overflow_on)
+	{
+		t_part_vector *overflow = &queue->overflow[iter & 1];
+		if (overflow->size + 1 > overflow->size_max)
+			part_vector_realloc(overflow, overflow->size_max + 1024);
+
+		part_vector_assign_valid_part(source, idx, overflow, overflow->size++);
+	} else
+	{
+		part_vector_assign_valid_part(source, idx, &queue->buf, queue->tail & (capacity - 1));
+		queue->tail++;
+	}
+}
+
+// Wait until the iteration counter of the other side of the queue (published or consumed) reaches
+// iter. The task is blocked in the runtime, so the core runs other tasks in the meantime. The
+// side that advances the counter unblocks the task (see part_queue_notify), which may happen
+// before the task blocks. Never waits outside the tasks (all the tasks have finished)
+static void part_queue_wait(t_part_queue *queue, const int *counter, const int iter)
+{
+	while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < iter)
+	{
+		void *context = nanos6_get_current_blocking_context();
+		__atomic_store_n(&queue->waiter, context, __ATOMIC_SEQ_CST);
+
+		// The counter may have advanced before the waiter was set. If nobody took the waiter,
+		// there is no unblock to consume
+		if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) >= iter
+				&& __atomic_exchange_n(&queue->waiter, NULL, __ATOMIC_SEQ_CST) == context)
+			break;
+
+		nanos6_block_current_task(context);
+	}
+}
+
+// Advance the counter of this side of the queue to iter and unblock the other side, if waiting
+static void part_queue_notify(t_part_queue *queue, int *counter, const int iter)
+{
+	__atomic_store_n(counter, iter, __ATOMIC_SEQ_CST);
+
+	void *waiter = __atomic_exchange_n(&queue->waiter, NULL, __ATOMIC_SEQ_CST);
+	if (waiter) nanos6_unblock_task(waiter);
+}
+
+// Publish the particles sent in the iteration (producer)
+static void part_queue_publish(t_part_queue *queue, const int iter)
+{
+	queue->mark[iter & 1] = queue->tail;
+	queue->overflow_on = false;
+	part_queue_notify(queue, &queue->published, iter);
+}
+
+// Wait until the consumer has drained the iteration that used the same parity, so the particles
+// of the iteration iter can be sent (producer). The field solve of the adjacent region depends on
+// the current deposited by this region, so in practice this does not wait
+static inline void part_queue_reserve(t_part_queue *queue, const int iter)
+{
+	part_queue_wait(queue, &queue->consumed, iter - 2);
+}
+
+// Number of particles sent in the iteration that are in the queue (consumer). The push of the
+// adjacent regions in an iteration usually finishes before the push of this region in the next
+// one starts (the field solve of this region depends on their current), so this rarely waits
+static inline int part_queue_drain_size(t_part_queue *queue, const int iter)
+{
+	part_queue_wait(queue, &queue->published, iter);
+	return queue->mark[iter & 1] - queue->head;
+}
+
+// Fill the holes left by the particles that exited the region, starting from the hole h (the
+// first ones were filled by the incoming particles). The holes are filled with the particles at
+// the end of the buffer or, if there are too many, the buffer is compacted
+static void spec_fill_holes(t_species *spec, const int h)
+{
+	t_part_vector *restrict const vector = &spec->main_vector;
+	const int *restrict const holes = spec->holes;
+
+	if (spec->n_holes > spec->holes_hwm) spec->holes_hwm = spec->n_holes;
+
+	const int n_holes = spec->n_holes - h;
+
+	if (n_holes > vector->size / HOLE_COMPACT_RATIO)
+	{
+		part_vector_compact(vector, holes[h]);
+
+	} else if (n_holes > 0)
+	{
+		// Fill the holes (from the lowest index) with the last particles of the buffer. The holes
+		// are sorted, so if the last particle is also a hole, it is simply discarded
+		int lo = h;
+		int hi = spec->n_holes - 1;
+
+		while (lo <= hi)
 		{
-			printf("Error in allocating particle vector. Exiting...\n");
-			exit(1);
+			const int last = vector->size - 1;
+
+			if (holes[hi] == last) hi--;
+			else part_vector_assign_valid_part(vector, last, vector, holes[lo++]);
+
+			vector->size--;
 		}
 	}
+
+	spec->n_holes = 0;
+
+	// Pre-size the (empty) hole list for the next iterations, so the push does not have to grow it
+	if (spec->holes_max < EXCHANGE_HEADROOM * spec->holes_hwm)
+	{
+		realloc_vector((void**) &spec->holes, 0, EXCHANGE_HEADROOM * spec->holes_hwm, sizeof(int),
+				MEM_PARTICLES);
+		spec->holes_max = EXCHANGE_HEADROOM * spec->holes_hwm;
+		spec->exchange_merge_grow++;
+	}
 }
 
-// Add the incoming particles to the main buffer
+// Add the particles sent by the adjacent regions in the previous iteration to the main buffer.
+// The incoming particles fill the holes left by the particles that exited the region (hole list)
+// first. Called at the beginning of the push and after waiting for all the tasks (in this case,
+// the push drains nothing)
 void spec_merge_vectors(t_species *spec)
 {
-	int i = 0, j, k;
-	int size = spec->main_vector.size;
+	t_part_vector *restrict const vector = &spec->main_vector;
+	const int *restrict const holes = spec->holes;
+	const int iter = spec->iter;
+	int h = 0;
 
-	//Loop through all the 2 temp buffers
-	for (k = 0; k < 2; k++)
+	for (int k = 0; k < NUM_ADJ_PART; k++)
 	{
-		int size_temp = spec->incoming_part[k].size;
+		t_part_queue *queue = &spec->incoming_part[k];
+		t_part_vector *overflow = &queue->overflow[iter & 1];
+		const unsigned int mask = queue->buf.size_max - 1;
+
+		// Nothing is sent across the x edges of the box with a moving window
+		if (!queue->has_producer) continue;
+
+		const int n_queue = part_queue_drain_size(queue, iter);
+		const int size_temp = n_queue + overflow->size;
+		if (size_temp > spec->exchange_hwm[k]) spec->exchange_hwm[k] = size_temp;
 
 		// Check if buffer is large enough and if not reallocate
-		if (spec->main_vector.size + size_temp > spec->main_vector.size_max)
-		{
-			spec->main_vector.size_max = ((spec->main_vector.size_max + size_temp) / 1024 + 1) * 1024;
-			realloc_vector(&spec->main_vector.data, spec->main_vector.size, spec->main_vector.size_max, sizeof(t_part));
-		}
+		if (vector->size + size_temp > vector->size_max)
+			part_vector_realloc(vector, ((vector->size_max + size_temp) / 1024 + 1) * 1024);
 
-		//Loop through all elements on the buffer, copying to the main_vector particle buffer (if applicable)
-		for (j = 0; j < size_temp; j++)
+		// Copy the incoming particles (in the order they were sent) to the holes first and then to
+		// the end of the buffer
+		for (int j = 0; j < size_temp; j++)
 		{
-			while (i < size && !spec->main_vector.data[i].invalid) i++;   //Checks if a particle can be safely deleted
-			if (i < size) spec->main_vector.data[i] = spec->incoming_part[k].data[j];
-			else
-			{
-				spec->main_vector.size++;
-				spec->main_vector.data[i] = spec->incoming_part[k].data[j];
-				i++;
-			}
+			const t_part_vector *source = (j < n_queue) ? &queue->buf : overflow;
+			const int idx = (j < n_queue) ? (int) ((queue->head + j) & mask) : j - n_queue;
+
+			if (h < spec->n_holes) part_vector_assign_valid_part(source, idx, vector, holes[h++]);
+			else part_vector_assign_valid_part(source, idx, vector, vector->size++);
 		}
+
+		// Release the slots to the producer
+		__atomic_store_n(&queue->head, queue->head + n_queue, __ATOMIC_RELEASE);
+
+		spec->exchange_overflow += overflow->size;
+		spec->exchange_push_grow += overflow->n_grow;
+		overflow->size = 0;
+		overflow->n_grow = 0;
+
+		// The producer can reuse the overflow buffer and the mark of this iteration
+		part_queue_notify(queue, &queue->consumed, iter);
 	}
 
-	if (i < size)
+	spec_fill_holes(spec, h);
+}
+
+// Grow the incoming queues to EXCHANGE_HEADROOM times the high-water mark of the particles
+// received in one iteration. The queues must be empty (after spec_merge_vectors) and their
+// producers idle
+void spec_resize_queues(t_species *spec)
+{
+	for (int k = 0; k < NUM_ADJ_PART; k++)
 	{
-		while (i < spec->main_vector.size)
+		t_part_queue *queue = &spec->incoming_part[k];
+		assert(queue->head == queue->tail);
+
+		if (queue->buf.size_max < EXCHANGE_HEADROOM * spec->exchange_hwm[k])
 		{
-			if (spec->main_vector.data[i].invalid)
-				spec->main_vector.data[i] = spec->main_vector.data[--spec->main_vector.size];
-			else i++;
+			int capacity = queue->buf.size_max;
+			while (capacity < EXCHANGE_HEADROOM * spec->exchange_hwm[k]) capacity *= 2;
+
+			part_vector_free(&queue->buf);
+			part_vector_alloc(&queue->buf, capacity);
+			spec->exchange_merge_grow++;
 		}
 	}
+}
+
+// Add the particle index to the hole list
+static void spec_add_hole(t_species *spec, const int idx)
+{
+	if (spec->n_holes + 1 > spec->holes_max)
+	{
+		const int holes_max = spec->holes_max + spec->holes_max / 2 + 1024;
+		realloc_vector((void**) &spec->holes, spec->n_holes, holes_max, sizeof(int), MEM_PARTICLES);
+		spec->holes_max = holes_max;
+		spec->exchange_push_grow++;
+	}
+
+	spec->holes[spec->n_holes++] = idx;
+}
+
+// Check if the particle is inside the cells [limits[0][0], limits[0][1]) x [limits[1][0], limits[1][1])
+static inline bool part_vector_is_inside(const t_part_vector *vector, const int idx,
+		const int limits[2][2])
+{
+	return vector->ix[idx] >= limits[0][0] && vector->ix[idx] < limits[0][1]
+			&& vector->iy[idx] >= limits[1][0] && vector->iy[idx] < limits[1][1];
+}
+
+// Move the particles of vector that are inside (inside = true) or outside (inside = false) the
+// cells given by limits to the end of target. The remaining particles keep their order
+void part_vector_move_cells(t_part_vector *vector, const int limits[2][2], const bool inside,
+		t_part_vector *target)
+{
+	int n_move = 0;
+	for (int i = 0; i < vector->size; i++)
+		if (part_vector_is_inside(vector, i, limits) == inside) n_move++;
+
+	if (target->size + n_move > target->size_max)
+		part_vector_realloc(target, ((target->size + n_move) / 1024 + 1) * 1024);
+
+	int size = 0;
+	for (int i = 0; i < vector->size; i++)
+	{
+		if (part_vector_is_inside(vector, i, limits) == inside)
+			part_vector_assign_valid_part(vector, i, target, target->size++);
+		else part_vector_assign_valid_part(vector, i, vector, size++);
+	}
+
+	vector->size = size;
+}
+
+/*********************************************************************************************
+ Sorting
+ *********************************************************************************************/
+// Move each element of a particle attribute to its sorted position. Since the sorted data
+// is written to the auxiliary buffer, both buffers are swapped at the end
+static void spec_apply_sort(void **restrict attr, void **restrict buffer, const int *restrict pos,
+		const int size)
+{
+	const uint32_t *restrict source = *attr;
+	uint32_t *restrict target = *buffer;
 
-	//Clean the temp buffer
-	for (k = 0; k < 2; k++)
-		spec->incoming_part[k].size = 0;
+	for (int i = 0; i < size; i++)
+		target[pos[i]] = source[i];
 
+	void *temp = *attr;
+	*attr = *buffer;
+	*buffer = temp;
 }
 
-// Add particle to the outgoing buffer
-void spec_add_to_outgoing_vector(t_part_vector *temp, t_part part)
+// Sort the particles by tile (counting sort). Particles in the same tile are kept in
+// their original order. The particles must be inside the region (the holes are filled first and
+// the particles sent by the adjacent regions are only added by the next push). The particles
+// are only sorted every n_sort iterations (the task can be created in all iterations)
+void spec_sort(t_species *spec, const int limits[2][2])
 {
-	if (temp->size + 1 > temp->size_max)
+	if (spec->n_sort <= 0 || spec->iter % spec->n_sort != 0) return;
+
+	uint64_t t0 = timer_ticks();
+
+	spec_fill_holes(spec, 0);
+
+	// Tiles of the region in the absolute cells of the particles
+	const int offset_x = limits[0][0] + spec->n_move;
+
+	const int size = spec->main_vector.size;
+	const int n_tiles_x = (limits[0][1] - limits[0][0] + TILE_SIZE - 1) / TILE_SIZE;
+	const int n_tiles_y = (limits[1][1] - limits[1][0] + TILE_SIZE - 1) / TILE_SIZE;
+	const int n_tiles = n_tiles_x * n_tiles_y;
+
+	// The sorting buffers are only reallocated when the particle buffer or the region grows. The
+	// scratch buffer is swapped with the particle arrays, so it must come from the same allocator
+	if (spec->sort_buffer_max < spec->main_vector.size_max)
+	{
+		mem_free(spec->sort_buffer);
+		spec->sort_buffer_max = spec->main_vector.size_max;
+		spec->sort_buffer = mem_alloc(spec->sort_buffer_max * sizeof(uint32_t), MEM_PARTICLES);
+	}
+
+	if (spec->sort_pos_max < size)
+	{
+		free(spec->sort_pos);
+		spec->sort_pos_max = spec->main_vector.size_max;
+		spec->sort_pos = malloc(spec->sort_pos_max * sizeof(int));
+	}
+
+	if (spec->sort_n_tiles_max < n_tiles)
+	{
+		free(spec->sort_tile_offset);
+		spec->sort_n_tiles_max = n_tiles;
+		spec->sort_tile_offset = malloc((n_tiles + 1) * sizeof(int));
+	}
+
+	if ((!spec->sort_buffer && spec->sort_buffer_max > 0) || (!spec->sort_pos && size > 0)
+			|| !spec->sort_tile_offset)
+	{
+		printf("Error in allocating the sorting buffers. Exiting...\n");
+		exit(1);
+	}
+
+	int *restrict tile_offset = spec->sort_tile_offset;
+	int *restrict pos = spec->sort_pos;
+	void *buffer = spec->sort_buffer;
+
+	memset(tile_offset, 0, (n_tiles + 1) * sizeof(int));
+
+	// Calculate the histogram (number of particles per tile)
+	for (int i = 0; i < size; i++)
 	{
-		temp->size_max = temp->size_max + 1024;
-		realloc_vector(&temp->data, temp->size, temp->size_max, sizeof(t_part));
+		int ix = (spec->main_vector.ix[i] - offset_x) / TILE_SIZE;
+		int iy = (spec->main_vector.iy[i] - limits[1][0]) / TILE_SIZE;
+
+		pos[i] = ix + iy * n_tiles_x;
+		tile_offset[pos[i] + 1]++;
 	}
 
-	temp->data[temp->size] = part;
-	temp->size++;
+	// Prefix sum to find the initial idx of each tile in the particle vector
+	for (int k = 0; k < n_tiles; k++)
+		tile_offset[k + 1] += tile_offset[k];
+
+	// Calculate the target position of each particle
+	for (int i = 0; i < size; i++)
+		pos[i] = tile_offset[pos[i]]++;
+
+	// Organize the particles in tiles based on the position vector
+	spec_apply_sort((void**) &spec->main_vector.ix, &buffer, pos, size);
+	spec_apply_sort((void**) &spec->main_vector.iy, &buffer, pos, size);
+	spec_apply_sort((void**) &spec->main_vector.x, &buffer, pos, size);
+	spec_apply_sort((void**) &spec->main_vector.y, &buffer, pos, size);
+	spec_apply_sort((void**) &spec->main_vector.ux, &buffer, pos, size);
+	spec_apply_sort((void**) &spec->main_vector.uy, &buffer, pos, size);
+	spec_apply_sort((void**) &spec->main_vector.uz, &buffer, pos, size);
+
+	// The buffer now holds the old array of the last attribute (with at least size_max values)
+	spec->sort_buffer = buffer;
+	spec->sort_buffer_max = spec->main_vector.size_max;
+
+	// The push time after this point is compared with the one before sorting
+	spec->push_rate_unsorted = spec->push_rate;
+	spec->sort_time += timer_interval_seconds(t0, timer_ticks());
+	spec->n_sorts++;
 }
 
 /*********************************************************************************************
  Initialization
  *********************************************************************************************/
 
-// Set the momentum of the injected particles
+// Set the momentum of the particles in [begin, end). The random numbers of each particle are
+// keyed on its absolute cell (ix, iy) and its index inside the cell, so the result does not
+// depend on the region decomposition or on the order of the injections
+#pragma oss task label("Spec Set U") out(vector->ux[begin; end - begin]) \
+	out(vector->uy[begin; end - begin]) out(vector->uz[begin; end - begin])
+static void spec_set_u_block(t_part_vector *vector, const int start, const int begin,
+		const int end, const t_part_data ufl[3], const t_part_data uth[3], const int npc,
+		const uint32_t key[2])
+{
+	uint32_t ctr[RAND_BATCH][4], bits[RAND_BATCH][4];
+	float norm[RAND_BATCH][4];
+
+	for (int k = begin; k < end; k += RAND_BATCH)
+	{
+		const int n = (k + RAND_BATCH > end) ? end - k : RAND_BATCH;
+
+		for (int i = 0; i < n; i++)
+		{
+			ctr[i][0] = vector->ix[k + i];
+			ctr[i][1] = vector->iy[k + i];
+			ctr[i][2] = (k + i - start) % npc;
+			ctr[i][3] = 0;
+		}
+
+		rand_philox4x32(n, ctr, key, bits);
+		rand_norm4(n, bits, norm);
+
+		for (int i = 0; i < n; i++)
+		{
+			vector->ux[k + i] = ufl[0] + uth[0] * norm[i][0];
+			vector->uy[k + i] = ufl[1] + uth[1] * norm[i][1];
+			vector->uz[k + i] = ufl[2] + uth[2] * norm[i][2];
+		}
+	}
+}
+
+// Set the momentum of the injected particles (npc particles per cell, starting at start)
 void spec_set_u(t_part_vector *vector, const int start, const int end, const t_part_data ufl[3],
-		const t_part_data uth[3])
+		const t_part_data uth[3], const int npc, const int spec_id)
 {
-	for (int i = start; i < end; i++)
+	const uint32_t key[2] = {philox_seed(), spec_id};
+
+	for (int begin = start; begin < end; begin += SET_U_BLOCK)
 	{
-		vector->data[i].ux = ufl[0] + uth[0] * rand_norm();
-		vector->data[i].uy = ufl[1] + uth[1] * rand_norm();
-		vector->data[i].uz = ufl[2] + uth[2] * rand_norm();
+		const int block_end = (begin + SET_U_BLOCK > end) ? end : begin + SET_U_BLOCK;
+		spec_set_u_block(vector, start, begin, block_end, ufl, uth, npc, key);
 	}
+
+	#pragma oss taskwait
 }
 
-// Set the initial position of the particles
+// Set the initial position of the particles. The range is given in cells of the simulation window,
+// while the cell index of the particles is absolute (the window moved n_move cells)
 void spec_set_x(t_part_vector *vector, const int range[][2], const int ppc[2],
 		const t_density *part_density, const t_part_data dx[2], const int n_move)
 {
@@ -185,11 +656,10 @@ void spec_set_x(t_part_vector *vector, const int range[][2], const int ppc[2],
 		{
 			for (int k = 0; k < npc; k++)
 			{
-				vector->data[ip].ix = i;
-				vector->data[ip].iy = j;
-				vector->data[ip].x = poscell[2 * k];
-				vector->data[ip].y = poscell[2 * k + 1];
-				vector->data[ip].invalid = false;
+				vector->ix[ip] = i + n_move;
+				vector->iy[ip] = j;
+				vector->x[ip] = poscell[2 * k];
+				vector->y[ip] = poscell[2 * k + 1];
 				ip++;
 			}
 		}
@@ -202,7 +672,7 @@ void spec_set_x(t_part_vector *vector, const int range[][2], const int ppc[2],
 // Inject the particles in the simulation
 void spec_inject_particles(t_part_vector *part_vector, const int range[][2], const int ppc[2],
 		const t_density *part_density, const t_part_data dx[2], const int n_move,
-		const t_part_data ufl[3], const t_part_data uth[3])
+		const t_part_data ufl[3], const t_part_data uth[3], const int spec_id)
 {
 	int start = part_vector->size;
 
@@ -211,17 +681,13 @@ void spec_inject_particles(t_part_vector *part_vector, const int range[][2], con
 
 	// Check if buffer is large enough and if not reallocate
 	if (start + np_inj > part_vector->size_max)
-	{
-		part_vector->size_max = ((part_vector->size_max + np_inj) / 1024 + 1) * 1024;
-		if(!part_vector->data) part_vector->data = malloc(part_vector->size_max * sizeof(t_part));
-		else realloc_vector(&part_vector->data, part_vector->size, part_vector->size_max, sizeof(t_part));
-	}
+		part_vector_realloc(part_vector, ((part_vector->size_max + np_inj) / 1024 + 1) * 1024);
 
 	// Set particle positions
 	spec_set_x(part_vector, range, ppc, part_density, dx, n_move);
 
 	// Set momentum of injected particles
-	spec_set_u(part_vector, start, part_vector->size, ufl, uth);
+	spec_set_u(part_vector, start, part_vector->size, ufl, uth, ppc[0] * ppc[1], spec_id);
 }
 
 // Constructor
@@ -250,18 +716,11 @@ void spec_new(t_species *spec, char name[], const t_part_data m_q, const int ppc
 	spec->dt = dt;
 	spec->energy = 0;
 
-	// Initialize particle buffer
-	spec->main_vector.size_max = 0;
-	spec->main_vector.data = NULL;
-	spec->main_vector.size = 0;
+	// Select the particle push kernel for this CPU
+	spec_select_push_kernel();
 
-	// Initialize temp buffer
-	for (int i = 0; i < 2; i++)
-	{
-		spec->incoming_part[i].size_max = spec->nx[0] / 4;
-		spec->incoming_part[i].data = malloc(spec->incoming_part[i].size_max * sizeof(t_part));
-		spec->incoming_part[i].size = 0;
-	}
+	// Initialize particle buffer
+	spec->main_vector = (t_part_vector) {0};
 
 	// Initialize density profile
 	if (density)
@@ -306,33 +765,132 @@ void spec_new(t_species *spec, char name[], const t_part_data m_q, const int ppc
 	// Reset moving window information
 	spec->moving_window = false;
 	spec->n_move = 0;
+
+	// Empty hole list
+	spec->holes = NULL;
+	spec->n_holes = 0;
+	spec->holes_max = 0;
+
+	// No particles exchanged yet
+	for (int i = 0; i < NUM_ADJ_PART; i++)
+		spec->exchange_hwm[i] = 0;
+	spec->holes_hwm = 0;
+	spec->exchange_overflow = 0;
+	spec->exchange_push_grow = 0;
+	spec->exchange_merge_grow = 0;
+
+	// No chunks by default (one task per species and region)
+	spec->chunk_size = 0;
+	spec->J_chunk = NULL;
+	spec->n_J_chunk = 0;
+	spec->push_stats = NULL;
+	spec->n_push_stats = 0;
+
+	// Reset sorting information
+	spec->n_sort = 0;
+	spec->n_sorts = 0;
+	spec->sort_time = 0.0;
+	spec->push_time = 0.0;
+	spec->push_time_saved = 0.0;
+	spec->push_rate = 0.0;
+	spec->push_rate_unsorted = 0.0;
+
+	spec->sort_buffer = NULL;
+	spec->sort_buffer_max = 0;
+	spec->sort_pos = NULL;
+	spec->sort_pos_max = 0;
+	spec->sort_tile_offset = NULL;
+	spec->sort_n_tiles_max = 0;
+
+	// Species index in the simulation (set by sim_new and region_new)
+	spec->id = 0;
+
+	// Boris pusher by default
+	spec->pusher = BORIS;
+	spec->pusher_time = 0.0;
+
+	// Zamb current deposit by default
+	spec->deposit = ZAMB;
+	for (int c = 0; c < NUM_SPLIT_CASES; c++)
+		spec->dep_case_count[c] = 0.0;
 }
 
-void spec_delete(t_species *spec)
+// Inject the initial particles of the cells [limits[0][0], limits[0][1]) x
+// [limits[1][0], limits[1][1]) of the simulation box
+// Allocate the incoming queues with room for all the particles of the boundary cells of the
+// region (the particles move less than one cell per iteration, so only the particles in the
+// boundary cells of the adjacent region can cross each edge or corner)
+void spec_init_queues(t_species *spec, const int limits[2][2])
 {
-	free(spec->main_vector.data);
-	spec->main_vector.size = -1;
+	const int nx[2] = {limits[0][1] - limits[0][0], limits[1][1] - limits[1][0]};
+	const int npc = spec->ppc[0] * spec->ppc[1];
 
-	for(int i = 0; i < 2; i++)
+	for (int dir = 0; dir < NUM_ADJ_PART; dir++)
 	{
-		free(spec->incoming_part[i].data);
-		spec->incoming_part[i].size = -1;
+		int cells = 1;
+		if (dir == PART_DOWN || dir == PART_UP) cells = nx[0];
+		else if (dir == PART_LEFT || dir == PART_RIGHT) cells = nx[1];
+
+		part_queue_alloc(&spec->incoming_part[dir], cells * npc);
 	}
 }
 
+void spec_init_particles(t_species *spec, const int limits[2][2])
+{
+	const int range[][2] = {{limits[0][0], limits[0][1]}, {limits[1][0], limits[1][1]}};
+	spec_inject_particles(&spec->main_vector, range, spec->ppc, &spec->density, spec->dx,
+			spec->n_move, spec->ufl, spec->uth, spec->id);
+}
+
+void spec_delete(t_species *spec)
+{
+	part_vector_free(&spec->main_vector);
+	spec->main_vector.size = -1;
+
+	for(int i = 0; i < NUM_ADJ_PART; i++)
+		part_queue_free(&spec->incoming_part[i]);
+
+	mem_free(spec->holes);
+	spec->n_holes = 0;
+
+	mem_free(spec->sort_buffer);
+	free(spec->sort_pos);
+	free(spec->sort_tile_offset);
+
+	spec_free_chunk_buffers(spec);
+}
+
+// Free the private current buffers and the statistics of the push chunks (they are allocated again if needed)
+void spec_free_chunk_buffers(t_species *spec)
+{
+	for (int c = 0; c < spec->n_J_chunk; c++)
+		mem_free(spec->J_chunk[c]);
+	mem_free(spec->J_chunk);
+	free(spec->push_stats);
+
+	spec->J_chunk = NULL;
+	spec->n_J_chunk = 0;
+	spec->push_stats = NULL;
+	spec->n_push_stats = 0;
+}
+
 /*********************************************************************************************
  Current deposition
  *********************************************************************************************/
 // Current deposition (Esirkepov method)
 void dep_current_esk(int ix0, int iy0, int di, int dj, t_part_data x0, t_part_data y0,
 		t_part_data x1, t_part_data y1, t_part_data qvx, t_part_data qvy, t_part_data qvz,
-		t_current *current)
+		t_fld *restrict const J, const int nrow)
 {
 
 	int i, j;
 	t_fld S0x[4], S0y[4], S1x[4], S1y[4], DSx[4], DSy[4];
 	t_fld Wx[16], Wy[16], Wz[16];
 
+	t_fld *restrict const Jx = J + FLD_COMP(0, nrow);
+	t_fld *restrict const Jy = J + FLD_COMP(1, nrow);
+	t_fld *restrict const Jz = J + FLD_COMP(2, nrow);
+
 	S0x[0] = 0.0f;
 	S0x[1] = 1.0f - x0;
 	S0x[2] = x0;
@@ -373,19 +931,16 @@ void dep_current_esk(int ix0, int iy0, int di, int dj, t_part_data x0, t_part_da
 	}
 
 	// jx
-	const int nrow = current->nrow;
-	t_vfld *restrict const J = current->J;
-
 	for (j = 0; j < 4; j++)
 	{
 		t_fld c;
 
 		c = -qvx * Wx[4 * j];
-		J[ix0 - 1 + (iy0 - 1 + j) * nrow].x += c;
+		Jx[FLD_CELL(ix0 - 1, iy0 - 1 + j, nrow)] += c;
 		for (i = 1; i < 4; i++)
 		{
 			c -= qvx * Wx[i + 4 * j];
-			J[ix0 + i - 1 + (iy0 - 1 + j) * nrow].x += c;
+			Jx[FLD_CELL(ix0 + i - 1, iy0 - 1 + j, nrow)] += c;
 		}
 	}
 
@@ -395,11 +950,11 @@ void dep_current_esk(int ix0, int iy0, int di, int dj, t_part_data x0, t_part_da
 		t_fld c;
 
 		c = -qvy * Wy[i];
-		J[ix0 + i - 1 + (iy0 - 1) * nrow].y += c;
+		Jy[FLD_CELL(ix0 + i - 1, iy0 - 1, nrow)] += c;
 		for (j = 1; j < 4; j++)
 		{
 			c -= qvy * Wy[i + 4 * j];
-			J[ix0 + i - 1 + (iy0 - 1 + j) * nrow].y += c;
+			Jy[FLD_CELL(ix0 + i - 1, iy0 - 1 + j, nrow)] += c;
 		}
 	}
 
@@ -408,22 +963,73 @@ void dep_current_esk(int ix0, int iy0, int di, int dj, t_part_data x0, t_part_da
 	{
 		for (i = 0; i < 4; i++)
 		{
-			J[ix0 + i - 1 + (iy0 - 1 + j) * nrow].z += qvz * Wz[i + 4 * j];
+			Jz[FLD_CELL(ix0 + i - 1, iy0 - 1 + j, nrow)] += qvz * Wz[i + 4 * j];
 		}
 	}
 
 }
 
-// Current deposition (adapted Villasenor-Bunemann method)
+// Virtual particle of the Zamb deposit (a trajectory segment inside a single cell)
+typedef struct {
+	float x0, x1, y0, y1, dx, dy, qvz;
+	int ix, iy;
+} t_vp;
+
+// Deposit the current of a single virtual particle
+static inline void dep_zamb_vp(const t_vp *restrict vp, const float qnx, const float qny,
+		t_fld *restrict const J, const int nrow)
+{
+	float S0x[2], S1x[2], S0y[2], S1y[2];
+	float wl1, wl2;
+	float wp1[2], wp2[2];
+
+	S0x[0] = 1.0f - vp->x0;
+	S0x[1] = vp->x0;
+
+	S1x[0] = 1.0f - vp->x1;
+	S1x[1] = vp->x1;
+
+	S0y[0] = 1.0f - vp->y0;
+	S0y[1] = vp->y0;
+
+	S1y[0] = 1.0f - vp->y1;
+	S1y[1] = vp->y1;
+
+	wl1 = qnx * vp->dx;
+	wl2 = qny * vp->dy;
+
+	wp1[0] = 0.5f * (S0y[0] + S1y[0]);
+	wp1[1] = 0.5f * (S0y[1] + S1y[1]);
+
+	wp2[0] = 0.5f * (S0x[0] + S1x[0]);
+	wp2[1] = 0.5f * (S0x[1] + S1x[1]);
+
+	t_fld *restrict const Jx = J + FLD_COMP(0, nrow);
+	t_fld *restrict const Jy = J + FLD_COMP(1, nrow);
+	t_fld *restrict const Jz = J + FLD_COMP(2, nrow);
+
+	Jx[FLD_CELL(vp->ix, vp->iy, nrow)] += wl1 * wp1[0];
+	Jx[FLD_CELL(vp->ix, vp->iy + 1, nrow)] += wl1 * wp1[1];
+
+	Jy[FLD_CELL(vp->ix, vp->iy, nrow)] += wl2 * wp2[0];
+	Jy[FLD_CELL(vp->ix + 1, vp->iy, nrow)] += wl2 * wp2[1];
+
+	Jz[FLD_CELL(vp->ix, vp->iy, nrow)] += vp->qvz
+			* (S0x[0] * S0y[0] + S1x[0] * S1y[0] + (S0x[0] * S1y[0] - S1x[0] * S0y[0]) / 2.0f);
+	Jz[FLD_CELL(vp->ix + 1, vp->iy, nrow)] += vp->qvz
+			* (S0x[1] * S0y[0] + S1x[1] * S1y[0] + (S0x[1] * S1y[0] - S1x[1] * S0y[0]) / 2.0f);
+	Jz[FLD_CELL(vp->ix, vp->iy + 1, nrow)] += vp->qvz
+			* (S0x[0] * S0y[1] + S1x[0] * S1y[1] + (S0x[0] * S1y[1] - S1x[0] * S0y[1]) / 2.0f);
+	Jz[FLD_CELL(vp->ix + 1, vp->iy + 1, nrow)] += vp->qvz
+			* (S0x[1] * S0y[1] + S1x[1] * S1y[1] + (S0x[1] * S1y[1] - S1x[1] * S0y[1]) / 2.0f);
+}
+
+// Current deposition (adapted Villasenor-Bunemann method). Handles all the split cases, but it
+// is only used for the particles that cross a cell edge in both directions
 void dep_current_zamb(int ix, int iy, int di, int dj, float x0, float y0, float dx, float dy,
-		float qnx, float qny, float qvz, t_current *current)
+		float qnx, float qny, float qvz, t_fld *restrict const J, const int nrow)
 {
 	// Split the particle trajectory
-	typedef struct {
-		float x0, x1, y0, y1, dx, dy, qvz;
-		int ix, iy;
-	} t_vp;
-
 	t_vp vp[3];
 	int vnp = 1;
 
@@ -523,71 +1129,211 @@ void dep_current_zamb(int ix, int iy, int di, int dj, float x0, float y0, float
 	}
 
 	// Deposit virtual particle currents
-	int k;
-	const int nrow = current->nrow;
-	t_vfld *restrict const J = current->J;
+	for (int k = 0; k < vnp; k++)
+		dep_zamb_vp(&vp[k], qnx, qny, J, nrow);
+}
 
-	for (k = 0; k < vnp; k++)
-	{
-		float S0x[2], S1x[2], S0y[2], S1y[2];
-		float wl1, wl2;
-		float wp1[2], wp2[2];
+// Zamb deposit for a particle that stays in the same cell
+static inline void dep_zamb_none(int ix, int iy, float x0, float y0, float dx, float dy,
+		float qnx, float qny, float qvz, t_fld *restrict const J, const int nrow)
+{
+	const t_vp vp = {.x0 = x0, .x1 = x0 + dx, .y0 = y0, .y1 = y0 + dy, .dx = dx, .dy = dy,
+					 .qvz = qvz / 2.0, .ix = ix, .iy = iy};
+
+	dep_zamb_vp(&vp, qnx, qny, J, nrow);
+}
+
+// Zamb deposit for a particle that only crosses a cell edge in x (di != 0, dj = 0)
+static inline void dep_zamb_x(int ix, int iy, int di, float x0, float y0, float dx, float dy,
+		float qnx, float qny, float qvz, t_fld *restrict const J, const int nrow)
+{
+	const int ib = (di == 1);
+	const float qvz2 = qvz / 2.0;
+	const float delta = (x0 + dx - ib) / dx;
+	const float ycross = y0 + dy * (1.0f - delta);
+
+	const t_vp vp0 = {.x0 = x0, .x1 = ib, .y0 = y0, .y1 = ycross, .dx = dx * (1.0f - delta),
+					  .dy = dy * (1.0f - delta), .qvz = qvz2 * (1.0f - delta), .ix = ix, .iy = iy};
+	const t_vp vp1 = {.x0 = 1 - ib, .x1 = (x0 + dx) - di, .y0 = ycross, .y1 = y0 + dy,
+					  .dx = dx * delta, .dy = dy * delta, .qvz = qvz2 * delta, .ix = ix + di,
+					  .iy = iy};
+
+	dep_zamb_vp(&vp0, qnx, qny, J, nrow);
+	dep_zamb_vp(&vp1, qnx, qny, J, nrow);
+}
+
+// Zamb deposit for a particle that only crosses a cell edge in y (di = 0, dj != 0)
+static inline void dep_zamb_y(int ix, int iy, int dj, float x0, float y0, float dx, float dy,
+		float qnx, float qny, float qvz, t_fld *restrict const J, const int nrow)
+{
+	const int jb = (dj == 1);
+	const float qvz2 = qvz / 2.0;
+	const float delta = (y0 + dy - jb) / dy;
+	const float xcross = x0 + dx * (1.0f - delta);
+
+	const t_vp vp0 = {.x0 = x0, .x1 = xcross, .y0 = y0, .y1 = jb, .dx = dx * (1.0f - delta),
+					  .dy = dy * (1.0f - delta), .qvz = qvz2 * (1.0f - delta), .ix = ix, .iy = iy};
+	const t_vp vp1 = {.x0 = xcross, .x1 = x0 + dx, .y0 = 1 - jb, .y1 = (y0 + dy) - dj,
+					  .dx = dx * delta, .dy = dy * delta, .qvz = qvz2 * delta, .ix = ix,
+					  .iy = iy + dj};
+
+	dep_zamb_vp(&vp0, qnx, qny, J, nrow);
+	dep_zamb_vp(&vp1, qnx, qny, J, nrow);
+}
+
+
+// Deposit benchmark: a synthetic batch of particles of one split case, spread over the cells of a
+// copy of the region current (the same particles are deposited in every call)
+typedef struct {
+	t_fld *J;
+	int nrow, np;
+	int *ix, *iy, *di, *dj;
+	float *x0, *y0, *dx, *dy;
+} t_dep_bench;
+
+static void dep_bench_none(void *arg)
+{
+	const t_dep_bench *b = arg;
 
-		S0x[0] = 1.0f - vp[k].x0;
-		S0x[1] = vp[k].x0;
+	for (int n = 0; n < b->np; n++)
+		dep_zamb_none(b->ix[n], b->iy[n], b->x0[n], b->y0[n], b->dx[n], b->dy[n], 1.0f, 1.0f, 0.1f,
+				b->J, b->nrow);
+}
+
+static void dep_bench_x(void *arg)
+{
+	const t_dep_bench *b = arg;
 
-		S1x[0] = 1.0f - vp[k].x1;
-		S1x[1] = vp[k].x1;
+	for (int n = 0; n < b->np; n++)
+		dep_zamb_x(b->ix[n], b->iy[n], b->di[n], b->x0[n], b->y0[n], b->dx[n], b->dy[n], 1.0f, 1.0f,
+				0.1f, b->J, b->nrow);
+}
 
-		S0y[0] = 1.0f - vp[k].y0;
-		S0y[1] = vp[k].y0;
+static void dep_bench_y(void *arg)
+{
+	const t_dep_bench *b = arg;
 
-		S1y[0] = 1.0f - vp[k].y1;
-		S1y[1] = vp[k].y1;
+	for (int n = 0; n < b->np; n++)
+		dep_zamb_y(b->ix[n], b->iy[n], b->dj[n], b->x0[n], b->y0[n], b->dx[n], b->dy[n], 1.0f, 1.0f,
+				0.1f, b->J, b->nrow);
+}
 
-		wl1 = qnx * vp[k].dx;
-		wl2 = qny * vp[k].dy;
+static void dep_bench_xy(void *arg)
+{
+	const t_dep_bench *b = arg;
 
-		wp1[0] = 0.5f * (S0y[0] + S1y[0]);
-		wp1[1] = 0.5f * (S0y[1] + S1y[1]);
+	for (int n = 0; n < b->np; n++)
+		dep_current_zamb(b->ix[n], b->iy[n], b->di[n], b->dj[n], b->x0[n], b->y0[n], b->dx[n],
+				b->dy[n], 1.0f, 1.0f, 0.1f, b->J, b->nrow);
+}
 
-		wp2[0] = 0.5f * (S0x[0] + S1x[0]);
-		wp2[1] = 0.5f * (S0x[1] + S1x[1]);
+static void dep_bench_esk(void *arg)
+{
+	const t_dep_bench *b = arg;
 
-		J[vp[k].ix + nrow * vp[k].iy].x += wl1 * wp1[0];
-		J[vp[k].ix + nrow * (vp[k].iy + 1)].x += wl1 * wp1[1];
+	for (int n = 0; n < b->np; n++)
+		dep_current_esk(b->ix[n], b->iy[n], b->di[n], b->dj[n], b->x0[n], b->y0[n],
+				b->x0[n] + b->dx[n] - b->di[n], b->y0[n] + b->dy[n] - b->dj[n], 1.0f, 1.0f, 0.1f,
+				b->J, b->nrow);
+}
 
-		J[vp[k].ix + nrow * vp[k].iy].y += wl2 * wp2[0];
-		J[vp[k].ix + 1 + nrow * vp[k].iy].y += wl2 * wp2[1];
+// Uniform random number in [a, b)
+static float dep_bench_rand(const float a, const float b)
+{
+	return a + (b - a) * (rand_uint32() >> 8) / 16777216.0f;
+}
 
-		J[vp[k].ix + nrow * vp[k].iy].z += vp[k].qvz
-				* (S0x[0] * S0y[0] + S1x[0] * S1y[0] + (S0x[0] * S1y[0] - S1x[0] * S0y[0]) / 2.0f);
-		J[vp[k].ix + 1 + nrow * vp[k].iy].z += vp[k].qvz
-				* (S0x[1] * S0y[0] + S1x[1] * S1y[0] + (S0x[1] * S1y[0] - S1x[1] * S0y[0]) / 2.0f);
-		J[vp[k].ix + nrow * (vp[k].iy + 1)].z += vp[k].qvz
-				* (S0x[0] * S0y[1] + S1x[0] * S1y[1] + (S0x[0] * S1y[1] - S1x[0] * S0y[1]) / 2.0f);
-		J[vp[k].ix + 1 + nrow * (vp[k].iy + 1)].z += vp[k].qvz
-				* (S0x[1] * S0y[1] + S1x[1] * S1y[1] + (S0x[1] * S1y[1] - S1x[1] * S0y[1]) / 2.0f);
+// Position and displacement (in one direction) of a particle that crosses a cell edge (cross) or
+// not. Half of the particles crossing an edge move to the next cell and half to the previous one
+static void dep_bench_motion(const bool cross, float *x0, float *dx)
+{
+	if (!cross)
+	{
+		*x0 = dep_bench_rand(0.25f, 0.75f);
+		*dx = dep_bench_rand(-0.2f, 0.2f);
+	} else if (rand_uint32() & 1)
+	{
+		*x0 = dep_bench_rand(0.8f, 1.0f);
+		*dx = dep_bench_rand(0.25f, 0.45f);
+	} else
+	{
+		*x0 = dep_bench_rand(0.0f, 0.2f);
+		*dx = -dep_bench_rand(0.25f, 0.45f);
 	}
 }
 
+// Time per particle (in ns) of the Zamb kernel of each split case and of the Esirkepov deposit
+// for the same particles, measured in one thread on a copy of the region current
+void spec_bench_deposit(const t_current *current, double zamb_ns[NUM_SPLIT_CASES],
+		double esk_ns[NUM_SPLIT_CASES])
+{
+	const int np = DEP_BENCH_NPART;
+	void (*zamb_kernel[NUM_SPLIT_CASES])(void *) = {dep_bench_none, dep_bench_x, dep_bench_y,
+			dep_bench_xy};
+
+	t_vfld *J_buf = mem_alloc(current->total_size * sizeof(t_vfld), MEM_CURRENT);
+	memset(J_buf, 0, current->total_size * sizeof(t_vfld));
+
+	t_dep_bench bench;
+	bench.J = (t_fld*) J_buf + (current->J - (t_fld*) current->J_buf);
+	bench.nrow = current->nrow;
+	bench.np = np;
+	bench.ix = malloc(np * sizeof(int));
+	bench.iy = malloc(np * sizeof(int));
+	bench.di = malloc(np * sizeof(int));
+	bench.dj = malloc(np * sizeof(int));
+	bench.x0 = malloc(np * sizeof(float));
+	bench.y0 = malloc(np * sizeof(float));
+	bench.dx = malloc(np * sizeof(float));
+	bench.dy = malloc(np * sizeof(float));
+
+	for (int c = 0; c < NUM_SPLIT_CASES; c++)
+	{
+		// The particles (and the cells they move to) are inside the region
+		for (int n = 0; n < np; n++)
+		{
+			bench.ix[n] = 1 + rand_uint32() % (current->nx[0] - 2);
+			bench.iy[n] = 1 + rand_uint32() % (current->nx[1] - 2);
+
+			dep_bench_motion(c & 1, &bench.x0[n], &bench.dx[n]);
+			dep_bench_motion(c & 2, &bench.y0[n], &bench.dy[n]);
+
+			bench.di[n] = LTRIM(bench.x0[n] + bench.dx[n]);
+			bench.dj[n] = LTRIM(bench.y0[n] + bench.dy[n]);
+		}
+
+		zamb_ns[c] = timer_bench(zamb_kernel[c], &bench) / np * 1E9;
+		esk_ns[c] = timer_bench(dep_bench_esk, &bench) / np * 1E9;
+	}
+
+	free(bench.ix);
+	free(bench.iy);
+	free(bench.di);
+	free(bench.dj);
+	free(bench.x0);
+	free(bench.y0);
+	free(bench.dx);
+	free(bench.dy);
+	mem_free(J_buf);
+}
 
 /*********************************************************************************************
  Particle advance
  *********************************************************************************************/
 
 // EM fields interpolation
-void interpolate_fld(const t_vfld *restrict const E, const t_vfld *restrict const B, const int nrow,
-		const t_part *restrict const part, t_vfld *restrict const Ep, t_vfld *restrict const Bp, const int offset)
+void interpolate_fld(const t_fld *restrict const E, const t_fld *restrict const B, const int nrow,
+		const int ix, const int iy, const t_fld x, const t_fld y, t_vfld *restrict const Ep,
+		t_vfld *restrict const Bp)
 {
 	register int i, j, ih, jh;
 	register t_fld w1, w2, w1h, w2h;
 
-	i = part->ix;
-	j = part->iy - offset;
+	i = ix;
+	j = iy;
 
-	w1 = part->x;
-	w2 = part->y;
+	w1 = x;
+	w2 = y;
 
 	ih = (w1 < 0.5f) ? -1 : 0;
 	jh = (w2 < 0.5f) ? -1 : 0;
@@ -600,79 +1346,100 @@ void interpolate_fld(const t_vfld *restrict const E, const t_vfld *restrict cons
 	ih += i;
 	jh += j;
 
-	Ep->x = (E[ih + j * nrow].x * (1.0f - w1h) + E[ih + 1 + j * nrow].x * w1h) * (1.0f - w2)
-			+ (E[ih + (j + 1) * nrow].x * (1.0f - w1h) + E[ih + 1 + (j + 1) * nrow].x * w1h) * w2;
-	Ep->y = (E[i + jh * nrow].y * (1.0f - w1) + E[i + 1 + jh * nrow].y * w1) * (1.0f - w2h)
-			+ (E[i + (jh + 1) * nrow].y * (1.0f - w1) + E[i + 1 + (jh + 1) * nrow].y * w1) * w2h;
-	Ep->z = (E[i + j * nrow].z * (1.0f - w1) + E[i + 1 + j * nrow].z * w1) * (1.0f - w2)
-			+ (E[i + (j + 1) * nrow].z * (1.0f - w1) + E[i + 1 + (j + 1) * nrow].z * w1) * w2;
-
-	Bp->x = (B[i + jh * nrow].x * (1.0f - w1) + B[i + 1 + jh * nrow].x * w1) * (1.0f - w2h)
-			+ (B[i + (jh + 1) * nrow].x * (1.0f - w1) + B[i + 1 + (jh + 1) * nrow].x * w1) * w2h;
-	Bp->y = (B[ih + j * nrow].y * (1.0f - w1h) + B[ih + 1 + j * nrow].y * w1h) * (1.0f - w2)
-			+ (B[ih + (j + 1) * nrow].y * (1.0f - w1h) + B[ih + 1 + (j + 1) * nrow].y * w1h) * w2;
-	Bp->z = (B[ih + jh * nrow].z * (1.0f - w1h) + B[ih + 1 + jh * nrow].z * w1h) * (1.0f - w2h)
-			+ (B[ih + (jh + 1) * nrow].z * (1.0f - w1h) + B[ih + 1 + (jh + 1) * nrow].z * w1h)
-					* w2h;
+	const t_fld *restrict const Ex = E + FLD_COMP(0, nrow);
+	const t_fld *restrict const Ey = E + FLD_COMP(1, nrow);
+	const t_fld *restrict const Ez = E + FLD_COMP(2, nrow);
+	const t_fld *restrict const Bx = B + FLD_COMP(0, nrow);
+	const t_fld *restrict const By = B + FLD_COMP(1, nrow);
+	const t_fld *restrict const Bz = B + FLD_COMP(2, nrow);
+
+	Ep->x = (Ex[FLD_CELL(ih, j, nrow)] * (1.0f - w1h) + Ex[FLD_CELL(ih + 1, j, nrow)] * w1h)
+			* (1.0f - w2)
+			+ (Ex[FLD_CELL(ih, j + 1, nrow)] * (1.0f - w1h)
+					+ Ex[FLD_CELL(ih + 1, j + 1, nrow)] * w1h) * w2;
+	Ep->y = (Ey[FLD_CELL(i, jh, nrow)] * (1.0f - w1) + Ey[FLD_CELL(i + 1, jh, nrow)] * w1)
+			* (1.0f - w2h)
+			+ (Ey[FLD_CELL(i, jh + 1, nrow)] * (1.0f - w1)
+					+ Ey[FLD_CELL(i + 1, jh + 1, nrow)] * w1) * w2h;
+	Ep->z = (Ez[FLD_CELL(i, j, nrow)] * (1.0f - w1) + Ez[FLD_CELL(i + 1, j, nrow)] * w1)
+			* (1.0f - w2)
+			+ (Ez[FLD_CELL(i, j + 1, nrow)] * (1.0f - w1)
+					+ Ez[FLD_CELL(i + 1, j + 1, nrow)] * w1) * w2;
+
+	Bp->x = (Bx[FLD_CELL(i, jh, nrow)] * (1.0f - w1) + Bx[FLD_CELL(i + 1, jh, nrow)] * w1)
+			* (1.0f - w2h)
+			+ (Bx[FLD_CELL(i, jh + 1, nrow)] * (1.0f - w1)
+					+ Bx[FLD_CELL(i + 1, jh + 1, nrow)] * w1) * w2h;
+	Bp->y = (By[FLD_CELL(ih, j, nrow)] * (1.0f - w1h) + By[FLD_CELL(ih + 1, j, nrow)] * w1h)
+			* (1.0f - w2)
+			+ (By[FLD_CELL(ih, j + 1, nrow)] * (1.0f - w1h)
+					+ By[FLD_CELL(ih + 1, j + 1, nrow)] * w1h) * w2;
+	Bp->z = (Bz[FLD_CELL(ih, jh, nrow)] * (1.0f - w1h) + Bz[FLD_CELL(ih + 1, jh, nrow)] * w1h)
+			* (1.0f - w2h)
+			+ (Bz[FLD_CELL(ih, jh + 1, nrow)] * (1.0f - w1h)
+					+ Bz[FLD_CELL(ih + 1, jh + 1, nrow)] * w1h) * w2h;
 
 }
 
-// Particle advance
-void spec_advance(t_species *spec, const t_emf *emf, t_current *current, const int limits_y[2])
+/*********************************************************************************************
+ Vectorized particle push
+ *********************************************************************************************/
+
+// Parameters shared by all the push kernels
+typedef struct {
+	const t_fld *restrict E;
+	const t_fld *restrict B;
+	int nrow;
+	int offset_x, offset_y;		// Cell index of the cell [0][0] of E and B (see FLD_CELL)
+
+	t_part_data tem;
+	t_part_data dt_dx, dt_dy;
+	t_part_data q;
+} t_push_param;
+
+// Advance the momentum of np particles and calculate their displacement and qvz.
+// Returns the time centered kinetic energy of the particles.
+typedef double (*t_push_kernel)(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz);
+
+static double push_boris_scalar(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz)
 {
-	const int nx0 = spec->nx[0];
-	const int nx1 = spec->nx[1];
-	const t_part_data tem = 0.5 * spec->dt / spec->m_q;
-	const t_part_data dt_dx = spec->dt / spec->dx[0];
-	const t_part_data dt_dy = spec->dt / spec->dx[1];
+	const t_part_data tem = param->tem;
+	double energy = 0;
 
-	// Auxiliary values for current deposition
-	const t_part_data qnx = spec->q * spec->dx[0] / spec->dt;
-	const t_part_data qny = spec->q * spec->dx[1] / spec->dt;
-
-	spec->npush += spec->main_vector.size;
-
-	// Advance internal iteration number
-	spec->iter += 1;
-
-	// Advance particles
-	for (int i = 0; i < spec->main_vector.size; i++)
+	for (int k = 0; k < np; k++)
 	{
 		t_vfld Ep, Bp;
 		t_part_data utx, uty, utz;
-		t_part_data ux, uy, uz, rg;
+		t_part_data u1, u2, u3, rg;
 		t_part_data utsq, gamma;
 		t_part_data gtem, otsq;
-		t_part_data qvz;
-		t_part_data x1, y1;
-
-		int di, dj;
-		float dx, dy;
-
-		// Load particle momenta
-		ux = spec->main_vector.data[i].ux;
-		uy = spec->main_vector.data[i].uy;
-		uz = spec->main_vector.data[i].uz;
 
 		// Interpolate fields
-		interpolate_fld(emf->E, emf->B, emf->nrow, &spec->main_vector.data[i], &Ep, &Bp, limits_y[0]);
+		interpolate_fld(param->E, param->B, param->nrow, ix[k] - param->offset_x,
+				iy[k] - param->offset_y, x[k], y[k], &Ep, &Bp);
 
 		// Advance u using Boris scheme
 		Ep.x *= tem;
 		Ep.y *= tem;
 		Ep.z *= tem;
 
-		utx = ux + Ep.x;
-		uty = uy + Ep.y;
-		utz = uz + Ep.z;
+		utx = ux[k] + Ep.x;
+		uty = uy[k] + Ep.y;
+		utz = uz[k] + Ep.z;
 
 		// Get time centered energy
 		utsq = utx * utx + uty * uty + utz * utz;
 		gamma = sqrtf(1.0f + utsq);
-		spec->energy += utsq / (gamma + 1);
+		energy += utsq / (gamma + 1);
 
 		// Perform first half of the rotation
-		gtem = tem / sqrtf(1.0f + utx * utx + uty * uty + utz * utz);
+		gtem = tem / gamma;
 
 		Bp.x *= gtem;
 		Bp.y *= gtem;
@@ -680,107 +1447,1076 @@ void spec_advance(t_species *spec, const t_emf *emf, t_current *current, const i
 
 		otsq = 2.0f / (1.0f + Bp.x * Bp.x + Bp.y * Bp.y + Bp.z * Bp.z);
 
-		ux = utx + uty * Bp.z - utz * Bp.y;
-		uy = uty + utz * Bp.x - utx * Bp.z;
-		uz = utz + utx * Bp.y - uty * Bp.x;
+		u1 = utx + uty * Bp.z - utz * Bp.y;
+		u2 = uty + utz * Bp.x - utx * Bp.z;
+		u3 = utz + utx * Bp.y - uty * Bp.x;
 
 		// Perform second half of the rotation
 		Bp.x *= otsq;
 		Bp.y *= otsq;
 		Bp.z *= otsq;
 
-		utx += uy * Bp.z - uz * Bp.y;
-		uty += uz * Bp.x - ux * Bp.z;
-		utz += ux * Bp.y - uy * Bp.x;
+		utx += u2 * Bp.z - u3 * Bp.y;
+		uty += u3 * Bp.x - u1 * Bp.z;
+		utz += u1 * Bp.y - u2 * Bp.x;
 
 		// Perform second half of electric field acceleration
-		ux = utx + Ep.x;
-		uy = uty + Ep.y;
-		uz = utz + Ep.z;
+		u1 = utx + Ep.x;
+		u2 = uty + Ep.y;
+		u3 = utz + Ep.z;
+
+		// Store new momenta
+		ux[k] = u1;
+		uy[k] = u2;
+		uz[k] = u3;
+
+		// Particle displacement
+		rg = 1.0f / sqrtf(1.0f + u1 * u1 + u2 * u2 + u3 * u3);
+
+		dx[k] = param->dt_dx * rg * u1;
+		dy[k] = param->dt_dy * rg * u2;
+		qvz[k] = param->q * u3 * rg;
+	}
+
+	return energy;
+}
+
+// Rotate u around tau after its norm has been corrected to gamma (shared by the Vay and
+// Higuera-Cary schemes). Returns t = tau / gamma in tx, ty, tz
+static inline void push_rotate(const t_part_data gamma, const t_vfld *restrict tau,
+		t_part_data *restrict u1, t_part_data *restrict u2, t_part_data *restrict u3,
+		t_part_data *restrict tx, t_part_data *restrict ty, t_part_data *restrict tz)
+{
+	*tx = tau->x / gamma;
+	*ty = tau->y / gamma;
+	*tz = tau->z / gamma;
+
+	const t_part_data s = 1.0f / (1.0f + *tx * *tx + *ty * *ty + *tz * *tz);
+	const t_part_data ut = *u1 * *tx + *u2 * *ty + *u3 * *tz;
+
+	const t_part_data v1 = s * (*u1 + ut * *tx + *u2 * *tz - *u3 * *ty);
+	const t_part_data v2 = s * (*u2 + ut * *ty + *u3 * *tx - *u1 * *tz);
+	const t_part_data v3 = s * (*u3 + ut * *tz + *u1 * *ty - *u2 * *tx);
+
+	*u1 = v1;
+	*u2 = v2;
+	*u3 = v3;
+}
+
+// Lorentz factor at the end of the step from the intermediate momentum u and tau
+static inline t_part_data push_gamma(const t_part_data u1, const t_part_data u2,
+		const t_part_data u3, const t_vfld *restrict tau)
+{
+	const t_part_data tsq = tau->x * tau->x + tau->y * tau->y + tau->z * tau->z;
+	const t_part_data ustar = u1 * tau->x + u2 * tau->y + u3 * tau->z;
+	const t_part_data sigma = 1.0f + u1 * u1 + u2 * u2 + u3 * u3 - tsq;
+
+	return sqrtf(0.5f * (sigma + sqrtf(sigma * sigma + 4.0f * (tsq + ustar * ustar))));
+}
+
+// Vay scheme (J.-L. Vay, Phys. Plasmas 15, 056701 (2008)). Correct E x B drift for
+// relativistic particles
+static double push_vay_scalar(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz)
+{
+	const t_part_data tem = param->tem;
+	double energy = 0;
+
+	for (int k = 0; k < np; k++)
+	{
+		t_vfld Ep, Bp;
+		t_part_data u1, u2, u3, rg;
+		t_part_data utx, uty, utz, utsq;
+		t_part_data tx, ty, tz;
+
+		// Interpolate fields
+		interpolate_fld(param->E, param->B, param->nrow, ix[k] - param->offset_x,
+				iy[k] - param->offset_y, x[k], y[k], &Ep, &Bp);
+
+		Ep.x *= tem;
+		Ep.y *= tem;
+		Ep.z *= tem;
+
+		Bp.x *= tem;
+		Bp.y *= tem;
+		Bp.z *= tem;
+
+		// Get time centered energy (same estimate as the Boris pusher)
+		utx = ux[k] + Ep.x;
+		uty = uy[k] + Ep.y;
+		utz = uz[k] + Ep.z;
+
+		utsq = utx * utx + uty * uty + utz * utz;
+		energy += utsq / (sqrtf(1.0f + utsq) + 1);
+
+		// Half step with the velocity at the start of the step
+		rg = 1.0f / sqrtf(1.0f + ux[k] * ux[k] + uy[k] * uy[k] + uz[k] * uz[k]);
+
+		u1 = utx + Ep.x + rg * (uy[k] * Bp.z - uz[k] * Bp.y);
+		u2 = uty + Ep.y + rg * (uz[k] * Bp.x - ux[k] * Bp.z);
+		u3 = utz + Ep.z + rg * (ux[k] * Bp.y - uy[k] * Bp.x);
+
+		// Second half step (implicit in the velocity)
+		push_rotate(push_gamma(u1, u2, u3, &Bp), &Bp, &u1, &u2, &u3, &tx, &ty, &tz);
 
 		// Store new momenta
-		spec->main_vector.data[i].ux = ux;
-		spec->main_vector.data[i].uy = uy;
-		spec->main_vector.data[i].uz = uz;
+		ux[k] = u1;
+		uy[k] = u2;
+		uz[k] = u3;
 
-		// push particle
-		rg = 1.0f / sqrtf(1.0f + ux * ux + uy * uy + uz * uz);
+		// Particle displacement
+		rg = 1.0f / sqrtf(1.0f + u1 * u1 + u2 * u2 + u3 * u3);
 
-		dx = dt_dx * rg * ux;
-		dy = dt_dy * rg * uy;
+		dx[k] = param->dt_dx * rg * u1;
+		dy[k] = param->dt_dy * rg * u2;
+		qvz[k] = param->q * u3 * rg;
+	}
 
-		x1 = spec->main_vector.data[i].x + dx;
-		y1 = spec->main_vector.data[i].y + dy;
+	return energy;
+}
 
-		di = LTRIM(x1);
-		dj = LTRIM(y1);
+// Higuera-Cary scheme (A. V. Higuera and J. R. Cary, Phys. Plasmas 24, 052104 (2017)). Volume
+// preserving like Boris, with the correct E x B drift like Vay
+static double push_higuera_cary_scalar(const t_push_param *param, const int np,
+		const int *restrict ix, const int *restrict iy, const t_part_data *restrict x,
+		const t_part_data *restrict y, t_part_data *restrict ux, t_part_data *restrict uy,
+		t_part_data *restrict uz, t_part_data *restrict dx, t_part_data *restrict dy,
+		t_part_data *restrict qvz)
+{
+	const t_part_data tem = param->tem;
+	double energy = 0;
 
-		x1 -= di;
-		y1 -= dj;
+	for (int k = 0; k < np; k++)
+	{
+		t_vfld Ep, Bp;
+		t_part_data u1, u2, u3, rg;
+		t_part_data utsq;
+		t_part_data tx, ty, tz;
 
-		qvz = spec->q * uz * rg;
+		// Interpolate fields
+		interpolate_fld(param->E, param->B, param->nrow, ix[k] - param->offset_x,
+				iy[k] - param->offset_y, x[k], y[k], &Ep, &Bp);
+
+		Ep.x *= tem;
+		Ep.y *= tem;
+		Ep.z *= tem;
 
-		dep_current_zamb(spec->main_vector.data[i].ix, spec->main_vector.data[i].iy - limits_y[0],
-				di, dj, spec->main_vector.data[i].x, spec->main_vector.data[i].y, dx, dy, qnx, qny,
-				qvz, current);
+		Bp.x *= tem;
+		Bp.y *= tem;
+		Bp.z *= tem;
 
-		// Store results
-		spec->main_vector.data[i].x = x1;
-		spec->main_vector.data[i].y = y1;
-		spec->main_vector.data[i].ix += di;
-		spec->main_vector.data[i].iy += dj;
+		// First half of electric field acceleration
+		u1 = ux[k] + Ep.x;
+		u2 = uy[k] + Ep.y;
+		u3 = uz[k] + Ep.z;
+
+		// Get time centered energy
+		utsq = u1 * u1 + u2 * u2 + u3 * u3;
+		energy += utsq / (sqrtf(1.0f + utsq) + 1);
+
+		// Magnetic rotation, using the time centered Lorentz factor
+		push_rotate(push_gamma(u1, u2, u3, &Bp), &Bp, &u1, &u2, &u3, &tx, &ty, &tz);
+
+		// Second half of electric field acceleration and rotation
+		const t_part_data v1 = u1 + Ep.x + u2 * tz - u3 * ty;
+		const t_part_data v2 = u2 + Ep.y + u3 * tx - u1 * tz;
+		const t_part_data v3 = u3 + Ep.z + u1 * ty - u2 * tx;
+
+		// Store new momenta
+		ux[k] = v1;
+		uy[k] = v2;
+		uz[k] = v3;
+
+		// Particle displacement
+		rg = 1.0f / sqrtf(1.0f + v1 * v1 + v2 * v2 + v3 * v3);
+
+		dx[k] = param->dt_dx * rg * v1;
+		dy[k] = param->dt_dy * rg * v2;
+		qvz[k] = param->q * v3 * rg;
+	}
+
+	return energy;
+}
+
+#ifdef SIMD_X86
+
+// Interpolate a field component in 8 particles. idx is the index (in floats) of the lower left
+// corner, nrow3 the size of a grid row (in floats) and (wx, wy) the interpolation weights. The
+// adjacent cell in x is FLD_STRIDE floats away
+__attribute__((target("avx2")))
+static inline __m256 interp_avx2(const float *restrict f, const __m256i idx, const __m256i nrow3,
+		const __m256 wx, const __m256 wy)
+{
+	const __m256i stride = _mm256_set1_epi32(FLD_STRIDE);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256i idx_up = _mm256_add_epi32(idx, nrow3);
+
+	const __m256 f00 = _mm256_i32gather_ps(f, idx, 4);
+	const __m256 f10 = _mm256_i32gather_ps(f, _mm256_add_epi32(idx, stride), 4);
+	const __m256 f01 = _mm256_i32gather_ps(f, idx_up, 4);
+	const __m256 f11 = _mm256_i32gather_ps(f, _mm256_add_epi32(idx_up, stride), 4);
+
+	const __m256 wx0 = _mm256_sub_ps(one, wx);
+	const __m256 wy0 = _mm256_sub_ps(one, wy);
+
+	const __m256 low = _mm256_add_ps(_mm256_mul_ps(f00, wx0), _mm256_mul_ps(f10, wx));
+	const __m256 up = _mm256_add_ps(_mm256_mul_ps(f01, wx0), _mm256_mul_ps(f11, wx));
+
+	return _mm256_add_ps(_mm256_mul_ps(low, wy0), _mm256_mul_ps(up, wy));
+}
+
+// Index (in floats) of the cell (i, j), FLD_CELL(i, j, nrow). nrow_cells is the size of a grid row
+// in units of FLD_STRIDE floats (3 * nrow / FLD_STRIDE)
+__attribute__((target("avx2")))
+static inline __m256i cell_idx_avx2(const __m256i i, const __m256i j, const __m256i nrow_cells)
+{
+	const __m256i cell = _mm256_add_epi32(i, _mm256_mullo_epi32(j, nrow_cells));
+#ifdef ENABLE_PLANAR_FIELDS
+	return cell;
+#else
+	return _mm256_add_epi32(cell, _mm256_add_epi32(cell, cell));
+#endif
+}
+
+// Component of the cross product (a x b)
+#define CROSS_X(ay, az, by, bz) _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by))
+
+__attribute__((target("avx2")))
+static double push_boris_avx2(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz)
+{
+	const int nv = np - np % 8;
+
+	const float *restrict const E = (const float*) param->E;
+	const float *restrict const B = (const float*) param->B;
+
+	const __m256i nrow_cells = _mm256_set1_epi32(3 * param->nrow / FLD_STRIDE);
+	const __m256i nrow3 = _mm256_set1_epi32(3 * param->nrow);
+	const __m256i offset_x = _mm256_set1_epi32(param->offset_x);
+	const __m256i offset_y = _mm256_set1_epi32(param->offset_y);
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 minus_half = _mm256_set1_ps(-0.5f);
+	const __m256 tem = _mm256_set1_ps(param->tem);
+	const __m256 dt_dx = _mm256_set1_ps(param->dt_dx);
+	const __m256 dt_dy = _mm256_set1_ps(param->dt_dy);
+	const __m256 q = _mm256_set1_ps(param->q);
+
+	__m256d energy_lo = _mm256_setzero_pd();
+	__m256d energy_hi = _mm256_setzero_pd();
+
+	for (int k = 0; k < nv; k += 8)
+	{
+		const __m256i i = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (ix + k)), offset_x);
+		const __m256i j = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (iy + k)), offset_y);
+		const __m256 w1 = _mm256_loadu_ps(x + k);
+		const __m256 w2 = _mm256_loadu_ps(y + k);
+
+		// Indexes and weights of the staggered grid points (the mask is -1 when w < 0.5)
+		const __m256 mask1 = _mm256_cmp_ps(w1, half, _CMP_LT_OQ);
+		const __m256 mask2 = _mm256_cmp_ps(w2, half, _CMP_LT_OQ);
+
+		const __m256i ih = _mm256_add_epi32(i, _mm256_castps_si256(mask1));
+		const __m256i jh = _mm256_add_epi32(j, _mm256_castps_si256(mask2));
+
+		const __m256 w1h = _mm256_add_ps(w1, _mm256_blendv_ps(minus_half, half, mask1));
+		const __m256 w2h = _mm256_add_ps(w2, _mm256_blendv_ps(minus_half, half, mask2));
+
+		// Interpolate fields
+		const __m256i idx_ih_j = cell_idx_avx2(ih, j, nrow_cells);
+		const __m256i idx_i_jh = cell_idx_avx2(i, jh, nrow_cells);
+		const __m256i idx_i_j = cell_idx_avx2(i, j, nrow_cells);
+		const __m256i idx_ih_jh = cell_idx_avx2(ih, jh, nrow_cells);
+
+		__m256 Epx = interp_avx2(E, idx_ih_j, nrow3, w1h, w2);
+		__m256 Epy = interp_avx2(E + FLD_COMP(1, param->nrow), idx_i_jh, nrow3, w1, w2h);
+		__m256 Epz = interp_avx2(E + FLD_COMP(2, param->nrow), idx_i_j, nrow3, w1, w2);
+
+		__m256 Bpx = interp_avx2(B, idx_i_jh, nrow3, w1, w2h);
+		__m256 Bpy = interp_avx2(B + FLD_COMP(1, param->nrow), idx_ih_j, nrow3, w1h, w2);
+		__m256 Bpz = interp_avx2(B + FLD_COMP(2, param->nrow), idx_ih_jh, nrow3, w1h, w2h);
+
+		// Advance u using Boris scheme
+		Epx = _mm256_mul_ps(Epx, tem);
+		Epy = _mm256_mul_ps(Epy, tem);
+		Epz = _mm256_mul_ps(Epz, tem);
+
+		__m256 utx = _mm256_add_ps(_mm256_loadu_ps(ux + k), Epx);
+		__m256 uty = _mm256_add_ps(_mm256_loadu_ps(uy + k), Epy);
+		__m256 utz = _mm256_add_ps(_mm256_loadu_ps(uz + k), Epz);
+
+		// Get time centered energy
+		const __m256 utsq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(utx, utx),
+				_mm256_mul_ps(uty, uty)), _mm256_mul_ps(utz, utz));
+		const __m256 gamma = _mm256_sqrt_ps(_mm256_add_ps(one, utsq));
+		const __m256 energy = _mm256_div_ps(utsq, _mm256_add_ps(gamma, one));
+
+		energy_lo = _mm256_add_pd(energy_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(energy)));
+		energy_hi = _mm256_add_pd(energy_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(energy, 1)));
+
+		// Perform first half of the rotation
+		const __m256 gtem = _mm256_div_ps(tem, gamma);
+
+		Bpx = _mm256_mul_ps(Bpx, gtem);
+		Bpy = _mm256_mul_ps(Bpy, gtem);
+		Bpz = _mm256_mul_ps(Bpz, gtem);
+
+		const __m256 den = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(one, _mm256_mul_ps(Bpx, Bpx)),
+				_mm256_mul_ps(Bpy, Bpy)), _mm256_mul_ps(Bpz, Bpz));
+		const __m256 otsq = _mm256_div_ps(two, den);
+
+		__m256 u1 = _mm256_sub_ps(_mm256_add_ps(utx, _mm256_mul_ps(uty, Bpz)), _mm256_mul_ps(utz, Bpy));
+		__m256 u2 = _mm256_sub_ps(_mm256_add_ps(uty, _mm256_mul_ps(utz, Bpx)), _mm256_mul_ps(utx, Bpz));
+		__m256 u3 = _mm256_sub_ps(_mm256_add_ps(utz, _mm256_mul_ps(utx, Bpy)), _mm256_mul_ps(uty, Bpx));
+
+		// Perform second half of the rotation
+		Bpx = _mm256_mul_ps(Bpx, otsq);
+		Bpy = _mm256_mul_ps(Bpy, otsq);
+		Bpz = _mm256_mul_ps(Bpz, otsq);
+
+		utx = _mm256_add_ps(utx, CROSS_X(u2, u3, Bpy, Bpz));
+		uty = _mm256_add_ps(uty, CROSS_X(u3, u1, Bpz, Bpx));
+		utz = _mm256_add_ps(utz, CROSS_X(u1, u2, Bpx, Bpy));
+
+		// Perform second half of electric field acceleration
+		u1 = _mm256_add_ps(utx, Epx);
+		u2 = _mm256_add_ps(uty, Epy);
+		u3 = _mm256_add_ps(utz, Epz);
+
+		// Store new momenta
+		_mm256_storeu_ps(ux + k, u1);
+		_mm256_storeu_ps(uy + k, u2);
+		_mm256_storeu_ps(uz + k, u3);
+
+		// Particle displacement
+		const __m256 usq = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(one, _mm256_mul_ps(u1, u1)),
+				_mm256_mul_ps(u2, u2)), _mm256_mul_ps(u3, u3));
+		const __m256 rg = _mm256_div_ps(one, _mm256_sqrt_ps(usq));
+
+		_mm256_storeu_ps(dx + k, _mm256_mul_ps(_mm256_mul_ps(dt_dx, rg), u1));
+		_mm256_storeu_ps(dy + k, _mm256_mul_ps(_mm256_mul_ps(dt_dy, rg), u2));
+		_mm256_storeu_ps(qvz + k, _mm256_mul_ps(_mm256_mul_ps(q, u3), rg));
+	}
+
+	double buf[4];
+	_mm256_storeu_pd(buf, _mm256_add_pd(energy_lo, energy_hi));
+
+	// Remaining particles
+	return buf[0] + buf[1] + buf[2] + buf[3]
+			+ push_boris_scalar(param, np - nv, ix + nv, iy + nv, x + nv, y + nv, ux + nv, uy + nv,
+					uz + nv, dx + nv, dy + nv, qvz + nv);
+}
+
+#undef CROSS_X
+
+// AVX-512 version (16 particles per iteration)
+__attribute__((target("avx512f")))
+static inline __m512 interp_avx512(const float *restrict f, const __m512i idx, const __m512i nrow3,
+		const __m512 wx, const __m512 wy)
+{
+	const __m512i stride = _mm512_set1_epi32(FLD_STRIDE);
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512i idx_up = _mm512_add_epi32(idx, nrow3);
+
+	const __m512 f00 = _mm512_i32gather_ps(idx, f, 4);
+	const __m512 f10 = _mm512_i32gather_ps(_mm512_add_epi32(idx, stride), f, 4);
+	const __m512 f01 = _mm512_i32gather_ps(idx_up, f, 4);
+	const __m512 f11 = _mm512_i32gather_ps(_mm512_add_epi32(idx_up, stride), f, 4);
+
+	const __m512 wx0 = _mm512_sub_ps(one, wx);
+	const __m512 wy0 = _mm512_sub_ps(one, wy);
+
+	const __m512 low = _mm512_add_ps(_mm512_mul_ps(f00, wx0), _mm512_mul_ps(f10, wx));
+	const __m512 up = _mm512_add_ps(_mm512_mul_ps(f01, wx0), _mm512_mul_ps(f11, wx));
+
+	return _mm512_add_ps(_mm512_mul_ps(low, wy0), _mm512_mul_ps(up, wy));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i cell_idx_avx512(const __m512i i, const __m512i j, const __m512i nrow_cells)
+{
+	const __m512i cell = _mm512_add_epi32(i, _mm512_mullo_epi32(j, nrow_cells));
+#ifdef ENABLE_PLANAR_FIELDS
+	return cell;
+#else
+	return _mm512_add_epi32(cell, _mm512_add_epi32(cell, cell));
+#endif
+}
+
+#define CROSS_X(ay, az, by, bz) _mm512_sub_ps(_mm512_mul_ps(ay, bz), _mm512_mul_ps(az, by))
+
+__attribute__((target("avx512f")))
+static double push_boris_avx512(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz)
+{
+	const int nv = np - np % 16;
+
+	const float *restrict const E = (const float*) param->E;
+	const float *restrict const B = (const float*) param->B;
+
+	const __m512i nrow_cells = _mm512_set1_epi32(3 * param->nrow / FLD_STRIDE);
+	const __m512i nrow3 = _mm512_set1_epi32(3 * param->nrow);
+	const __m512i offset_x = _mm512_set1_epi32(param->offset_x);
+	const __m512i offset_y = _mm512_set1_epi32(param->offset_y);
+	const __m512i one_i = _mm512_set1_epi32(1);
+
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 two = _mm512_set1_ps(2.0f);
+	const __m512 half = _mm512_set1_ps(0.5f);
+	const __m512 minus_half = _mm512_set1_ps(-0.5f);
+	const __m512 tem = _mm512_set1_ps(param->tem);
+	const __m512 dt_dx = _mm512_set1_ps(param->dt_dx);
+	const __m512 dt_dy = _mm512_set1_ps(param->dt_dy);
+	const __m512 q = _mm512_set1_ps(param->q);
+
+	__m512d energy_lo = _mm512_setzero_pd();
+	__m512d energy_hi = _mm512_setzero_pd();
+
+	for (int k = 0; k < nv; k += 16)
+	{
+		const __m512i i = _mm512_sub_epi32(_mm512_loadu_si512(ix + k), offset_x);
+		const __m512i j = _mm512_sub_epi32(_mm512_loadu_si512(iy + k), offset_y);
+		const __m512 w1 = _mm512_loadu_ps(x + k);
+		const __m512 w2 = _mm512_loadu_ps(y + k);
+
+		// Indexes and weights of the staggered grid points
+		const __mmask16 mask1 = _mm512_cmp_ps_mask(w1, half, _CMP_LT_OQ);
+		const __mmask16 mask2 = _mm512_cmp_ps_mask(w2, half, _CMP_LT_OQ);
+
+		const __m512i ih = _mm512_mask_sub_epi32(i, mask1, i, one_i);
+		const __m512i jh = _mm512_mask_sub_epi32(j, mask2, j, one_i);
+
+		const __m512 w1h = _mm512_add_ps(w1, _mm512_mask_blend_ps(mask1, minus_half, half));
+		const __m512 w2h = _mm512_add_ps(w2, _mm512_mask_blend_ps(mask2, minus_half, half));
+
+		// Interpolate fields
+		const __m512i idx_ih_j = cell_idx_avx512(ih, j, nrow_cells);
+		const __m512i idx_i_jh = cell_idx_avx512(i, jh, nrow_cells);
+		const __m512i idx_i_j = cell_idx_avx512(i, j, nrow_cells);
+		const __m512i idx_ih_jh = cell_idx_avx512(ih, jh, nrow_cells);
+
+		__m512 Epx = interp_avx512(E, idx_ih_j, nrow3, w1h, w2);
+		__m512 Epy = interp_avx512(E + FLD_COMP(1, param->nrow), idx_i_jh, nrow3, w1, w2h);
+		__m512 Epz = interp_avx512(E + FLD_COMP(2, param->nrow), idx_i_j, nrow3, w1, w2);
+
+		__m512 Bpx = interp_avx512(B, idx_i_jh, nrow3, w1, w2h);
+		__m512 Bpy = interp_avx512(B + FLD_COMP(1, param->nrow), idx_ih_j, nrow3, w1h, w2);
+		__m512 Bpz = interp_avx512(B + FLD_COMP(2, param->nrow), idx_ih_jh, nrow3, w1h, w2h);
+
+		// Advance u using Boris scheme
+		Epx = _mm512_mul_ps(Epx, tem);
+		Epy = _mm512_mul_ps(Epy, tem);
+		Epz = _mm512_mul_ps(Epz, tem);
+
+		__m512 utx = _mm512_add_ps(_mm512_loadu_ps(ux + k), Epx);
+		__m512 uty = _mm512_add_ps(_mm512_loadu_ps(uy + k), Epy);
+		__m512 utz = _mm512_add_ps(_mm512_loadu_ps(uz + k), Epz);
+
+		// Get time centered energy
+		const __m512 utsq = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(utx, utx),
+				_mm512_mul_ps(uty, uty)), _mm512_mul_ps(utz, utz));
+		const __m512 gamma = _mm512_sqrt_ps(_mm512_add_ps(one, utsq));
+		const __m512 energy = _mm512_div_ps(utsq, _mm512_add_ps(gamma, one));
+
+		energy_lo = _mm512_add_pd(energy_lo, _mm512_cvtps_pd(_mm512_castps512_ps256(energy)));
+		energy_hi = _mm512_add_pd(energy_hi, _mm512_cvtps_pd(_mm256_castpd_ps(
+				_mm512_extractf64x4_pd(_mm512_castps_pd(energy), 1))));
+
+		// Perform first half of the rotation
+		const __m512 gtem = _mm512_div_ps(tem, gamma);
+
+		Bpx = _mm512_mul_ps(Bpx, gtem);
+		Bpy = _mm512_mul_ps(Bpy, gtem);
+		Bpz = _mm512_mul_ps(Bpz, gtem);
+
+		const __m512 den = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(one, _mm512_mul_ps(Bpx, Bpx)),
+				_mm512_mul_ps(Bpy, Bpy)), _mm512_mul_ps(Bpz, Bpz));
+		const __m512 otsq = _mm512_div_ps(two, den);
+
+		__m512 u1 = _mm512_sub_ps(_mm512_add_ps(utx, _mm512_mul_ps(uty, Bpz)), _mm512_mul_ps(utz, Bpy));
+		__m512 u2 = _mm512_sub_ps(_mm512_add_ps(uty, _mm512_mul_ps(utz, Bpx)), _mm512_mul_ps(utx, Bpz));
+		__m512 u3 = _mm512_sub_ps(_mm512_add_ps(utz, _mm512_mul_ps(utx, Bpy)), _mm512_mul_ps(uty, Bpx));
+
+		// Perform second half of the rotation
+		Bpx = _mm512_mul_ps(Bpx, otsq);
+		Bpy = _mm512_mul_ps(Bpy, otsq);
+		Bpz = _mm512_mul_ps(Bpz, otsq);
+
+		utx = _mm512_add_ps(utx, CROSS_X(u2, u3, Bpy, Bpz));
+		uty = _mm512_add_ps(uty, CROSS_X(u3, u1, Bpz, Bpx));
+		utz = _mm512_add_ps(utz, CROSS_X(u1, u2, Bpx, Bpy));
+
+		// Perform second half of electric field acceleration
+		u1 = _mm512_add_ps(utx, Epx);
+		u2 = _mm512_add_ps(uty, Epy);
+		u3 = _mm512_add_ps(utz, Epz);
+
+		// Store new momenta
+		_mm512_storeu_ps(ux + k, u1);
+		_mm512_storeu_ps(uy + k, u2);
+		_mm512_storeu_ps(uz + k, u3);
+
+		// Particle displacement
+		const __m512 usq = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(one, _mm512_mul_ps(u1, u1)),
+				_mm512_mul_ps(u2, u2)), _mm512_mul_ps(u3, u3));
+		const __m512 rg = _mm512_div_ps(one, _mm512_sqrt_ps(usq));
+
+		_mm512_storeu_ps(dx + k, _mm512_mul_ps(_mm512_mul_ps(dt_dx, rg), u1));
+		_mm512_storeu_ps(dy + k, _mm512_mul_ps(_mm512_mul_ps(dt_dy, rg), u2));
+		_mm512_storeu_ps(qvz + k, _mm512_mul_ps(_mm512_mul_ps(q, u3), rg));
+	}
+
+	// Remaining particles
+	return _mm512_reduce_add_pd(_mm512_add_pd(energy_lo, energy_hi))
+			+ push_boris_scalar(param, np - nv, ix + nv, iy + nv, x + nv, y + nv, ux + nv, uy + nv,
+					uz + nv, dx + nv, dy + nv, qvz + nv);
+}
+
+#undef CROSS_X
+
+#endif
+
+static t_push_kernel push_kernel = push_boris_scalar;
+static const char *push_kernel_name = "scalar";
+
+// Select the push kernel for the current CPU (can be overridden with ZPIC_SIMD=scalar|avx2|avx512)
+void spec_select_push_kernel(void)
+{
+	push_kernel = push_boris_scalar;
+	push_kernel_name = "scalar";
+
+#ifdef SIMD_X86
+	switch (simd_select_isa())
+	{
+		case SIMD_AVX512:
+			push_kernel = push_boris_avx512;
+			push_kernel_name = "AVX-512 (16 particles/iteration)";
+			break;
+		case SIMD_AVX2:
+			push_kernel = push_boris_avx2;
+			push_kernel_name = "AVX2 (8 particles/iteration)";
+			break;
+		default:
+			break;
+	}
+#endif
+}
+
+// Name of the particle push kernel in use
+const char* spec_push_kernel_name(void)
+{
+	return push_kernel_name;
+}
+
+// Name of a particle pusher
+const char* spec_pusher_name(const enum pusher_type pusher)
+{
+	switch (pusher)
+	{
+		case VAY:
+			return "Vay";
+		case HIGUERA_CARY:
+			return "Higuera-Cary";
+		default:
+			return "Boris";
+	}
+}
+
+// Set the particle pusher of a species
+void spec_set_pusher(t_species *spec, const enum pusher_type pusher)
+{
+	spec->pusher = pusher;
+}
+
+// Push kernel of a particle pusher. Only Boris has SIMD versions (selected for the CPU)
+static t_push_kernel spec_pusher_kernel(const enum pusher_type pusher)
+{
+	switch (pusher)
+	{
+		case VAY:
+			return push_vay_scalar;
+		case HIGUERA_CARY:
+			return push_higuera_cary_scalar;
+		default:
+			return push_kernel;
+	}
+}
+
+// Push the particles in [begin, end) and deposit their current in J. The cell indexes of
+// the particles are converted to the indexes of E, B and J with the offsets in param.
+// The kinetic energy and the number of particles of each split case are accumulated in stats
+static void spec_push_range(t_species *spec, const t_push_param *param, const int begin,
+		const int end, t_fld *restrict const J, const int nrow, t_push_stats *restrict stats)
+{
+	// Auxiliary values for current deposition
+	const t_part_data qnx = spec->q * spec->dx[0] / spec->dt;
+	const t_part_data qny = spec->q * spec->dx[1] / spec->dt;
+	const int offset_x = param->offset_x;
+	const int offset_y = param->offset_y;
+
+	// The pusher is selected once for the whole range
+	const t_push_kernel kernel = spec_pusher_kernel(spec->pusher);
+
+	// Particle buffer (SoA)
+	int *restrict const part_ix = spec->main_vector.ix;
+	int *restrict const part_iy = spec->main_vector.iy;
+	t_part_data *restrict const part_x = spec->main_vector.x;
+	t_part_data *restrict const part_y = spec->main_vector.y;
+	t_part_data *restrict const part_ux = spec->main_vector.ux;
+	t_part_data *restrict const part_uy = spec->main_vector.uy;
+	t_part_data *restrict const part_uz = spec->main_vector.uz;
+
+	for (int k = begin; k < end; k += PUSH_BATCH)
+	{
+		const int np = (k + PUSH_BATCH > end) ? end - k : PUSH_BATCH;
+
+		t_part_data dx[PUSH_BATCH], dy[PUSH_BATCH], qvz[PUSH_BATCH];
+		t_part_data x1[PUSH_BATCH], y1[PUSH_BATCH];
+		int di[PUSH_BATCH], dj[PUSH_BATCH];
+
+		// Advance the momentum and calculate the displacement of the particles (vectorized)
+		stats->energy += kernel(param, np, part_ix + k, part_iy + k, part_x + k, part_y + k,
+				part_ux + k, part_uy + k, part_uz + k, dx, dy, qvz);
+
+		// Cell edges crossed by each particle (vectorized)
+		for (int n = 0; n < np; n++)
+		{
+			x1[n] = part_x[k + n] + dx[n];
+			y1[n] = part_y[k + n] + dy[n];
+			di[n] = LTRIM(x1[n]);
+			dj[n] = LTRIM(y1[n]);
+		}
+
+		if (spec->deposit == ESIRKEPOV)
+		{
+			for (int n = 0; n < np; n++)
+			{
+				const int i = k + n;
+				dep_current_esk(part_ix[i] - offset_x, part_iy[i] - offset_y, di[n], dj[n],
+						part_x[i], part_y[i], x1[n] - di[n], y1[n] - dj[n], qnx, qny, qvz[n], J,
+						nrow);
+			}
+
+		} else
+		{
+			// Group the particles by split case, so each one is deposited by a dedicated kernel
+			int list[NUM_SPLIT_CASES][PUSH_BATCH];
+			int count[NUM_SPLIT_CASES] = {0};
+
+			for (int n = 0; n < np; n++)
+			{
+				const int c = (di[n] != 0) + 2 * (dj[n] != 0);
+				list[c][count[c]++] = n;
+			}
+
+			for (int m = 0; m < count[SPLIT_NONE]; m++)
+			{
+				const int n = list[SPLIT_NONE][m];
+				const int i = k + n;
+				dep_zamb_none(part_ix[i] - offset_x, part_iy[i] - offset_y, part_x[i],
+						part_y[i], dx[n], dy[n], qnx, qny, qvz[n], J, nrow);
+			}
+
+			for (int m = 0; m < count[SPLIT_X]; m++)
+			{
+				const int n = list[SPLIT_X][m];
+				const int i = k + n;
+				dep_zamb_x(part_ix[i] - offset_x, part_iy[i] - offset_y, di[n], part_x[i],
+						part_y[i], dx[n], dy[n], qnx, qny, qvz[n], J, nrow);
+			}
+
+			for (int m = 0; m < count[SPLIT_Y]; m++)
+			{
+				const int n = list[SPLIT_Y][m];
+				const int i = k + n;
+				dep_zamb_y(part_ix[i] - offset_x, part_iy[i] - offset_y, dj[n], part_x[i],
+						part_y[i], dx[n], dy[n], qnx, qny, qvz[n], J, nrow);
+			}
+
+			for (int m = 0; m < count[SPLIT_XY]; m++)
+			{
+				const int n = list[SPLIT_XY][m];
+				const int i = k + n;
+				dep_current_zamb(part_ix[i] - offset_x, part_iy[i] - offset_y, di[n], dj[n],
+						part_x[i], part_y[i], dx[n], dy[n], qnx, qny, qvz[n], J, nrow);
+			}
+
+			for (int c = 0; c < NUM_SPLIT_CASES; c++)
+				stats->dep_case_count[c] += count[c];
+		}
+
+		// Move the particles (vectorized)
+		for (int n = 0; n < np; n++)
+		{
+			const int i = k + n;
+			part_x[i] = x1[n] - di[n];
+			part_y[i] = y1[n] - dj[n];
+			part_ix[i] += di[n];
+			part_iy[i] += dj[n];
+		}
+	}
+}
+
+#ifdef ENABLE_TILE_CACHE
+// Find the consecutive particles, starting at begin, located inside the tile window of the first
+// particle (its tile plus TILE_HALO cells in each direction, clipped to the region). Returns the
+// end of the run and the window limits
+static int tile_find_run(const t_part_vector *vector, const int begin, const int limits[2][2],
+		int window[2][2])
+{
+	const int *restrict const ix = vector->ix;
+	const int *restrict const iy = vector->iy;
+
+	window[0][0] = MAX(((ix[begin] - limits[0][0]) / TILE_SIZE) * TILE_SIZE - TILE_HALO + limits[0][0],
+			limits[0][0]);
+	window[0][1] = MIN(((ix[begin] - limits[0][0]) / TILE_SIZE + 1) * TILE_SIZE + TILE_HALO
+			+ limits[0][0], limits[0][1]);
+	window[1][0] = MAX(((iy[begin] - limits[1][0]) / TILE_SIZE) * TILE_SIZE - TILE_HALO + limits[1][0],
+			limits[1][0]);
+	window[1][1] = MIN(((iy[begin] - limits[1][0]) / TILE_SIZE + 1) * TILE_SIZE + TILE_HALO
+			+ limits[1][0], limits[1][1]);
+
+	const unsigned int width = window[0][1] - window[0][0];
+	const unsigned int height = window[1][1] - window[1][0];
+
+	int k;
+	for (k = begin + 1; k < vector->size; k++)
+		if ((unsigned int) (ix[k] - window[0][0]) >= width
+				|| (unsigned int) (iy[k] - window[1][0]) >= height) break;
+
+	return k;
+}
+
+// Copy the field values used by the particles inside the window to the tile cache (same layout
+// as the region fields). Each row is copied as 3 / FLD_STRIDE contiguous planes
+static void tile_load_fld(const t_fld *restrict const fld, const int nrow, const int window[2][2],
+		t_fld *restrict tile_fld)
+{
+	const int width = window[0][1] - window[0][0] + 2;
+
+	for (int j = window[1][0] - 1; j <= window[1][1]; j++)
+	{
+		const t_fld *restrict const row = fld + FLD_CELL(window[0][0] - 1, j, nrow);
+
+		for (int c = 0; c < 3 / FLD_STRIDE; c++)
+			memcpy(tile_fld + FLD_COMP(c, TILE_FLD_NROW), row + FLD_COMP(c, nrow),
+					width * FLD_STRIDE * sizeof(t_fld));
+
+		tile_fld += FLD_CELL(0, 1, TILE_FLD_NROW);
+	}
+}
+
+// Add the current deposited in the tile buffer to the region current
+static void tile_store_current(const t_fld *restrict tile_J, const int window[2][2],
+		t_fld *restrict const J, const int nrow)
+{
+	for (int j = window[1][0] - 1; j <= window[1][1] + 1; j++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			const t_fld *restrict const tile_row = tile_J + FLD_COMP(c, TILE_J_NROW);
+			t_fld *restrict const row = J + FLD_CELL(0, j, nrow) + FLD_COMP(c, nrow);
+
+			for (int i = window[0][0] - 1; i <= window[0][1] + 1; i++)
+				row[i * FLD_STRIDE] += tile_row[(i - window[0][0] + 1) * FLD_STRIDE];
+		}
+
+		tile_J += FLD_CELL(0, 1, TILE_J_NROW);
+	}
+}
+
+// Push the particles in [begin, end) using the tile cache. Consecutive particles located in the
+// same tile window are pushed using a local copy of E and B, while their current is accumulated
+// in a local buffer that is added to J at the end
+static void spec_push_tiles(t_species *spec, const t_push_param *param, const t_emf *emf,
+		int begin, const int end_range, t_fld *restrict const J, const int nrow,
+		const int limits[2][2], t_push_stats *restrict stats)
+{
+	while (begin < end_range)
+	{
+		int window[2][2];
+		int end = MIN(tile_find_run(&spec->main_vector, begin, limits, window), end_range);
+
+		if (end - begin >= TILE_MIN_PART)
+		{
+			t_fld tile_E[3 * TILE_FLD_NROW * TILE_FLD_NROW];
+			t_fld tile_B[3 * TILE_FLD_NROW * TILE_FLD_NROW];
+			t_fld tile_J[3 * TILE_J_NROW * TILE_J_NROW];
+
+			// Region local coordinates
+			window[0][0] -= limits[0][0];
+			window[0][1] -= limits[0][0];
+			window[1][0] -= limits[1][0];
+			window[1][1] -= limits[1][0];
+
+			tile_load_fld(emf->E, emf->nrow, window, tile_E);
+			tile_load_fld(emf->B, emf->nrow, window, tile_B);
+			memset(tile_J, 0, sizeof(tile_J));
+
+			// The cell (window[0][0], window[1][0]) corresponds to the cell (1, 1) of the tile
+			t_push_param tile_param = *param;
+			tile_param.E = tile_E + FLD_CELL(1, 1, TILE_FLD_NROW);
+			tile_param.B = tile_B + FLD_CELL(1, 1, TILE_FLD_NROW);
+			tile_param.nrow = TILE_FLD_NROW;
+			tile_param.offset_x = window[0][0] + limits[0][0];
+			tile_param.offset_y = window[1][0] + limits[1][0];
+
+			spec_push_range(spec, &tile_param, begin, end, tile_J + FLD_CELL(1, 1, TILE_J_NROW),
+					TILE_J_NROW, stats);
+			tile_store_current(tile_J, window, J, nrow);
+
+		} else
+		{
+			// Consecutive small runs are pushed together using the region E, B and J
+			int next;
+			while (end < end_range)
+			{
+				next = MIN(tile_find_run(&spec->main_vector, end, limits, window), end_range);
+				if (next - end >= TILE_MIN_PART) break;
+				end = next;
+			}
+
+			spec_push_range(spec, param, begin, end, J, nrow, stats);
+		}
+
+		begin = end;
+	}
+}
+#endif
+
+// Number of chunks of the particle buffer and of the current buffers they deposit in. There are at
+// most as many buffers as CPUs (the region current and the private ones), shared by the chunks in
+// a round-robin way. The private current buffers and the statistics of the chunks are allocated
+// if needed
+static int spec_num_chunks(t_species *spec, const t_current *current, int *n_buf)
+{
+	int n_chunks = 1;
+	if (spec->chunk_size > 0 && spec->main_vector.size > spec->chunk_size)
+		n_chunks = (spec->main_vector.size + spec->chunk_size - 1) / spec->chunk_size;
+
+	const int n_cpus = nanos6_get_num_cpus();
+	*n_buf = (n_chunks < n_cpus) ? n_chunks : n_cpus;
+
+	if (*n_buf - 1 > spec->n_J_chunk)
+	{
+		realloc_vector((void**) &spec->J_chunk, spec->n_J_chunk, *n_buf - 1, sizeof(t_vfld*),
+				MEM_CURRENT);
+		for (int c = spec->n_J_chunk; c < *n_buf - 1; c++)
+			spec->J_chunk[c] = mem_alloc(current->total_size * sizeof(t_vfld), MEM_CURRENT);
+		spec->n_J_chunk = *n_buf - 1;
+	}
+
+	if (n_chunks > spec->n_push_stats)
+	{
+		free(spec->push_stats);
+		spec->push_stats = malloc(n_chunks * sizeof(t_push_stats));
+		assert(spec->push_stats);
+		spec->n_push_stats = n_chunks;
+	}
+
+	return n_chunks;
+}
+
+// Push the particles in [begin, end) and deposit their current in the J_buf buffer (same layout
+// as the region current). The first chunk that uses a private buffer resets it
+#pragma oss task label("Spec Advance Chunk") \
+	in(emf->E_buf[0; emf->total_size]) in(emf->B_buf[0; emf->total_size]) \
+	inout(J_buf[0; current->total_size]) out(*stats)
+static void spec_advance_chunk(t_species *spec, const t_emf *emf, const t_current *current,
+		t_vfld *J_buf, const bool reset, const t_push_param *param, const int begin,
+		const int end, const int limits[2][2], t_push_stats *stats)
+{
+	// The chunk is timed as a whole (momentum advance and current deposit)
+	const uint64_t t0 = timer_ticks_ns();
+
+	if (reset) memset(J_buf, 0, current->total_size * sizeof(t_vfld));
+	memset(stats, 0, sizeof(t_push_stats));
+
+	// Same offset of the guard cells as the region current
+	t_fld *restrict const J = (t_fld*) J_buf + (current->J - (t_fld*) current->J_buf);
+
+#ifdef ENABLE_TILE_CACHE
+	spec_push_tiles(spec, param, emf, begin, end, J, current->nrow, limits, stats);
+#else
+	spec_push_range(spec, param, begin, end, J, current->nrow, stats);
+#endif
+
+	stats->pusher_time = timer_interval_seconds_ns(t0, timer_ticks_ns());
+}
+
+// Add the current of one chunk to the current of another one (tree reduction)
+#pragma oss task label("Spec Current Reduction") inout(J[0; size]) in(J_chunk[0; size])
+static void spec_reduce_current(t_vfld *restrict J, const t_vfld *restrict J_chunk, const int size)
+{
+	t_fld *restrict const f = (t_fld*) J;
+	const t_fld *restrict const f_chunk = (const t_fld*) J_chunk;
+
+	for (int i = 0; i < 3 * size; i++)
+		f[i] += f_chunk[i];
+}
+
+// Particle advance
+void spec_advance(t_species *spec, const t_emf *emf, t_current *current, const int limits[2][2])
+{
+	// Particles received from the adjacent regions in the previous iteration
+	spec_merge_vectors(spec);
+
+	uint64_t t0 = timer_ticks();
+
+	const int nx0 = spec->nx[0];
+	const int nx1 = spec->nx[1];
+	const t_part_data tem = 0.5 * spec->dt / spec->m_q;
+	const t_part_data dt_dx = spec->dt / spec->dx[0];
+	const t_part_data dt_dy = spec->dt / spec->dx[1];
+
+	// Particle buffer (SoA)
+	int *restrict const part_ix = spec->main_vector.ix;
+	int *restrict const part_iy = spec->main_vector.iy;
+
+	// Region limits in the absolute cells of the particles (see n_move)
+	const int part_limits[2][2] = {{limits[0][0] + spec->n_move, limits[0][1] + spec->n_move},
+								   {limits[1][0], limits[1][1]}};
+
+	const t_push_param param = {.E = emf->E, .B = emf->B, .nrow = emf->nrow, .offset_x = part_limits[0][0],
+								.offset_y = limits[1][0], .tem = tem, .dt_dx = dt_dx, .dt_dy = dt_dy,
+								.q = spec->q};
+
+	const int np_push = spec->main_vector.size;
+	spec->npush += np_push;
+
+	// Advance internal iteration number
+	spec->iter += 1;
+
+	// Advance particles. The buffer is split in chunks, each one pushed by a different task. The
+	// chunks deposit in n_buf current buffers in a round-robin way (the first buffer is the region
+	// current), and the chunks that share a buffer are serialized by its dependency
+	int n_buf;
+	const int n_chunks = spec_num_chunks(spec, current, &n_buf);
+	t_push_stats *restrict stats = spec->push_stats;
+	t_vfld **J_chunk = spec->J_chunk;
+
+	for (int c = 0; c < n_chunks; c++)
+	{
+		const int begin = c * spec->chunk_size;
+		const int end = (c == n_chunks - 1) ? np_push : begin + spec->chunk_size;
+		const int b = c % n_buf;
+		t_vfld *J_buf = (b == 0) ? current->J_buf : J_chunk[b - 1];
+
+		spec_advance_chunk(spec, emf, current, J_buf, c > 0 && c < n_buf, &param, begin, end,
+				part_limits, &stats[c]);
+	}
+
+	// Reduce the current of all buffers (tree reduction)
+	for (int stride = 1; stride < n_buf; stride *= 2)
+	{
+		for (int c = 0; c + stride < n_buf; c += 2 * stride)
+		{
+			t_vfld *J_buf = (c == 0) ? current->J_buf : J_chunk[c - 1];
+			spec_reduce_current(J_buf, J_chunk[c + stride - 1], current->total_size);
+		}
+	}
+
+	#pragma oss taskwait
+
+	for (int c = 0; c < n_chunks; c++)
+	{
+		spec->energy += stats[c].energy;
+		spec->pusher_time += stats[c].pusher_time;
+
+		for (int k = 0; k < NUM_SPLIT_CASES; k++)
+		{
+			spec->dep_case_count[k] += stats[c].dep_case_count[k];
+		}
 	}
 
 	// Particle post processing (Transfer particles between regions and move the simulation
-	// window, if applicable)
+	// window, if applicable). The window is moved by changing the offset between the absolute
+	// cells of the particles and the cells of the window, so the particles are not shifted
+	const bool shift = spec->moving_window
+			&& (spec->iter * spec->dt) > (spec->dx[0] * (spec->n_move + 1));
+
+	if (shift) spec->n_move++;
+	const int n_move = spec->n_move;
+
+	// The adjacent regions must have received the particles sent two iterations ago (the same
+	// parity of the queue)
+	for (int dir = 0; dir < NUM_ADJ_PART; dir++)
+		if (spec->outgoing_part[dir]) part_queue_reserve(spec->outgoing_part[dir], spec->iter);
+
 	for(int i = 0; i < spec->main_vector.size; i++)
 	{
-		int iy = spec->main_vector.data[i].iy;
+		// Check for particles leaving the simulation space (cells of the window)
+		const int ix = part_ix[i] - n_move;
+		const int iy = part_iy[i];
 
-		// First shift particle left (if applicable), then check for particles leaving the simulation space
 		if (spec->moving_window)
 		{
-			if ((spec->iter * spec->dt) > (spec->dx[0] * (spec->n_move + 1)))
-				spec->main_vector.data[i].ix--;
-
-			if ((spec->main_vector.data[i].ix < 0) || (spec->main_vector.data[i].ix >= nx0))
+			if ((ix < 0) || (ix >= nx0))
 			{
-				spec->main_vector.data[i].invalid = true;
+				part_ix[i] = PART_INVALID;
+				spec_add_hole(spec, i);
 				continue;
 			}
 		} else
 		{
 			// Periodic boundaries for X axis
-			if (spec->main_vector.data[i].ix < 0) spec->main_vector.data[i].ix += nx0;
-			else if (spec->main_vector.data[i].ix >= nx0) spec->main_vector.data[i].ix -= nx0;
+			if (part_ix[i] < 0) part_ix[i] += nx0;
+			else if (part_ix[i] >= nx0) part_ix[i] -= nx0;
 		}
 
 		// Periodic boudaries for Y axis
-		if (spec->main_vector.data[i].iy < 0) spec->main_vector.data[i].iy += nx1;
-		else if (spec->main_vector.data[i].iy >= nx1) spec->main_vector.data[i].iy -= nx1;
+		if (part_iy[i] < 0) part_iy[i] += nx1;
+		else if (part_iy[i] >= nx1) part_iy[i] -= nx1;
 
-		//Verify if the particle is still in the correct region. If not send the particle to the correct one
-		if (iy < limits_y[0]) // Particles going to the region below
-		{
-			spec_add_to_outgoing_vector(spec->outgoing_part[0], spec->main_vector.data[i]);
-			spec->main_vector.data[i].invalid = true; // Mark the particle as invalid
+		//Verify if the particle is still in the correct region. If not send the particle to the
+		//adjacent region in that direction (see part_direction)
+		const int dir_x = (ix < limits[0][0]) ? 0 : ((ix >= limits[0][1]) ? 2 : 1);
+		const int dir_y = (iy < limits[1][0]) ? 0 : ((iy >= limits[1][1]) ? 2 : 1);
+		int dir = dir_x + 3 * dir_y;
 
-		} else if (iy >= limits_y[1]) // Particles going to the region above
-		{
-			spec_add_to_outgoing_vector(spec->outgoing_part[1], spec->main_vector.data[i]);
-			spec->main_vector.data[i].invalid = true; // Mark the particle as invalid
-		}
+		if (dir == 4) continue;
+		if (dir > 4) dir--;
+
+		// Without other regions in that direction, the particle crossed a periodic boundary and
+		// stays in this region
+		if (spec->outgoing_part[dir] == &spec->incoming_part[OPPOSITE_DIR(dir)]) continue;
+
+		part_queue_push(spec->outgoing_part[dir], &spec->main_vector, i, spec->iter);
+		part_ix[i] = PART_INVALID; // Mark the particle as invalid
+		spec_add_hole(spec, i);
 	}
 
-	if (spec->moving_window && (spec->iter * spec->dt) > (spec->dx[0] * (spec->n_move + 1)))
+	// Publish the particles sent in this iteration (the queues without particles are published
+	// as well, so the adjacent regions know that this iteration is complete)
+	for (int dir = 0; dir < NUM_ADJ_PART; dir++)
+		if (spec->outgoing_part[dir]) part_queue_publish(spec->outgoing_part[dir], spec->iter);
+
+	// Inject particles in the right edge of the simulation box
+	if (shift && limits[0][1] == nx0)
+	{
+		const int range[][2] = {{nx0 - 1, nx0}, {limits[1][0], limits[1][1]}};
+		spec_inject_particles(&spec->main_vector, range, spec->ppc, &spec->density, spec->dx,
+				n_move, spec->ufl, spec->uth, spec->id);
+	}
+
+	const double push_time = timer_interval_seconds(t0, timer_ticks());
+	spec->push_time += push_time;
+
+	if (np_push > 0)
 	{
-		// Increase moving window counter
-		spec->n_move++;
+		spec->push_rate = push_time / np_push;
 
-		// Inject particles in the right edge of the simulation box
-		const int range[][2] = {{spec->nx[0] - 1, spec->nx[0]}, {limits_y[0], limits_y[1]}};
-		spec_inject_particles(&spec->main_vector, range, spec->ppc, &spec->density,
-				spec->dx, spec->n_move, spec->ufl, spec->uth);
+		// Compare with the push rate measured before the last sorting
+		if (spec->n_sorts > 0)
+			spec->push_time_saved += spec->push_rate_unsorted * np_push - push_time;
 	}
 }
 
@@ -796,11 +2532,11 @@ void spec_deposit_charge(const t_species *spec, t_part_data *charge)
 
 	for (int i = 0; i < spec->main_vector.size; i++)
 	{
-		int idx = spec->main_vector.data[i].ix + nrow * spec->main_vector.data[i].iy;
+		int idx = spec->main_vector.ix[i] - spec->n_move + nrow * spec->main_vector.iy[i];
 		t_fld w1, w2;
 
-		w1 = spec->main_vector.data[i].x;
-		w2 = spec->main_vector.data[i].y;
+		w1 = spec->main_vector.x[i];
+		w2 = spec->main_vector.y[i];
 
 		charge[idx] += (1.0f - w1) * (1.0f - w2) * q;
 		charge[idx + 1] += (w1) * (1.0f - w2) * q;
@@ -865,25 +2601,25 @@ void spec_pha_axis(const t_species *spec, int i0, int np, int quant, float *axis
 	{
 		case X1:
 			for (i = 0; i < np; i++)
-				axis[i] = (spec->main_vector.data[i0 + i].x + spec->main_vector.data[i0 + i].ix)
-						* spec->dx[0];
+				axis[i] = (spec->main_vector.x[i0 + i] + (spec->main_vector.ix[i0 + i]
+						- spec->n_move)) * spec->dx[0];
 			break;
 		case X2:
 			for (i = 0; i < np; i++)
-				axis[i] = (spec->main_vector.data[i0 + i].y + spec->main_vector.data[i0 + i].iy)
+				axis[i] = (spec->main_vector.y[i0 + i] + spec->main_vector.iy[i0 + i])
 						* spec->dx[1];
 			break;
 		case U1:
 			for (i = 0; i < np; i++)
-				axis[i] = spec->main_vector.data[i0 + i].ux;
+				axis[i] = spec->main_vector.ux[i0 + i];
 			break;
 		case U2:
 			for (i = 0; i < np; i++)
-				axis[i] = spec->main_vector.data[i0 + i].uy;
+				axis[i] = spec->main_vector.uy[i0 + i];
 			break;
 		case U3:
 			for (i = 0; i < np; i++)
-				axis[i] = spec->main_vector.data[i0 + i].uz;
+				axis[i] = spec->main_vector.uz[i0 + i];
 			break;
 	}
 }
@@ -1020,8 +2756,8 @@ void spec_calculate_energy(t_species *spec)
 
 	for (int i = 0; i < part->size; i++)
 	{
-		t_part_data usq = part->data[i].ux * part->data[i].ux + part->data[i].uy * part->data[i].uy
-				+ part->data[i].uz * part->data[i].uz;
+		t_part_data usq = part->ux[i] * part->ux[i] + part->uy[i] * part->uy[i]
+				+ part->uz[i] * part->uz[i];
 		t_part_data gamma = sqrtf(1 + usq);
 		spec->energy += usq / (gamma + 1.0);
 	}
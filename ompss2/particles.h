@@ -14,24 +14,17 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <limits.h>
 
 #include "zpic.h"
 #include "emf.h"
 #include "current.h"
+#include "memory.h"
 
 #define MAX_SPNAME_LEN 32
+#define TILE_SIZE 16
 #define LTRIM(x) (x >= 1.0f) - (x < 0.0f)
 
-typedef struct {
-	int ix, iy;
-	t_part_data x, y;
-	t_part_data ux, uy, uz;
-
-	// Mark the particle as invalid (the particle exited the region)
-	bool invalid;
-
-} t_part;
-
 enum density_type {
 	UNIFORM, STEP, SLAB
 };
@@ -43,20 +36,99 @@ typedef struct {
 
 } t_density;
 
-// Particle data buffer
+// Current deposition scheme
+enum deposit_type {
+	ZAMB, ESIRKEPOV
+};
+
+// Particle pusher (momentum advance) scheme
+enum pusher_type {
+	BORIS, VAY, HIGUERA_CARY, NUM_PUSHERS
+};
+
+// Trajectory split cases of the Zamb deposit (cell edges crossed by the particle)
+enum split_case {
+	SPLIT_NONE, SPLIT_X, SPLIT_Y, SPLIT_XY, NUM_SPLIT_CASES
+};
+
+// Particles that exited the region are marked as invalid by setting ix to this value
+#define PART_INVALID INT_MIN
+
+// Direction of the adjacent regions (particle exchange)
+enum part_direction {
+	PART_DOWN_LEFT = 0,
+	PART_DOWN = 1,
+	PART_DOWN_RIGHT = 2,
+	PART_LEFT = 3,
+	PART_RIGHT = 4,
+	PART_UP_LEFT = 5,
+	PART_UP = 6,
+	PART_UP_RIGHT = 7
+};
+#define NUM_ADJ_PART 8
+
+// Calculate the opposite direction
+#define OPPOSITE_DIR(dir) ((NUM_ADJ_PART - 1) - (dir))
+
+// Direction in x of an adjacent region (0 - left, 1 - same column, 2 - right)
+#define DIR_X(dir) (((dir) < 4 ? (dir) : (dir) + 1) % 3)
+
+// Particle data buffer (SoA)
 typedef struct {
-	t_part *data;
+	int *ix, *iy;
+	t_part_data *x, *y;
+	t_part_data *ux, *uy, *uz;
+
 	int size;
 	int size_max;
+	int n_grow;		// Number of reallocations (see spec_merge_vectors)
 } t_part_vector;
 
+// Bounded single-producer / single-consumer queue of the particles sent by an adjacent region.
+// The producer (push of the adjacent region) appends the particles that leave its region and
+// publishes its position at the end of each iteration. The consumer (this species) drains the
+// particles of the previous iteration at the beginning of its push, while the producer may already
+// be appending the ones of the current iteration. When the queue is full, the remaining particles
+// of that iteration go to the overflow buffer of the iteration, so the producer never waits for
+// free slots. Each side only waits for the other one if it gets too far ahead (the task is blocked
+// in the runtime, see part_queue_wait)
+typedef struct {
+	t_part_vector buf;		// Particle slots (the capacity size_max is a power of 2)
+	unsigned int head;		// Consumer position (written by the consumer)
+	unsigned int tail;		// Producer position (private to the producer)
+	unsigned int head_cache;	// Last consumer position seen by the producer
+	bool overflow_on;		// The queue was full in the current iteration of the producer
+	bool has_producer;		// False across the x edges of the box with a moving window
+
+	// Producer position at the end of each iteration (by parity)
+	unsigned int mark[2];
+
+	// Last iteration published by the producer and drained by the consumer (monotonic)
+	int published;
+	int consumed;
+	void *waiter;			// Blocked task waiting for the other side of the queue
+
+	// Particles that did not fit in the queue (by iteration parity)
+	t_part_vector overflow[2];
+} t_part_queue;
+
+// Statistics of a push chunk (added to the species after all the chunks finish)
+typedef struct {
+	double energy;
+	double pusher_time;
+	double dep_case_count[NUM_SPLIT_CASES];
+} t_push_stats;
+
 typedef struct {
 	char name[MAX_SPNAME_LEN];
 
+	// Species index in the simulation (key of the random number generator)
+	int id;
+
 	// Particle data buffer
 	t_part_vector main_vector;
-	t_part_vector incoming_part[2];    	// Temporary buffer for incoming particles
-	t_part_vector *outgoing_part[2]; 	// Outgoing particles (0 - Below / 1 - Above)
+	t_part_queue incoming_part[NUM_ADJ_PART];    	// Particles sent by each adjacent region
+	t_part_queue *outgoing_part[NUM_ADJ_PART]; 	// Outgoing particles (NULL if none are sent)
 
 	// Mass over charge ratio
 	t_part_data m_q;
@@ -91,10 +163,58 @@ typedef struct {
 	// Iteration number
 	int iter;
 
-	// Moving window
+	// Moving window. The cell index ix of the particles is absolute (the particles do not move
+	// when the window moves), the cell of the window is ix - n_move
 	bool moving_window;
 	int n_move;
 
+	// Indexes of the particles that exited the region in the last iteration (sorted)
+	int *holes;
+	int n_holes;
+	int holes_max;
+
+	// Exchange buffers (incoming queues and hole list): high-water mark of the particles received
+	// from each direction and of the holes in one iteration, number of particles that went through
+	// the overflow buffers and number of buffer growths in the push (zero in steady state) and
+	// when the buffers are pre-sized outside the push
+	int exchange_hwm[NUM_ADJ_PART];
+	int holes_hwm;
+	int exchange_overflow;
+	int exchange_push_grow;
+	int exchange_merge_grow;
+
+	// Push chunks (0 - one chunk), their private current buffers and their statistics
+	int chunk_size;
+	t_vfld **J_chunk;
+	int n_J_chunk;
+	t_push_stats *push_stats;
+	int n_push_stats;
+
+	// Particle sorting (frequency and number of sorts)
+	int n_sort;
+	int n_sorts;
+	double sort_time;
+	double push_time;
+	double push_time_saved;		// Estimated push time saved by the sorting
+	double push_rate;			// Push time per particle in the last iteration
+	double push_rate_unsorted;	// Push time per particle before the last sorting
+
+	// Sorting buffers, kept between sorts (sort_buffer is swapped with the particle arrays, so
+	// it holds sort_buffer_max values)
+	void *sort_buffer;
+	int sort_buffer_max;
+	int *sort_pos;
+	int sort_pos_max;
+	int *sort_tile_offset;
+	int sort_n_tiles_max;
+
+	// Particle pusher and time spent in the push chunks (momentum advance and current deposit)
+	enum pusher_type pusher;
+	double pusher_time;
+
+	// Current deposition
+	enum deposit_type deposit;
+	double dep_case_count[NUM_SPLIT_CASES];		// Number of particles in each split case
 
 } t_species;
 
@@ -104,25 +224,54 @@ void spec_new(t_species *spec, char name[], const t_part_data m_q, const int ppc
 		const float dt, t_density *density);
 void spec_inject_particles(t_part_vector *part_vector, const int range[][2], const int ppc[2],
 		const t_density *part_density, const t_part_data dx[2], const int n_move,
-		const t_part_data ufl[3], const t_part_data uth[3]);
+		const t_part_data ufl[3], const t_part_data uth[3], const int spec_id);
 void spec_delete(t_species *spec);
+void spec_free_chunk_buffers(t_species *spec);
+void spec_select_push_kernel(void);
+void spec_set_pusher(t_species *spec, const enum pusher_type pusher);
 
 // Report - General
 double spec_time(void);
 double spec_perf(void);
+const char* spec_push_kernel_name(void);
+const char* spec_pusher_name(const enum pusher_type pusher);
+// Deposit benchmark (DEP_BENCH_NPART particles of each split case)
+#define DEP_BENCH_NPART 4096
+void spec_bench_deposit(const t_current *current, double zamb_ns[NUM_SPLIT_CASES],
+		double esk_ns[NUM_SPLIT_CASES]);
 
 // Utilities
-void realloc_vector(void **restrict ptr, const int old_size, const int new_size, const size_t type_size);
+void realloc_vector(void **restrict ptr, const int old_size, const int new_size, const size_t type_size,
+		const enum mem_type type);
+void part_vector_alloc(t_part_vector *vector, const int size_max);
+void part_vector_free(t_part_vector *vector);
+void part_vector_realloc(t_part_vector *vector, const int new_size);
+void part_vector_assign_valid_part(const t_part_vector *source, const int source_idx,
+		t_part_vector *target, const int target_idx);
+void part_vector_move_cells(t_part_vector *vector, const int limits[2][2], const bool inside,
+		t_part_vector *target);
+void part_vector_memcpy(const t_part_vector *source, t_part_vector *target, const int begin,
+		const int size);
+
+// Particle exchange. The push drains the incoming queues itself, these functions are only called
+// outside the tasks (after waiting for the push of all the regions)
+void spec_merge_vectors(t_species *spec);
+void spec_resize_queues(t_species *spec);
 
-// CPU Tasks
+// CPU Tasks (the species of a region can deposit their current in any order). The particles sent
+// to the adjacent regions go through the lock-free queues (see t_part_queue), without dependencies
+// between the pushes of adjacent regions
 #pragma oss task label("Spec Advance") \
 	in(emf->E_buf[0; emf->total_size]) in(emf->B_buf[0; emf->total_size]) \
-	inout(spec->main_vector) inout(current->J_buf[0; current->total_size]) \
-	out(*spec->outgoing_part[0]) out(*spec->outgoing_part[1]) priority(5)
-void spec_advance(t_species *spec, const t_emf *emf, t_current *current, const int limits_y[2]);
+	inout(spec->main_vector) commutative(current->J_buf[0; current->total_size]) priority(5)
+void spec_advance(t_species *spec, const t_emf *emf, t_current *current, const int limits[2][2]);
 
-#pragma oss task in(spec->incoming_part[0:1]) inout(spec->main_vector) label("Spec Merge Vectors")
-void spec_merge_vectors(t_species *spec);
+#pragma oss task inout(spec->main_vector) label("Spec Init Particles")
+void spec_init_queues(t_species *spec, const int limits[2][2]);
+void spec_init_particles(t_species *spec, const int limits[2][2]);
+
+#pragma oss task inout(spec->main_vector) label("Spec Sort")
+void spec_sort(t_species *spec, const int limits[2][2]);
 
 /*********************************************************************************************
  Diagnostics
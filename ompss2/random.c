@@ -10,6 +10,10 @@
 #include "random.h"
 #include <math.h>
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 uint32_t m_w = 12345; /* must not be zero */
 uint32_t m_z = 67890; /* must not be zero */
 
@@ -66,3 +70,73 @@ double rand_norm(void)
 	}
 
 }
+
+/*********************************************************************************************
+ Counter-based generator (Philox4x32-10, J. K. Salmon et al., SC'11)
+ *********************************************************************************************/
+#define PHILOX_M0 0xD2511F53
+#define PHILOX_M1 0xCD9E8D57
+#define PHILOX_W0 0x9E3779B9
+#define PHILOX_W1 0xBB67AE85
+
+uint32_t philox_key = 12345;
+
+void set_philox_seed(uint32_t seed)
+{
+	philox_key = seed;
+}
+
+uint32_t philox_seed(void)
+{
+	return philox_key;
+}
+
+// Generate 4 random 32-bit integers for each one of the n counters (vectorizable)
+void rand_philox4x32(const int n, const uint32_t ctr[][4], const uint32_t key[2], uint32_t out[][4])
+{
+	for (int i = 0; i < n; i++)
+	{
+		uint32_t c0 = ctr[i][0], c1 = ctr[i][1], c2 = ctr[i][2], c3 = ctr[i][3];
+		uint32_t k0 = key[0], k1 = key[1];
+
+		for (int r = 0; r < 10; r++)
+		{
+			const uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+			const uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+
+			c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+			c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+			c1 = (uint32_t) p1;
+			c3 = (uint32_t) p0;
+
+			k0 += PHILOX_W0;
+			k1 += PHILOX_W1;
+		}
+
+		out[i][0] = c0;
+		out[i][1] = c1;
+		out[i][2] = c2;
+		out[i][3] = c3;
+	}
+}
+
+// Convert the output of the Philox generator into 4 normal deviates (Box-Muller)
+void rand_norm4(const int n, const uint32_t in[][4], float out[][4])
+{
+	for (int i = 0; i < n; i++)
+	{
+		// Uniform numbers in (0, 1]
+		const float u0 = (in[i][0] + 1.0) / 4294967296.0;
+		const float u2 = (in[i][2] + 1.0) / 4294967296.0;
+
+		const float r0 = sqrtf(-2.0f * logf(u0));
+		const float r1 = sqrtf(-2.0f * logf(u2));
+		const float a0 = (float) (2.0 * M_PI / 4294967296.0) * in[i][1];
+		const float a1 = (float) (2.0 * M_PI / 4294967296.0) * in[i][3];
+
+		out[i][0] = r0 * cosf(a0);
+		out[i][1] = r0 * sinf(a0);
+		out[i][2] = r1 * cosf(a1);
+		out[i][3] = r1 * sinf(a1);
+	}
+}
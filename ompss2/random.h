@@ -17,4 +17,13 @@ void set_rand_seed(uint32_t m_z_, uint32_t m_w_);
 double rand_norm(void);
 uint32_t rand_uint32(void);
 
+// Counter-based generator (Philox4x32-10). The numbers only depend on the counter and the key,
+// so they can be generated in any order and by any thread
+#define RAND_BATCH 256
+
+void set_philox_seed(uint32_t seed);
+uint32_t philox_seed(void);
+void rand_philox4x32(const int n, const uint32_t ctr[][4], const uint32_t key[2], uint32_t out[][4]);
+void rand_norm4(const int n, const uint32_t in[][4], float out[][4]);
+
 #endif
@@ -16,106 +16,248 @@
 #include <string.h>
 #include <assert.h>
 #include "timer.h"
+#include "memory.h"
 
 /*********************************************************************************************
  Initialisation
  *********************************************************************************************/
 
-// Initialize a given region
-void region_new(t_region *region, int n_regions, int nx[2], int id, int n_spec, t_species *spec,
-		float box[], float dt, t_region *prev_region, t_region *next_region)
+// Initialise the current and the fields of a region. The buffers are allocated and zeroed inside a
+// task, so the pages are first touched by a worker (and placed in the NUMA node of the region)
+#pragma oss task out(region->local_current) out(region->local_emf) label("Region Init Fields")
+static void region_init_fields(t_region *region, const float box_x, const float box_y,
+		const float dt)
+{
+	float region_box[] = {box_x, box_y};
+
+	// Initialise the local current
+	current_new(&region->local_current, region->nx, region_box, dt, region->numa_node);
+
+	// Initialise the local emf
+	emf_new(&region->local_emf, region->nx, region_box, dt, region->numa_node);
+}
+
+// Initialize a given region. The regions form a n_regions[0] x n_regions[1] grid, ordered by rows
+// (region id = column + row * n_regions[0])
+void region_new(t_region *region, const int n_regions[2], int nx[2], int id, int n_spec,
+		t_species *spec, float box[], float dt, t_region *prev_region, t_region *next_region,
+		t_region *left_region, t_region *right_region)
 {
 	region->id = id;
-	region->prev = prev_region; // Previous region in the list
+	region->prev = prev_region; // Adjacent regions in the grid (periodic)
 	region->next = next_region;
+	region->left = left_region;
+	region->right = right_region;
+	region->push_time = 0.0;
+
+	// Regions are assigned to NUMA nodes in blocks of consecutive ids (adjacent rows)
+	region->numa_node = id * numa_num_nodes() / (n_regions[0] * n_regions[1]);
 
 	// Region boundaries
-	region->limits_y[0] = floor((float) id * nx[1] / n_regions);
-	region->limits_y[1] = floor((float) (id + 1) * nx[1] / n_regions);
-	region->nx[0] = nx[0];
-	region->nx[1] = region->limits_y[1] - region->limits_y[0];
+	const int pos[2] = {id % n_regions[0], id / n_regions[0]};
 
-	// Initialise the particles inside the region
-	t_part_vector *restrict particles;
+	for (int dir = 0; dir < 2; dir++)
+	{
+		region->limits[dir][0] = floor((float) pos[dir] * nx[dir] / n_regions[dir]);
+		region->limits[dir][1] = floor((float) (pos[dir] + 1) * nx[dir] / n_regions[dir]);
+		region->nx[dir] = region->limits[dir][1] - region->limits[dir][0];
+	}
 
+	// Initialise the species and inject the particles inside the region (in parallel, the caller
+	// must wait for the tasks to finish)
 	region->n_species = n_spec;
 	region->species = (t_species*) malloc(n_spec * sizeof(t_species));
 	assert(region->species);
 
-	int start, end;
 	for (int n = 0; n < n_spec; ++n)
 	{
 		spec_new(&region->species[n], spec[n].name, spec[n].m_q, spec[n].ppc, spec[n].ufl,
 				spec[n].uth, spec[n].nx, spec[n].box, spec[n].dt, &spec[n].density);
+		region->species[n].id = n;
 
-		particles = &region->species[n].main_vector;
+		spec_init_queues(&region->species[n], region->limits);
+		spec_init_particles(&region->species[n], region->limits);
+	}
 
-		const int ppc = region->species[n].ppc[1] * region->species[n].ppc[0];
+	// Initialise the local current and emf (in parallel, see above)
+	region_init_fields(region, box[0] / nx[0] * region->nx[0], box[1] / nx[1] * region->nx[1], dt);
+}
 
-		switch (spec[n].density.type)
-		{
-			case STEP:
-				start = spec->density.start / spec->dx[0];
-				particles->size = (region->nx[0] - start) * region->nx[1] * ppc;
-				break;
-
-			case SLAB:
-				start = spec->density.start / spec->dx[0] - spec->n_move;
-				end = spec->density.end / spec->dx[0] - spec->n_move;
-				particles->size = (end - start) * region->nx[1] * ppc;
-				break;
-
-			default:
-				particles->size = region->nx[0] * region->nx[1] * ppc;
-				break;
-		}
+// Link the adjacent regions and calculate the overlap zone between them
+void region_link_adj_regions(t_region *region)
+{
+	current_overlap_zone(&region->local_current, &region->prev->local_current,
+			&region->left->local_current);
+	emf_overlap_zone(&region->local_emf, &region->prev->local_emf, &region->left->local_emf);
 
-		particles->size_max = particles->size;
-		particles->data = malloc(particles->size * sizeof(t_part));
-		memcpy(particles->data, spec[n].main_vector.data, particles->size * sizeof(t_part));
+	// Adjacent regions in each direction (see part_direction)
+	t_region *adj[NUM_ADJ_PART] = {region->prev->left, region->prev, region->prev->right,
+								   region->left, region->right, region->next->left, region->next,
+								   region->next->right};
 
-		spec[n].main_vector.size -= particles->size;
-		void *restrict ptr = malloc(spec[n].main_vector.size * sizeof(t_part));
+	// With a moving window, the particles leaving the box in x are removed, so the regions in the
+	// first and last columns do not exchange particles (and do not wait for each other)
+	for (int n = 0; n < region->n_species; n++)
+	{
+		t_species *spec = &region->species[n];
 
-		if(ptr)
+		for (int dir = 0; dir < NUM_ADJ_PART; dir++)
 		{
-			memcpy(ptr, spec[n].main_vector.data + particles->size, spec[n].main_vector.size * sizeof(t_part));
-			free(spec[n].main_vector.data);
-			spec[n].main_vector.data = ptr;
+			const bool box_edge = spec->moving_window
+					&& ((DIR_X(dir) == 0 && region->limits[0][0] == 0)
+							|| (DIR_X(dir) == 2 && region->limits[0][1] == spec->nx[0]));
+
+			spec->outgoing_part[dir] = box_edge ? NULL
+					: &adj[dir]->species[n].incoming_part[OPPOSITE_DIR(dir)];
+			spec->incoming_part[dir].has_producer = !box_edge;
 		}
 	}
+}
 
-	//Calculate the region box
-	float region_box[] = {box[0], box[1] / nx[1] * (region->limits_y[1] - region->limits_y[0])};
+// Move the fields of a region to rows with room for the moving window (in a task, so the new
+// buffers are first touched by a worker, see region_init_fields)
+#pragma oss task inout(region->local_emf) label("Region Set Moving Window")
+static void region_set_window_fields(t_region *region, const int slack)
+{
+	emf_set_moving_window(&region->local_emf, slack);
+}
 
-	// Initialise the local current
-	current_new(&region->local_current, region->nx, region_box, dt);
+// Set moving window. The window can move slack cells before the fields are moved back to the
+// start of the rows (see emf_move_window)
+void region_set_moving_window(t_region *region, const int slack)
+{
+	region->local_current.moving_window = true;
+	region_set_window_fields(region, slack);
 
-	// Initialise the local emf
-	emf_new(&region->local_emf, region->nx, region_box, dt);
+	for (int i = 0; i < region->n_species; i++)
+		region->species[i].moving_window = true;
 }
 
-// Link two adjacent regions and calculate the overlap zone between them
-void region_link_adj_regions(t_region *region)
+// Initialise the fields of region id for the new limits in y. E and B are copied from the
+// regions of the same column that contained each row. The buffers are allocated and copied inside
+// a task, so the pages are first touched by a worker (see region_init_fields)
+#pragma oss task out(*emf) out(*current) label("Region Rebalance Fields")
+static void region_rebalance_fields(t_emf *emf, t_current *current, const t_region *regions,
+		const int n_regions[2], const int id, const int limits_y[2], const int nx[2],
+		const float box[2], const float dt)
 {
-	current_overlap_zone(&region->local_current, &region->prev->local_current);
-	emf_overlap_zone(&region->local_emf, &region->prev->local_emf);
+	const int total = n_regions[0] * n_regions[1];
+	int region_nx[2] = {regions[id].nx[0], limits_y[1] - limits_y[0]};
+	float region_box[] = {box[0] / nx[0] * region_nx[0], box[1] / nx[1] * region_nx[1]};
 
-	for (int n = 0; n < region->n_species; n++)
+	emf_new(emf, region_nx, region_box, dt, regions[id].numa_node);
+	emf->iter = regions[id].local_emf.iter;
+	emf->n_move = regions[id].local_emf.n_move;
+	if (regions[id].local_emf.moving_window)
+		emf_set_moving_window(emf, regions[id].local_emf.window_slack);
+
+	for (int r = id % n_regions[0]; r < total; r += n_regions[0])
 	{
-		region->species[n].outgoing_part[0] = &region->prev->species[n].incoming_part[1];
-		region->species[n].outgoing_part[1] = &region->next->species[n].incoming_part[0];
+		const int begin = (limits_y[0] > regions[r].limits[1][0]) ? limits_y[0]
+				: regions[r].limits[1][0];
+		const int end = (limits_y[1] < regions[r].limits[1][1]) ? limits_y[1]
+				: regions[r].limits[1][1];
+
+		if (begin < end)
+			emf_copy_rows(emf, begin - limits_y[0], &regions[r].local_emf,
+					begin - regions[r].limits[1][0], end - begin);
 	}
+
+	// The current is reset at the beginning of each iteration
+	current_new(current, region_nx, region_box, dt, regions[id].numa_node);
+	current_set_smooth(current, &regions[id].local_current.smooth);
+	current->smooth_time = regions[id].local_current.smooth_time;
+	current->iter = regions[id].local_current.iter;
+	current->moving_window = regions[id].local_current.moving_window;
 }
 
-// Set moving window
-void region_set_moving_window(t_region *region)
+// Move the boundaries between the rows of regions. The regions of row i take the rows
+// [limits[i], limits[i + 1]) of the simulation box (the limits in x are not changed). The particles
+// are moved to the region that contains them and the fields of each row are copied to its new
+// region. Must be called outside of any task (all the regions are modified)
+void region_rebalance(t_region *regions, const int n_regions[2], const int *limits, const int nx[2],
+		const float box[2], const float dt)
 {
-	region->local_current.moving_window = true;
-	region->local_emf.moving_window = true;
+	const int total = n_regions[0] * n_regions[1];
 
-	for (int i = 0; i < region->n_species; i++)
-		region->species[i].moving_window = true;
+	// New limits of each region
+	int (*new_limits)[2][2] = malloc(total * sizeof(*new_limits));
+	assert(new_limits);
+
+	for (int i = 0; i < total; i++)
+	{
+		const int row = i / n_regions[0];
+
+		new_limits[i][0][0] = regions[i].limits[0][0];
+		new_limits[i][0][1] = regions[i].limits[0][1];
+		new_limits[i][1][0] = limits[row];
+		new_limits[i][1][1] = limits[row + 1];
+	}
+
+	// Move the particles outside of the new limits to a temporary buffer and then to their region
+	for (int k = 0; k < regions[0].n_species; k++)
+	{
+		t_part_vector migrants;
+		part_vector_alloc(&migrants, 1024);
+
+		// The cell index of the particles is absolute (see n_move)
+		const int n_move = regions[0].species[k].n_move;
+
+		for (int i = 0; i < total; i++)
+		{
+			const int part_limits[2][2] = {{new_limits[i][0][0] + n_move, new_limits[i][0][1] + n_move},
+										   {new_limits[i][1][0], new_limits[i][1][1]}};
+			part_vector_move_cells(&regions[i].species[k].main_vector, part_limits, false,
+					&migrants);
+		}
+
+		for (int i = 0; i < total; i++)
+		{
+			const int part_limits[2][2] = {{new_limits[i][0][0] + n_move, new_limits[i][0][1] + n_move},
+										   {new_limits[i][1][0], new_limits[i][1][1]}};
+			part_vector_move_cells(&migrants, part_limits, true, &regions[i].species[k].main_vector);
+
+			// The private current buffers have the size of the old region
+			spec_free_chunk_buffers(&regions[i].species[k]);
+		}
+
+		part_vector_free(&migrants);
+	}
+
+	// New fields (E and B are copied from the regions of the same column that contained each row),
+	// initialised in parallel (see region_rebalance_fields)
+	t_emf *emf = malloc(total * sizeof(t_emf));
+	t_current *current = malloc(total * sizeof(t_current));
+	assert(emf && current);
+
+	for (int i = 0; i < total; i++)
+		region_rebalance_fields(&emf[i], &current[i], regions, n_regions, i, new_limits[i][1], nx,
+				box, dt);
+
+	#pragma oss taskwait
+
+	for (int i = 0; i < total; i++)
+	{
+		emf_delete(&regions[i].local_emf);
+		current_delete(&regions[i].local_current);
+
+		regions[i].local_emf = emf[i];
+		regions[i].local_current = current[i];
+		regions[i].limits[1][0] = new_limits[i][1][0];
+		regions[i].limits[1][1] = new_limits[i][1][1];
+		regions[i].nx[1] = new_limits[i][1][1] - new_limits[i][1][0];
+	}
+
+	free(emf);
+	free(current);
+	free(new_limits);
+
+	// Update the overlap zones and the ghost cells in y
+	for (int i = 0; i < total; i++)
+		region_link_adj_regions(&regions[i]);
+
+	for (int i = 0; i < total; i++)
+		emf_update_gc_y_serial(&regions[i].local_emf);
 }
 
 void region_delete(t_region *region)
@@ -19,12 +19,15 @@
 typedef struct Region
 {
 	int id;
+	int numa_node; // NUMA node of the region buffers (fields and current)
 
 	int nx[2]; // Region size
-	int limits_y[2]; // Limits of the region in y
+	int limits[2][2]; // Limits of the region in x and y ([direction][min / max])
 
 	struct Region *next; // Pointer to the region above (j => j_max)
 	struct Region *prev; // Pointer to the region below (j < j_min)
+	struct Region *right; // Pointer to the region on the right (i => i_max)
+	struct Region *left; // Pointer to the region on the left (i < i_min)
 
 	// Local species
 	int n_species;
@@ -34,12 +37,18 @@ typedef struct Region
 	t_current local_current;
 	t_emf local_emf;
 
+	// Push time of all the species at the last rebalance
+	double push_time;
+
 } t_region;
 
-void region_new(t_region *region, int n_regions, int nx[2], int id, int n_spec, t_species *spec,
-		float box[], float dt, t_region *prev_region, t_region *next_region);
+void region_new(t_region *region, const int n_regions[2], int nx[2], int id, int n_spec,
+		t_species *spec, float box[], float dt, t_region *prev_region, t_region *next_region,
+		t_region *left_region, t_region *right_region);
 void region_link_adj_regions(t_region *region);
-void region_set_moving_window(t_region *region);
+void region_set_moving_window(t_region *region, const int slack);
+void region_rebalance(t_region *regions, const int n_regions[2], const int *limits, const int nx[2],
+		const float box[2], const float dt);
 void region_delete(t_region *region);
 
 #endif
@@ -0,0 +1,27 @@
+/*
+ *  simd.c
+ *  zpic
+ *
+ *  Instruction set of the SIMD kernels (particle push, field solver and current filter)
+ *
+ */
+
+#include "simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum simd_isa simd_select_isa(void)
+{
+#ifdef SIMD_X86
+	const char *isa = getenv("ZPIC_SIMD");
+	__builtin_cpu_init();
+
+	if (isa && !strcmp(isa, "scalar")) return SIMD_SCALAR;
+
+	if ((!isa || !strcmp(isa, "avx512")) && __builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+#endif
+
+	return SIMD_SCALAR;
+}
@@ -0,0 +1,25 @@
+/*
+ *  simd.h
+ *  zpic
+ *
+ *  Instruction set of the SIMD kernels (particle push, field solver and current filter)
+ *
+ */
+
+#ifndef __SIMD__
+#define __SIMD__
+
+#if defined(ENABLE_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+enum simd_isa {
+	SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512
+};
+
+// Widest instruction set supported by the CPU (can be overridden with ZPIC_SIMD=scalar|avx2|avx512).
+// Always SIMD_SCALAR without ENABLE_SIMD
+enum simd_isa simd_select_isa(void);
+
+#endif
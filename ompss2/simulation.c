@@ -17,12 +17,35 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <assert.h>
 #include <nanos6.h>
 
 #include "simulation.h"
 #include "timer.h"
 #include "zdf.h"
+#include "memory.h"
+
+// Region rebalancing: cost of a cell (relative to a particle), minimum number of rows of a
+// region and minimum load imbalance (maximum / average cost) to move the region limits
+#define REBALANCE_CELL_COST 0.25
+#define REBALANCE_MIN_ROWS 4
+#define REBALANCE_THRESHOLD 1.05
+
+// Number of iterations between the resizes of the particle exchange queues (when the tasks are
+// created in every iteration, see sim_iter)
+#define EXCHANGE_RESIZE_ITER 50
+
+// Minimum number of cells of a region in each direction
+#define REGION_MIN_CELLS 2
+
+// Auto-tuning: cache file, number of iterations discarded and measured for each configuration,
+// maximum number of regions per CPU and minimum number of particles per chunk
+#define AUTOTUNE_CACHE "output/autotune.cache"
+#define AUTOTUNE_WARMUP 2
+#define AUTOTUNE_ITER 5
+#define AUTOTUNE_MAX_REGIONS_PER_CPU 8
+#define AUTOTUNE_MIN_CHUNK 1024
 
 
 /*********************************************************************************************
@@ -52,12 +75,73 @@ void sim_create_dir(t_simulation *sim)
 	}
 }
 
+// Find the grid of n_regions regions. The number of regions along x is the divisor of n_regions
+// that minimizes the number of cells in the region boundaries (it can be overridden with
+// ZPIC_REGIONS_X=<number of regions in x>). Returns false if there is no valid grid
+static bool sim_region_grid_find(const int n_regions, const int nx[2], int grid[2])
+{
+	int best_cost = -1;
+	grid[0] = 1;
+	grid[1] = n_regions;
+
+	const char *env = getenv("ZPIC_REGIONS_X");
+	if (env)
+	{
+		const int n = atoi(env);
+		if (n <= 0 || n_regions % n != 0) return false;
+
+		grid[0] = n;
+		grid[1] = n_regions / n;
+	} else
+	{
+		for (int px = 1; px <= n_regions; px++)
+		{
+			const int py = n_regions / px;
+			if (px * py != n_regions) continue;
+			if (nx[0] / px < REGION_MIN_CELLS || nx[1] / py < REGION_MIN_CELLS) continue;
+
+			const int cost = (px - 1) * nx[1] + (py - 1) * nx[0];
+			if (best_cost < 0 || cost < best_cost)
+			{
+				best_cost = cost;
+				grid[0] = px;
+				grid[1] = py;
+			}
+		}
+	}
+
+	return nx[0] / grid[0] >= REGION_MIN_CELLS && nx[1] / grid[1] >= REGION_MIN_CELLS;
+}
+
+// Split the simulation box in a grid of n_regions regions
+static void sim_region_grid(const int n_regions, const int nx[2], int grid[2])
+{
+	if (!sim_region_grid_find(n_regions, nx, grid))
+	{
+		const char *env = getenv("ZPIC_REGIONS_X");
+		if (env && (atoi(env) <= 0 || n_regions % atoi(env) != 0))
+			fprintf(stderr, "Invalid number of regions in x (ZPIC_REGIONS_X = %s)\n", env);
+		else fprintf(stderr, "Invalid number of regions, each region must have at least %d x %d "
+				"cells\n", REGION_MIN_CELLS, REGION_MIN_CELLS);
+		exit(-1);
+	}
+}
+
 // Constructor
 void sim_new(t_simulation *sim, int nx[2], float box[2], float dt, float tmax, int ndump,
 		t_species *species, int n_species, char name[64], int n_regions)
 {
 	// Simulation parameters
 	sim->iter = 0;
+	sim->n_sort = 0;
+	sim->n_rebalance = 0;
+	sim->task_time = 0.0;
+	sim->task_iter = 0;
+	sim->graph_time = 0.0;
+	sim->graph_iter = 0;
+	sim->rebalance_count = 0;
+	sim->chunk_size = 0;
+	sim->deposit = ZAMB;
 	sim->moving_window = false;
 	sim->dt = dt;
 	sim->tmax = tmax;
@@ -77,25 +161,32 @@ void sim_new(t_simulation *sim, int nx[2], float box[2], float dt, float tmax, i
 		exit(-1);
 	}
 
-	// Inject particles in the simulation that will be distributed to all the regions
-	const int range[][2] = {{0, nx[0]}, {0, nx[1]}};
-	for (int n = 0; n < n_species; ++n)
-		spec_inject_particles(&species[n].main_vector, range, species[n].ppc, &species[n].density,
-				species[n].dx, species[n].n_move, species[n].ufl, species[n].uth);
-
-	// Initialise the regions
+	// Initialise the regions (grid with periodic neighbours, ordered by rows)
 	sim->n_regions = n_regions;
+	sim_region_grid(n_regions, nx, sim->region_grid);
 	sim->regions = malloc(n_regions * sizeof(t_region));
 	assert(sim->regions);
 
-	t_region *prev = &sim->regions[n_regions - 1];
+	const int px = sim->region_grid[0];
+	const int py = sim->region_grid[1];
+
 	for(int i = 0; i < n_regions; i++)
 	{
-		t_region *next = i == n_regions - 1 ? &sim->regions[0] : &sim->regions[i + 1];
-		region_new(&sim->regions[i], n_regions, nx, i, n_species, species, box, dt, prev, next);
-		prev = &sim->regions[i];
+		const int col = i % px;
+		const int row = i / px;
+
+		t_region *prev = &sim->regions[col + ((row + py - 1) % py) * px];
+		t_region *next = &sim->regions[col + ((row + 1) % py) * px];
+		t_region *left = &sim->regions[(col + px - 1) % px + row * px];
+		t_region *right = &sim->regions[(col + 1) % px + row * px];
+
+		region_new(&sim->regions[i], sim->region_grid, nx, i, n_species, species, box, dt, prev,
+				next, left, right);
 	}
 
+	// Wait for the particle injection of all regions
+	#pragma oss taskwait
+
 	// Cleaning
 	for (int n = 0; n < n_species; ++n)
 		spec_delete(&species[n]);
@@ -127,25 +218,39 @@ void sim_delete(t_simulation *sim)
 	free(sim->regions);
 }
 
+// Check if the ghost cells in the left edge of the region are updated (the left edge of the
+// simulation box is not periodic with a moving window)
+static bool sim_update_left_edge(const t_simulation *sim, const t_region *region)
+{
+	return !sim->moving_window || region->limits[0][0] > 0;
+}
+
 void sim_add_laser(t_simulation *sim, t_emf_laser *laser)
 {
-	for(int i = 0; i < sim->n_regions; i++)
-		emf_add_laser(&sim->regions[i].local_emf, laser, sim->regions[i].limits_y[0]);
+	t_region *regions = sim->regions;
 
-	for(int i = 1; i < sim->n_regions; i++)
-		emf_update_gc_y_serial(&sim->regions[i].local_emf);
+	for(int i = 0; i < sim->n_regions; i++)
+		emf_add_laser(&regions[i].local_emf, laser, regions[i].limits[0][0], regions[i].limits[1][0]);
 
 	for(int i = 0; i < sim->n_regions; i++)
-		emf_update_gc_x(&sim->regions[i].local_emf);
+		if (regions[i].limits[1][0] > 0)
+			emf_update_gc_y_serial(&regions[i].local_emf);
 
 	for(int i = 0; i < sim->n_regions; i++)
-		div_corr_x(&sim->regions[i].local_emf);
+		if (sim_update_left_edge(sim, &regions[i]))
+			emf_update_gc_x_serial(&regions[i].local_emf);
+
+	// The divergence correction is integrated from the right edge of the simulation box
+	for(int i = sim->n_regions - 1; i >= 0; i--)
+		div_corr_x(&regions[i].local_emf, regions[i].limits[0][1] < sim->nx[0] ?
+				&regions[i].right->local_emf : NULL);
 
 	for(int i = 0; i < sim->n_regions; i++)
-		emf_update_gc_y_serial(&sim->regions[i].local_emf);
+		emf_update_gc_y_serial(&regions[i].local_emf);
 
 	for(int i = 0; i < sim->n_regions; i++)
-		emf_update_gc_x(&sim->regions[i].local_emf);
+		if (sim_update_left_edge(sim, &regions[i]))
+			emf_update_gc_x_serial(&regions[i].local_emf);
 }
 
 void sim_set_smooth(t_simulation *sim, t_smooth *smooth)
@@ -162,21 +267,383 @@ void sim_set_smooth(t_simulation *sim, t_smooth *smooth)
 		exit(-1);
 	}
 
+	// The current buffers are allocated again with the guard cells needed by the filter
+	for(int i = 0; i < sim->n_regions; i++)
+	{
+		t_current *current = &sim->regions[i].local_current;
+		current_set_smooth(current, smooth);
+
+		if (current->nx[0] < current->gc[0][0] + current->gc[0][1]
+				|| current->nx[1] < current->gc[1][0] + current->gc[1][1])
+		{
+			fprintf(stderr, "Invalid number of regions, each region must have at least %d x %d "
+					"cells with this smoothing\n", current->gc[0][0] + current->gc[0][1],
+					current->gc[1][0] + current->gc[1][1]);
+			exit(-1);
+		}
+
+		for (int k = 0; k < sim->regions[i].n_species; k++)
+			spec_free_chunk_buffers(&sim->regions[i].species[k]);
+	}
+
 	for(int i = 0; i < sim->n_regions; i++)
-		sim->regions[i].local_current.smooth = *smooth;
+		region_link_adj_regions(&sim->regions[i]);
 }
 
+// Set the moving window. The fields of each region are moved to longer rows, so the window can
+// move a quarter of the region width before the fields are moved back to the start of the rows
 void sim_set_moving_window(t_simulation *sim)
 {
+	int slack = sim->nx[0] / sim->region_grid[0] / 4;
+	if (slack < 16) slack = 16;
+
+	#pragma oss taskwait
+
 	sim->moving_window = true;
 	for(int i = 0; i < sim->n_regions; i++)
-		region_set_moving_window(&sim->regions[i]);
+		region_set_moving_window(&sim->regions[i], slack);
+
+	// The overlap zones point to the new buffers
+	#pragma oss taskwait
+
+	for(int i = 0; i < sim->n_regions; i++)
+		region_link_adj_regions(&sim->regions[i]);
+}
+
+// Set the particle sorting frequency (in iterations)
+void sim_set_sort(t_simulation *sim, const int n_sort)
+{
+	sim->n_sort = n_sort;
+
+	for(int i = 0; i < sim->n_regions; i++)
+		for (int k = 0; k < sim->regions[i].n_species; k++)
+			sim->regions[i].species[k].n_sort = n_sort;
+}
+
+// Set the region rebalancing frequency (in iterations)
+void sim_set_rebalance(t_simulation *sim, const int n_rebalance)
+{
+	sim->n_rebalance = n_rebalance;
+}
+
+// Set the number of particles pushed by each task (0 - one task per species and region)
+void sim_set_chunk_size(t_simulation *sim, const int chunk_size)
+{
+	sim->chunk_size = chunk_size;
+
+	for(int i = 0; i < sim->n_regions; i++)
+		for (int k = 0; k < sim->regions[i].n_species; k++)
+			sim->regions[i].species[k].chunk_size = chunk_size;
+}
+
+// Set the particle pusher of a species (Boris, Vay or Higuera-Cary)
+void sim_set_pusher(t_simulation *sim, const int species, const enum pusher_type pusher)
+{
+	for(int i = 0; i < sim->n_regions; i++)
+		spec_set_pusher(&sim->regions[i].species[species], pusher);
+}
+
+// Set the current deposition scheme of all the species (Zamb or Esirkepov)
+void sim_set_current_deposit(t_simulation *sim, const enum deposit_type deposit)
+{
+	sim->deposit = deposit;
+
+	for(int i = 0; i < sim->n_regions; i++)
+		for (int k = 0; k < sim->regions[i].n_species; k++)
+			sim->regions[i].species[k].deposit = deposit;
+}
+
+/*********************************************************************************************
+ Auto-tuning
+ *********************************************************************************************/
+// Key of the configurations saved in the cache: input deck, machine and number of CPUs
+static void sim_autotune_key(const t_simulation *sim, char key[256])
+{
+	struct utsname host;
+	if (uname(&host) != 0) strcpy(host.nodename, "unknown");
+
+	snprintf(key, 256, "%s %s %d", sim->name, host.nodename, nanos6_get_num_cpus());
+}
+
+// Read the configuration saved for the key (the last entry is used)
+static bool sim_autotune_load(const char *key, int *n_regions, int *chunk_size)
+{
+	FILE *file = fopen(AUTOTUNE_CACHE, "r");
+	if (!file) return false;
+
+	char line[512];
+	bool found = false;
+	const size_t len = strlen(key);
+
+	while (fgets(line, sizeof(line), file))
+		if (strncmp(line, key, len) == 0 && line[len] == ' ')
+			if (sscanf(line + len, "%d %d", n_regions, chunk_size) == 2) found = true;
+
+	fclose(file);
+	return found;
+}
+
+static void sim_autotune_save(const char *key, const int n_regions, const int chunk_size)
+{
+	FILE *file = fopen(AUTOTUNE_CACHE, "a");
+	if (!file)
+	{
+		fprintf(stderr, "Could not write the autotuning cache (%s)\n", AUTOTUNE_CACHE);
+		return;
+	}
+
+	fprintf(file, "%s %d %d\n", key, n_regions, chunk_size);
+	fclose(file);
+}
+
+// Average time per iteration of the current configuration
+static double sim_autotune_measure(t_simulation *sim)
+{
+	for (int k = 0; k < AUTOTUNE_WARMUP; k++)
+		sim_iter(sim);
+
+	#pragma oss taskwait
+	uint64_t t0 = timer_ticks();
+
+	for (int k = 0; k < AUTOTUNE_ITER; k++)
+		sim_iter(sim);
+
+	#pragma oss taskwait
+	return timer_interval_seconds(t0, timer_ticks()) / AUTOTUNE_ITER;
+}
+
+// Initialise the simulation with the number of regions and the chunk size with the lowest time
+// per iteration. The candidates are 1, n_cpus, 2 * n_cpus, ... regions with the chunk size of the
+// input deck, followed by 2, 4 and 8 chunks per species and region for the fastest number of
+// regions. The choice is saved in AUTOTUNE_CACHE, so the next runs skip the calibration
+void sim_autotune(t_simulation *sim)
+{
+	const int n_cpus = nanos6_get_num_cpus();
+	char key[256];
+	int best_regions = 1, best_chunk;
+	double best_time = -1;
+
+	// A single region is always valid (the simulation name and size are only known afterwards)
+	sim_init(sim, 1);
+	sim_autotune_key(sim, key);
+	best_chunk = sim->chunk_size;
+
+	if (sim_autotune_load(key, &best_regions, &best_chunk))
+	{
+#ifndef TEST
+		fprintf(stderr, "Autotune: %d regions, chunk size %d (from %s)\n", best_regions, best_chunk,
+				AUTOTUNE_CACHE);
+#endif
+	} else
+	{
+		const int nx[] = {sim->nx[0], sim->nx[1]};
+		const int deck_chunk = sim->chunk_size;
+
+		// Minimum size of the regions (guard cells of the current filter)
+		const t_current *current = &sim->regions[0].local_current;
+		const int min_cells[] = {current->gc[0][0] + current->gc[0][1],
+								 current->gc[1][0] + current->gc[1][1]};
+
+		for (int n = 1; n <= AUTOTUNE_MAX_REGIONS_PER_CPU * n_cpus; n = (n < n_cpus) ? n_cpus : 2 * n)
+		{
+			int grid[2];
+			if (n > 1)
+			{
+				if (!sim_region_grid_find(n, nx, grid) || nx[0] / grid[0] < min_cells[0]
+						|| nx[1] / grid[1] < min_cells[1]) continue;
+				sim_delete(sim);
+				sim_init(sim, n);
+			}
+
+			const double time = sim_autotune_measure(sim);
+#ifndef TEST
+			fprintf(stderr, "Autotune: %d regions, chunk size %d: %f s/iteration\n", n, deck_chunk,
+					time);
+#endif
+			if (best_time < 0 || time < best_time)
+			{
+				best_time = time;
+				best_regions = n;
+			}
+		}
+
+		sim_delete(sim);
+		sim_init(sim, best_regions);
+
+		double npart = 0;
+		for (int i = 0; i < sim->n_regions; i++)
+			for (int k = 0; k < sim->regions[i].n_species; k++)
+				npart += sim->regions[i].species[k].main_vector.size;
+		npart /= sim->n_regions * sim->regions[0].n_species;
+
+		for (int n_chunks = 2; n_chunks <= 8; n_chunks *= 2)
+		{
+			const int chunk_size = ceil(npart / n_chunks);
+			if (chunk_size < AUTOTUNE_MIN_CHUNK || chunk_size == deck_chunk) continue;
+
+			sim_set_chunk_size(sim, chunk_size);
+			const double time = sim_autotune_measure(sim);
+#ifndef TEST
+			fprintf(stderr, "Autotune: %d regions, chunk size %d: %f s/iteration\n", best_regions,
+					chunk_size, time);
+#endif
+			if (time < best_time)
+			{
+				best_time = time;
+				best_chunk = chunk_size;
+			}
+		}
+
+		sim_autotune_save(key, best_regions, best_chunk);
+	}
+
+	// Rebuild the simulation with the chosen configuration
+	if (sim->iter > 0 || sim->n_regions != best_regions)
+	{
+		sim_delete(sim);
+		sim_init(sim, best_regions);
+	}
+
+	sim_set_chunk_size(sim, best_chunk);
 }
 
 /*********************************************************************************************
  Iteration
  *********************************************************************************************/
-void sim_iter(t_simulation *sim)
+// Move the boundaries between the rows of regions so that all rows have the same estimated cost.
+// The cost of each row of cells is the number of particles plus REBALANCE_CELL_COST for each cell
+static void sim_rebalance(t_simulation *sim)
+{
+	t_region *regions = sim->regions;
+	const int n_regions = sim->region_grid[1];	// Rows of regions
+	const int px = sim->region_grid[0];
+	const int ny = sim->nx[1];
+
+	// Each region must have at least REBALANCE_MIN_ROWS rows and the guard cells of the current
+	const t_current *current = &regions[0].local_current;
+	int min_rows = current->gc[1][0] + current->gc[1][1];
+	if (min_rows < REBALANCE_MIN_ROWS) min_rows = REBALANCE_MIN_ROWS;
+
+	if (n_regions < 2 || ny < n_regions * min_rows) return;
+
+	// Cost of the rows [0, j) of the simulation box
+	double *restrict cost = calloc(ny + 1, sizeof(double));
+	assert(cost);
+
+	for (int i = 0; i < sim->n_regions; i++)
+		for (int k = 0; k < regions[i].n_species; k++)
+			for (int p = 0; p < regions[i].species[k].main_vector.size; p++)
+				cost[regions[i].species[k].main_vector.iy[p] + 1] += 1.0;
+
+	for (int j = 1; j <= ny; j++)
+		cost[j] += cost[j - 1] + REBALANCE_CELL_COST * sim->nx[0];
+
+	// New limits (each region has at least min_rows rows)
+	int *restrict limits = malloc((n_regions + 1) * sizeof(int));
+	assert(limits);
+
+	limits[0] = 0;
+	limits[n_regions] = ny;
+
+	for (int i = 1; i < n_regions; i++)
+	{
+		const double target = cost[ny] * i / n_regions;
+
+		int j = limits[i - 1] + min_rows;
+		while (j < ny && cost[j] < target) j++;
+
+		if (j > ny - (n_regions - i) * min_rows)
+			j = ny - (n_regions - i) * min_rows;
+
+		limits[i] = j;
+	}
+
+	// Load imbalance (maximum / average cost) before and after moving the limits
+	double max_before = 0, max_after = 0, max_time = 0, total_time = 0;
+
+	for (int i = 0; i < n_regions; i++)
+	{
+		const t_region *first = &regions[i * px];
+		const double before = cost[first->limits[1][1]] - cost[first->limits[1][0]];
+		const double after = cost[limits[i + 1]] - cost[limits[i]];
+		if (before > max_before) max_before = before;
+		if (after > max_after) max_after = after;
+
+		// Measured push time since the last rebalance (all the regions of the row)
+		double time = 0;
+		for (int r = i * px; r < (i + 1) * px; r++)
+		{
+			double push_time = 0;
+			for (int k = 0; k < regions[r].n_species; k++)
+				push_time += regions[r].species[k].push_time;
+
+			time += push_time - regions[r].push_time;
+			regions[r].push_time = push_time;
+		}
+
+		total_time += time;
+		if (time > max_time) max_time = time;
+	}
+
+	const double imb_before = max_before * n_regions / cost[ny];
+	const double imb_after = max_after * n_regions / cost[ny];
+
+	if (imb_before > REBALANCE_THRESHOLD && imb_after < imb_before)
+	{
+		region_rebalance(regions, sim->region_grid, limits, sim->nx, sim->box, sim->dt);
+		sim->rebalance_count++;
+
+#ifndef TEST
+		const double imb_time = total_time > 0 ? max_time * n_regions / total_time : 1.0;
+		fprintf(stdout, "Iteration %d: region rebalance, load imbalance %.3f -> %.3f "
+				"(measured push time imbalance %.3f)\n", sim->iter, imb_before, imb_after,
+				imb_time);
+#endif
+	}
+
+	free(limits);
+	free(cost);
+}
+
+// Add the particles still in the exchange queues to the main buffers (the push of the next
+// iteration does it otherwise) and grow the queues. The caller must wait for all the tasks
+static void sim_merge_particles(t_simulation *sim)
+{
+	for(int i = 0; i < sim->n_regions; i++)
+		for (int k = 0; k < sim->regions[i].n_species; k++)
+			spec_merge_vectors(&sim->regions[i].species[k]);
+
+	for(int i = 0; i < sim->n_regions; i++)
+		for (int k = 0; k < sim->regions[i].n_species; k++)
+			spec_resize_queues(&sim->regions[i].species[k]);
+}
+
+// Rebalance the regions every n_rebalance iterations (before creating the tasks of the iteration)
+static void sim_check_rebalance(t_simulation *sim)
+{
+	if (sim->n_rebalance > 0 && sim->iter > 0 && sim->iter % sim->n_rebalance == 0)
+	{
+		#pragma oss taskwait
+		sim_merge_particles(sim);
+		sim_rebalance(sim);
+	}
+}
+
+// Grow the exchange queues every EXCHANGE_RESIZE_ITER iterations (sim_iter_graph does it at
+// the start of each block), so the queues follow the high-water mark without waiting for a report
+static void sim_check_queues(t_simulation *sim)
+{
+	if (sim->iter > 0 && sim->iter % EXCHANGE_RESIZE_ITER == 0)
+	{
+		#pragma oss taskwait
+		sim_merge_particles(sim);
+	}
+}
+
+// Create the tasks of one iteration. The arguments of the tasks do not depend on the iteration
+// number, so the same task graph can be replayed in the following iterations (taskiter). The
+// particles are sorted by the spec_sort tasks only at the iterations given by n_sort
+static void sim_iter_tasks(t_simulation *sim, const bool sort)
 {
 	t_region *regions = sim->regions;
 	const int n_regions = sim->n_regions;
@@ -187,56 +654,105 @@ void sim_iter(t_simulation *sim)
 
 		for (int k = 0; k < regions[i].n_species; k++)
 			spec_advance(&regions[i].species[k], &regions[i].local_emf, &regions[i].local_current,
-							regions[i].limits_y);
+							regions[i].limits);
+	}
 
-		if(!regions[i].local_current.moving_window)
+	for(int i = 0; i < n_regions; i++)
+		if (sim_update_left_edge(sim, &regions[i]))
 			current_reduction_x(&regions[i].local_current);
-	}
 
+	// The particles sent to the adjacent regions are added by their next push (the sorting only
+	// reorders the particles that stayed in the region)
 	for(int i = 0; i < n_regions; i++)
 	{
-		for (int k = 0; k < regions[i].n_species; k++)
-			spec_merge_vectors(&regions[i].species[k]);
+		if (sort)
+			for (int k = 0; k < regions[i].n_species; k++)
+				spec_sort(&regions[i].species[k], regions[i].limits);
+
 		current_reduction_y(&regions[i].local_current);
 	}
 
-	if (regions->local_current.smooth.xtype != NONE)
+	// All the passes of the filter in a single task per region (the guard cells are up to date
+	// after the current reduction)
+	if (regions->local_current.smooth.xtype != NONE || regions->local_current.smooth.ytype != NONE)
+		for(int i = 0; i < n_regions; i++)
+			current_smooth(&regions[i].local_current, sim_update_left_edge(sim, &regions[i]),
+					sim_update_left_edge(sim, regions[i].right));
+
+	// If the box is not split along x, the ghost cells in x are updated by the field solver
+	const bool fused_gc_x = sim->region_grid[0] == 1 && !sim->moving_window;
+
+	for(int i = 0; i < n_regions; i++)
+		emf_advance(&regions[i].local_emf, &regions[i].local_current, fused_gc_x);
+
+	// Update the ghost cells in x and then in y (the corners are copied with the rows)
+	if (!fused_gc_x)
+		for(int i = 0; i < n_regions; i++)
+			if (sim_update_left_edge(sim, &regions[i]))
+				emf_update_gc_x(&regions[i].local_emf);
+
+	if (sim->moving_window)
 	{
 		for(int i = 0; i < n_regions; i++)
-			current_smooth_x(&regions[i].local_current);
+			emf_move_window(&regions[i].local_emf, regions[i].limits[0][1] == sim->nx[0]);
 
 		for(int i = 0; i < n_regions; i++)
-			current_gc_update_y(&regions[i].local_current);
+			if (sim_update_left_edge(sim, &regions[i]))
+				emf_update_gc_x(&regions[i].local_emf);
 	}
 
-	if (regions->local_current.smooth.ytype != NONE)
-	{
-		for (int k = 0; k < regions[0].local_current.smooth.ylevel; k++)
-		{
-			for(int i = 0; i < n_regions; i++)
-				current_smooth_y(&regions[i].local_current, BINOMIAL);
+	for(int i = 0; i < n_regions; i++)
+		emf_update_gc_y(&regions[i].local_emf);
+}
 
-			for(int i = 0; i < n_regions; i++)
-				current_gc_update_y(&regions[i].local_current);
-		}
+void sim_iter(t_simulation *sim)
+{
+	sim_check_rebalance(sim);
+	sim_check_queues(sim);
 
-		if (regions[0].local_current.smooth.ytype == COMPENSATED)
-		{
-			for(int i = 0; i < n_regions; i++)
-				current_smooth_y(&regions[i].local_current, COMPENSATED);
+	// Sort the particles every n_sort iterations
+	const bool sort = sim->n_sort > 0 && (sim->iter + 1) % sim->n_sort == 0;
 
-			for(int i = 0; i < n_regions; i++)
-				current_gc_update_y(&regions[i].local_current);
-		}
+	uint64_t t0 = timer_ticks();
+	sim_iter_tasks(sim, sort);
+	sim->task_time += timer_interval_seconds(t0, timer_ticks());
+	sim->task_iter++;
+
+	sim->iter++;
+}
+
+// Advance the simulation up to n_iter iterations with the same task graph (the block ends before
+// the next region rebalance). With ENABLE_TASKITER, the graph is created once and replayed by the
+// runtime, otherwise the tasks are created in every iteration. Returns the number of iterations
+int sim_iter_graph(t_simulation *sim, int n_iter)
+{
+	sim_check_rebalance(sim);
+
+	if (sim->n_rebalance > 0)
+	{
+		const int next = (sim->iter / sim->n_rebalance + 1) * sim->n_rebalance;
+		if (sim->iter + n_iter > next) n_iter = next - sim->iter;
 	}
 
-	for(int i = 0; i < n_regions; i++)
-		emf_advance(&regions[i].local_emf, &regions[i].local_current);
+	// The tasks created inside the taskiter are not ordered with the previous ones
+	#pragma oss taskwait
+	sim_merge_particles(sim);
 
-	for(int i = 0; i < n_regions; i++)
-		emf_update_gc_y(&regions[i].local_emf);
+#ifdef ENABLE_TASKITER
+	// The code outside the tasks is only executed when the graph is created
+	#pragma oss taskiter
+#endif
+	for (int k = 0; k < n_iter; k++)
+	{
+		uint64_t t0 = timer_ticks();
+		sim_iter_tasks(sim, sim->n_sort > 0);
+		sim->graph_time += timer_interval_seconds(t0, timer_ticks());
+	}
 
-	sim->iter++;
+	sim->graph_iter += n_iter;
+	sim->iter += n_iter;
+
+	return n_iter;
 }
 
 /*********************************************************************************************
@@ -265,14 +781,217 @@ void sim_timings(t_simulation *sim, uint64_t t0, uint64_t t1)
 
 #ifndef TEST
 	fprintf(stdout, "Simulation: %s\n", sim->name);
-	fprintf(stdout, "Number of regions: %d\n", sim->n_regions);
+	fprintf(stdout, "Number of regions: %d (%d x %d)\n", sim->n_regions, sim->region_grid[0],
+			sim->region_grid[1]);
 	fprintf(stdout, "Number of threads: %d\n", n_threads);
+
+	// Share of the field and current pages (sampled) placed in the NUMA node of their region
+	long n_pages = 0, n_local = 0;
+	bool numa_info = true;
+
+	for(int j = 0; j < sim->n_regions && numa_info; j++)
+	{
+		const t_region *region = &sim->regions[j];
+		const size_t emf_size = region->local_emf.total_size * sizeof(t_vfld);
+		const size_t current_size = region->local_current.total_size * sizeof(t_vfld);
+
+		numa_info = numa_page_count(region->local_emf.E_buf, emf_size, region->numa_node,
+				&n_pages, &n_local)
+				&& numa_page_count(region->local_emf.B_buf, emf_size, region->numa_node,
+						&n_pages, &n_local)
+				&& numa_page_count(region->local_current.J_buf, current_size, region->numa_node,
+						&n_pages, &n_local);
+	}
+
+	if (numa_info && n_pages > 0)
+		fprintf(stdout, "NUMA nodes: %d, field pages in the region node: %.1f%% local, "
+				"%.1f%% remote\n", numa_num_nodes(), 100.0 * n_local / n_pages,
+				100.0 * (n_pages - n_local) / n_pages);
+	else fprintf(stdout, "NUMA nodes: %d (page location not available)\n", numa_num_nodes());
+
+	// Memory usage of each subsystem (buffers aligned to MEM_ALIGN bytes)
+	fprintf(stdout, "Memory (huge pages: %s):", mem_huge_pages_name());
+	for (int t = 0; t < MEM_NUM_TYPES; t++)
+		fprintf(stdout, " %s %.1f MB (peak %.1f MB)%s", mem_type_name(t), mem_usage(t) / 1E6,
+				mem_peak_usage(t) / 1E6, t < MEM_NUM_TYPES - 1 ? "," : "\n");
+
 	fprintf(stdout, "Total simulation time  = %f s\n", sim_time);
-	fprintf(stdout, "Performance: %f Mpart/s", npart / sim_time / 1E6);
-	fprintf(stdout, "\n");
+	fprintf(stdout, "Performance: %f Mpart/s\n", npart / sim_time / 1E6);
+	fprintf(stdout, "Particle push: %s\n", spec_push_kernel_name());
+	fprintf(stdout, "Field solver: %s, current smoothing: %s\n", emf_kernel_name(),
+			current_kernel_name());
+
+	if (sim->chunk_size > 0)
+		fprintf(stdout, "Particle push chunk size: %d particles\n", sim->chunk_size);
+	else fprintf(stdout, "Particle push chunk size: 1 chunk per region\n");
+
+	// Exchange buffers between regions (incoming queues and hole lists)
+	int exchange_hwm = 0, overflow = 0, push_grow = 0, merge_grow = 0;
+	double exchange_bytes = 0;
+
+	for(int j = 0; j < sim->n_regions; j++)
+	{
+		for (int i = 0; i < sim->regions[j].n_species; i++)
+		{
+			const t_species *spec = &sim->regions[j].species[i];
+
+			for (int k = 0; k < NUM_ADJ_PART; k++)
+			{
+				const t_part_queue *queue = &spec->incoming_part[k];
+
+				if (spec->exchange_hwm[k] > exchange_hwm) exchange_hwm = spec->exchange_hwm[k];
+				exchange_bytes += (queue->buf.size_max + queue->overflow[0].size_max
+						+ queue->overflow[1].size_max) * (2 * sizeof(int) + 5 * sizeof(t_part_data));
+			}
+
+			exchange_bytes += spec->holes_max * sizeof(int);
+			overflow += spec->exchange_overflow;
+			push_grow += spec->exchange_push_grow;
+			merge_grow += spec->exchange_merge_grow;
+		}
+	}
+
+	fprintf(stdout, "Particle exchange: up to %d particles/iteration per queue, %.2f MB reserved, "
+			"%d particles through the overflow buffers, %d buffer growths in the push "
+			"(%d outside the push)\n", exchange_hwm, exchange_bytes / 1E6, overflow, push_grow,
+			merge_grow);
+
+	// Push time per particle of each pusher (accumulated over all the push chunks)
+	double pusher_time[NUM_PUSHERS] = {0}, pusher_npush[NUM_PUSHERS] = {0};
+
+	for(int j = 0; j < sim->n_regions; j++)
+	{
+		for (int i = 0; i < sim->regions[j].n_species; i++)
+		{
+			pusher_time[sim->regions[j].species[i].pusher] += sim->regions[j].species[i].pusher_time;
+			pusher_npush[sim->regions[j].species[i].pusher] += sim->regions[j].species[i].npush;
+		}
+	}
+
+	for (int p = 0; p < NUM_PUSHERS; p++)
+		if (pusher_npush[p] > 0)
+			fprintf(stdout, "Push (%s pusher): %f ns/part\n", spec_pusher_name(p),
+					pusher_time[p] / pusher_npush[p] * 1E9);
+
+	// Fraction of the particles in each split case of the Zamb deposit (the time per particle of
+	// each case is measured by the kernel benchmark, see ENABLE_KERNEL_BENCH)
+	const char *case_name[NUM_SPLIT_CASES] = {"no split", "x split", "y split", "xy split"};
+
+	fprintf(stdout, "Current deposit: %s\n", sim->deposit == ESIRKEPOV ? "Esirkepov" : "Zamb");
+
+	if (sim->deposit == ZAMB && npart > 0)
+	{
+		double dep_case_count[NUM_SPLIT_CASES] = {0};
+
+		for(int j = 0; j < sim->n_regions; j++)
+			for (int i = 0; i < sim->regions[j].n_species; i++)
+				for (int c = 0; c < NUM_SPLIT_CASES; c++)
+					dep_case_count[c] += sim->regions[j].species[i].dep_case_count[c];
+
+		for (int c = 0; c < NUM_SPLIT_CASES; c++)
+			fprintf(stdout, "  %-8s: %5.1f%% of the particles\n", case_name[c],
+					100 * dep_case_count[c] / npart);
+	}
+
+	// Current filter: time accumulated over all the tasks and estimated memory traffic per
+	// iteration (each cell is read and written once), compared with one sweep per pass
+	const t_smooth *smooth = &sim->regions[0].local_current.smooth;
+	const int n_passes = current_smooth_passes(smooth->xtype, smooth->xlevel)
+			+ current_smooth_passes(smooth->ytype, smooth->ylevel);
+
+	if (n_passes > 0)
+	{
+		double smooth_time = 0, fused_bytes = 0, pass_bytes = 0;
+
+		for(int j = 0; j < sim->n_regions; j++)
+		{
+			const t_current *current = &sim->regions[j].local_current;
+			const int n_passes_y = current_smooth_passes(smooth->ytype, smooth->ylevel);
+
+			smooth_time += current->smooth_time;
+			fused_bytes += 2.0 * sizeof(t_vfld) * current->nrow * (current->nx[1] + 2 + 2 * n_passes_y);
+			pass_bytes += 2.0 * sizeof(t_vfld) * n_passes * current->nx[0] * current->nx[1];
+		}
+
+		fprintf(stdout, "Current smoothing: %d passes in one sweep, %f s (%f GB/s per task), "
+				"%.2f MB/iteration (%.2f MB/iteration with one sweep per pass)\n", n_passes,
+				smooth_time, fused_bytes * sim->iter / smooth_time / 1E9, fused_bytes / 1E6,
+				pass_bytes / 1E6);
+	}
+
+	// Time spent by the main thread creating the tasks (per iteration)
+	if (sim->task_iter > 0)
+		fprintf(stdout, "Task creation: %f us/iteration (%d iterations, graph created in every "
+				"iteration)\n", sim->task_time / sim->task_iter * 1E6, sim->task_iter);
+
+	if (sim->graph_iter > 0)
+#ifdef ENABLE_TASKITER
+		fprintf(stdout, "Task creation: %f us/iteration (%d iterations, graph replayed with "
+				"taskiter)\n", sim->graph_time / sim->graph_iter * 1E6, sim->graph_iter);
+#else
+		fprintf(stdout, "Task creation: %f us/iteration (%d iterations, graph created in every "
+				"iteration)\n", sim->graph_time / sim->graph_iter * 1E6, sim->graph_iter);
+#endif
+
+	if (sim->n_rebalance > 0)
+		fprintf(stdout, "Region rebalance: every %d iterations (%d rebalances)\n",
+				sim->n_rebalance, sim->rebalance_count);
+
+	if (sim->n_sort > 0)
+	{
+		int n_sorts = 0;
+		double push_time = 0, sort_time = 0, push_time_saved = 0;
+
+		for(int j = 0; j < sim->n_regions; j++)
+		{
+			for (int i = 0; i < sim->regions[j].n_species; i++)
+			{
+				n_sorts += sim->regions[j].species[i].n_sorts;
+				push_time += sim->regions[j].species[i].push_time;
+				sort_time += sim->regions[j].species[i].sort_time;
+				push_time_saved += sim->regions[j].species[i].push_time_saved;
+			}
+		}
+
+		// Time accumulated over all the tasks
+		fprintf(stdout, "Particle sort: every %d iterations (%d sorts)\n", sim->n_sort, n_sorts);
+		fprintf(stdout, "Time for spec. push = %f s\n", push_time);
+		fprintf(stdout, "Time for spec. sort = %f s\n", sort_time);
+		fprintf(stdout, "Estimated push time saved by sorting = %f s\n", push_time_saved);
+	}
+
+#ifdef ENABLE_KERNEL_BENCH
+	// Bandwidth of the field solver and filter kernels in one thread (grids of the first region),
+	// compared with the STREAM triad using arrays of the same size as the fields
+	const t_region *region = &sim->regions[0];
+	const size_t fld_size = region->local_emf.total_size * sizeof(t_vfld);
+	double yee_bw[2], smooth_bw[2];
+
+	emf_bench_kernels(&region->local_emf, &region->local_current, yee_bw);
+	current_bench_kernels(&region->local_current, smooth_bw);
+	const double stream_bw = mem_stream_bandwidth(fld_size);
+
+	const char *bench_name[4] = {"Yee B", "Yee E", "Smooth x", "Smooth y"};
+	const double bench_bw[4] = {yee_bw[0], yee_bw[1], smooth_bw[0], smooth_bw[1]};
+
+	fprintf(stdout, "Kernel bandwidth (1 thread, %.1f MB per grid): STREAM triad %.2f GB/s\n",
+			fld_size / 1E6, stream_bw);
+	for (int k = 0; k < 4; k++)
+		fprintf(stdout, "  %-8s: %7.2f GB/s (%5.1f%% of STREAM)\n", bench_name[k], bench_bw[k],
+				100 * bench_bw[k] / stream_bw);
+
+	// Deposit time per particle of each split case (synthetic batch, one thread)
+	double zamb_ns[NUM_SPLIT_CASES], esk_ns[NUM_SPLIT_CASES];
+	spec_bench_deposit(&region->local_current, zamb_ns, esk_ns);
+
+	fprintf(stdout, "Current deposit (1 thread, %d particles per case):\n", DEP_BENCH_NPART);
+	for (int c = 0; c < NUM_SPLIT_CASES; c++)
+		fprintf(stdout, "  %-8s: Zamb %7.2f ns/part, Esirkepov %7.2f ns/part\n", case_name[c],
+				zamb_ns[c], esk_ns[c]);
+#endif
 
 #else
-	printf("%s,%d,%d,%f,%lf\n", sim->name, n_regions, n_threads, sim_time, npart / sim_time / 10E6);
+	printf("%s,%d,%d,%f,%lf\n", sim->name, sim->n_regions, n_threads, sim_time, npart / sim_time / 10E6);
 #endif
 }
 
@@ -285,6 +1004,9 @@ void sim_report_energy(t_simulation *sim)
 	double tot_emf = 0;
 	double tot_part = 0;
 
+	// Particles sent in the last iteration (and holes left by them)
+	sim_merge_particles(sim);
+
 	for(int j = 0; j < sim->n_regions; j++)
 	{
 		tot_emf += emf_get_energy(&sim->regions[j].local_emf);
@@ -322,7 +1044,8 @@ void sim_report_grid_zdf(t_simulation *sim, enum report_grid_type type, const in
 	{
 		case REPORT_BFLD:
 			for(int j = 0; j < sim->n_regions; j++)
-				emf_reconstruct_global_buffer(&sim->regions[j].local_emf, global_buf, sim->regions[j].limits_y[0],
+				emf_reconstruct_global_buffer(&sim->regions[j].local_emf, global_buf,
+						sim->regions[j].limits[0][0], sim->regions[j].limits[1][0], sim->nx[0],
 						BFLD, coord);
 			emf_report(global_buf, sim->box, sim->nx, sim->iter, sim->dt, BFLD, coord, path);
 			break;
@@ -330,14 +1053,16 @@ void sim_report_grid_zdf(t_simulation *sim, enum report_grid_type type, const in
 		case REPORT_EFLD:
 
 			for(int j = 0; j < sim->n_regions; j++)
-				emf_reconstruct_global_buffer(&sim->regions[j].local_emf, global_buf, sim->regions[j].limits_y[0],
+				emf_reconstruct_global_buffer(&sim->regions[j].local_emf, global_buf,
+						sim->regions[j].limits[0][0], sim->regions[j].limits[1][0], sim->nx[0],
 						EFLD, coord);
 			emf_report(global_buf, sim->box, sim->nx, sim->iter, sim->dt, EFLD, coord, path);
 			break;
 
 		case REPORT_CURRENT:
 			for(int j = 0; j < sim->n_regions; j++)
-				current_reconstruct_global_buffer(&sim->regions[j].local_current, global_buf, sim->regions[j].limits_y[0], coord);
+				current_reconstruct_global_buffer(&sim->regions[j].local_current, global_buf,
+						sim->regions[j].limits[0][0], sim->regions[j].limits[1][0], sim->nx[0], coord);
 			current_report(global_buf, sim->iter, sim->nx, sim->box, sim->dt, coord, path);
 			break;
 
@@ -357,6 +1082,9 @@ void sim_report_spec_zdf(t_simulation *sim, const int species, const int rep_typ
 	char path[128] = "";
 	sprintf(path, "output/%s/%s", sim->name, sim->regions->species[species].name);
 
+	// Particles sent in the last iteration
+	sim_merge_particles(sim);
+
 	switch (rep_type & 0xF000)
 	{
 		case CHARGE:
@@ -419,8 +1147,7 @@ void sim_report_spec_zdf(t_simulation *sim, const int species, const int rep_typ
 			{
 				spec = &sim->regions[j].species[species];
 				for (int i = 0; i < spec->main_vector.size; i++)
-					data[i + offset] = (spec->n_move + spec->main_vector.data[i].ix + spec->main_vector.data[i].x)
-							* spec->dx[0];
+					data[i + offset] = (spec->main_vector.ix[i] + spec->main_vector.x[i]) * spec->dx[0];
 				offset += spec->main_vector.size;
 			}
 
@@ -432,7 +1159,7 @@ void sim_report_spec_zdf(t_simulation *sim, const int species, const int rep_typ
 			{
 				spec = &sim->regions[j].species[species];
 				for (int i = 0; i < spec->main_vector.size; i++)
-					data[i + offset] = (spec->main_vector.data[i].iy + spec->main_vector.data[i].y) * spec->dx[1];
+					data[i + offset] = (spec->main_vector.iy[i] + spec->main_vector.y[i]) * spec->dx[1];
 				offset += spec->main_vector.size;
 			}
 
@@ -444,7 +1171,7 @@ void sim_report_spec_zdf(t_simulation *sim, const int species, const int rep_typ
 			{
 				spec = &sim->regions[j].species[species];
 				for (int i = 0; i < spec->main_vector.size; i++)
-					data[i + offset] = spec->main_vector.data[i].ux;
+					data[i + offset] = spec->main_vector.ux[i];
 				offset += spec->main_vector.size;
 			}
 
@@ -456,7 +1183,7 @@ void sim_report_spec_zdf(t_simulation *sim, const int species, const int rep_typ
 			{
 				spec = &sim->regions[j].species[species];
 				for (int i = 0; i < spec->main_vector.size; i++)
-					data[i + offset] = spec->main_vector.data[i].uy;
+					data[i + offset] = spec->main_vector.uy[i];
 				offset += spec->main_vector.size;
 			}
 
@@ -468,7 +1195,7 @@ void sim_report_spec_zdf(t_simulation *sim, const int species, const int rep_typ
 			{
 				spec = &sim->regions[j].species[species];
 				for (int i = 0; i < spec->main_vector.size; i++)
-					data[i + offset] = spec->main_vector.data[i].uz;
+					data[i + offset] = spec->main_vector.uz[i];
 				offset += spec->main_vector.size;
 			}
 
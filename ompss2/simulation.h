@@ -39,10 +39,28 @@ typedef struct {
 	bool moving_window;
 
 	unsigned int n_regions;
+	int region_grid[2];	// Number of regions in x and y
 	t_region *regions;
 
 	int iter;
 
+	// Particle sorting frequency (0 - disabled)
+	int n_sort;
+
+	// Time spent creating the tasks of the iterations advanced with sim_iter and sim_iter_graph
+	double task_time, graph_time;
+	int task_iter, graph_iter;
+
+	// Region rebalancing frequency (0 - disabled) and number of rebalances
+	int n_rebalance;
+	int rebalance_count;
+
+	// Number of particles pushed by each task (0 - one task per species and region)
+	int chunk_size;
+
+	// Current deposition scheme
+	enum deposit_type deposit;
+
 } t_simulation;
 
 // Setup
@@ -50,12 +68,21 @@ void sim_new(t_simulation *sim, int nx[2], float box[2], float dt, float tmax, i
 		int n_species, char name[64], int n_regions);
 void sim_init(t_simulation *sim, int n_regions);
 void sim_set_moving_window(t_simulation *sim);
+void sim_set_sort(t_simulation *sim, const int n_sort);
+void sim_set_rebalance(t_simulation *sim, const int n_rebalance);
+void sim_set_chunk_size(t_simulation *sim, const int chunk_size);
+void sim_set_pusher(t_simulation *sim, const int species, const enum pusher_type pusher);
+void sim_set_current_deposit(t_simulation *sim, const enum deposit_type deposit);
 void sim_set_smooth(t_simulation *sim, t_smooth *smooth);
 void sim_add_laser(t_simulation *sim, t_emf_laser *laser);
 void sim_delete(t_simulation *sim);
 
+// Auto-tuning (number of regions and chunk size)
+void sim_autotune(t_simulation *sim);
+
 // Iteration
 void sim_iter(t_simulation *sim);
+int sim_iter_graph(t_simulation *sim, int n_iter);
 
 // Report
 int report(int n, int ndump);
@@ -7,9 +7,12 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include "timer.h"
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 uint64_t timer_ticks()
 {
@@ -24,6 +27,19 @@ double timer_interval_seconds(uint64_t start, uint64_t end)
 	return (end - start) * 1.0e-6;
 }
 
+uint64_t timer_ticks_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec) * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+double timer_interval_seconds_ns(uint64_t start, uint64_t end)
+{
+	return (end - start) * 1.0e-9;
+}
+
 double timer_cpu_seconds()
 {
 	struct timeval tv;
@@ -46,3 +62,31 @@ double timer_resolution()
 
 	return (double) (tv2.tv_usec - tv1.tv_usec) * 1.0e-6;
 }
+
+double timer_bench(void (*fn)(void *), void *arg)
+{
+	// Warm up (and number of calls of each measurement)
+	int n_calls = 1;
+	uint64_t t0 = timer_ticks_ns();
+	fn(arg);
+
+	while (timer_interval_seconds_ns(t0, timer_ticks_ns()) < TIMER_BENCH_MIN)
+	{
+		for (int k = 0; k < n_calls; k++)
+			fn(arg);
+		n_calls *= 2;
+	}
+
+	double best = -1;
+	for (int rep = 0; rep < TIMER_BENCH_REPS; rep++)
+	{
+		t0 = timer_ticks_ns();
+		for (int k = 0; k < n_calls; k++)
+			fn(arg);
+
+		const double time = timer_interval_seconds_ns(t0, timer_ticks_ns()) / n_calls;
+		if (best < 0 || time < best) best = time;
+	}
+
+	return best;
+}
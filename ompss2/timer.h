@@ -16,6 +16,16 @@
 uint64_t timer_ticks( void );
 double timer_interval_seconds(uint64_t start, uint64_t end);
 double timer_cpu_seconds( void );
+
+// Monotonic clock with ns resolution, for short intervals
+uint64_t timer_ticks_ns( void );
+double timer_interval_seconds_ns(uint64_t start, uint64_t end);
 double timer_resolution( void );
 
+// Best time (in seconds) of a call to fn(arg). The calls are repeated until each measurement takes
+// at least TIMER_BENCH_MIN seconds, and the best of TIMER_BENCH_REPS measurements is returned
+#define TIMER_BENCH_MIN 0.02
+#define TIMER_BENCH_REPS 5
+double timer_bench(void (*fn)(void *), void *arg);
+
 #endif
@@ -18,6 +18,22 @@ typedef struct {
 	t_fld x, y, z;
 } t_vfld;
 
+// Layout of the vector fields (E, B and J). The grids are stored by rows of nrow cells (padded, see
+// mem_row_pitch) and each row takes the space of nrow t_vfld. By default, the x, y and z components
+// of each cell are stored together. With ENABLE_PLANAR_FIELDS, each row is split in three planes
+// (nrow x values, then nrow y values and nrow z values), so consecutive cells of a component are
+// contiguous in memory. The fields are accessed through a t_fld pointer to the x component of the
+// cell [0][0]: the component c of the cell (i, j) is at FLD_CELL(i, j, nrow) + FLD_COMP(c, nrow)
+#ifdef ENABLE_PLANAR_FIELDS
+#define FLD_STRIDE 1
+#define FLD_COMP(c, nrow) ((c) * (nrow))
+#else
+#define FLD_STRIDE 3
+#define FLD_COMP(c, nrow) (c)
+#endif
+
+#define FLD_CELL(i, j, nrow) ((i) * FLD_STRIDE + 3 * (j) * (nrow))
+
 /* ANSI C does not define math constants */
 
 #ifndef M_PI
@@ -24,6 +24,14 @@
 #include "timer.h"
 #include "csv_handler.h"
 
+#if defined(ENABLE_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Number of particles pushed by each call of the push kernel
+#define PUSH_BATCH 256
+
 static double _spec_time = 0.0;
 static double _spec_npush = 0.0;
 
@@ -215,6 +223,9 @@ void spec_new(t_species *spec, char name[], const t_part_data m_q, const int ppc
 	spec->dt = dt;
 	spec->energy = 0;
 
+	// Select the particle push kernel for this CPU
+	spec_select_push_kernel();
+
 	// Initialize particle buffer
 	spec->np_max = 0;
 	spec->part = NULL;
@@ -534,16 +545,17 @@ void dep_current_zamb(int ix, int iy, int di, int dj, float x0, float y0, float
  *********************************************************************************************/
 
 void interpolate_fld(const t_vfld *restrict const E, const t_vfld *restrict const B, const int nrow,
-		const t_part *restrict const part, t_vfld *restrict const Ep, t_vfld *restrict const Bp)
+		const int ix, const int iy, const t_fld x, const t_fld y, t_vfld *restrict const Ep,
+		t_vfld *restrict const Bp)
 {
 	register int i, j, ih, jh;
 	register t_fld w1, w2, w1h, w2h;
 
-	i = part->ix;
-	j = part->iy;
+	i = ix;
+	j = iy;
 
-	w1 = part->x;
-	w2 = part->y;
+	w1 = x;
+	w2 = y;
 
 	ih = (w1 < 0.5f) ? -1 : 0;
 	jh = (w2 < 0.5f) ? -1 : 0;
@@ -576,73 +588,65 @@ void interpolate_fld(const t_vfld *restrict const E, const t_vfld *restrict cons
 
 }
 
-int ltrim(t_part_data x)
-{
-	return (x >= 1.0f) - (x < 0.0f);
-}
+/*********************************************************************************************
+ Vectorized particle push
+ *********************************************************************************************/
 
-void spec_advance(t_species *spec, t_emf *emf, t_current *current)
+// Parameters shared by all the push kernels
+typedef struct {
+	const t_vfld *restrict E;
+	const t_vfld *restrict B;
+	int nrow;
+	int offset_y;
+
+	t_part_data tem;
+	t_part_data dt_dx, dt_dy;
+	t_part_data q;
+} t_push_param;
+
+// Advance the momentum of np particles (Boris scheme) and calculate their displacement and qvz.
+// Returns the time centered kinetic energy of the particles.
+typedef double (*t_push_kernel)(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz);
+
+static double push_boris_scalar(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz)
 {
-	int i;
-	t_part_data qnx, qny, qvz;
+	const t_part_data tem = param->tem;
+	double energy = 0;
 
-	uint64_t t0;
-	t0 = timer_ticks();
-
-	const t_part_data tem = 0.5 * spec->dt / spec->m_q;
-	const t_part_data dt_dx = spec->dt / spec->dx[0];
-	const t_part_data dt_dy = spec->dt / spec->dx[1];
-
-	// Auxiliary values for current deposition
-	qnx = spec->q * spec->dx[0] / spec->dt;
-	qny = spec->q * spec->dx[1] / spec->dt;
-
-	const int nx0 = spec->nx[0];
-	const int nx1 = spec->nx[1];
-
-	// Advance internal iteration number
-	spec->iter += 1;
-
-	spec->energy = 0;
-
-	// Advance particles
-	for (i = 0; i < spec->np; i++)
+	for (int k = 0; k < np; k++)
 	{
 		t_vfld Ep, Bp;
 		t_part_data utx, uty, utz;
-		t_part_data ux, uy, uz, rg;
+		t_part_data u1, u2, u3, rg;
 		t_part_data utsq, gamma;
 		t_part_data gtem, otsq;
 
-		t_part_data x1, y1;
-
-		int di, dj;
-		float dx, dy;
-
-		// Load particle momenta
-		ux = spec->part[i].ux;
-		uy = spec->part[i].uy;
-		uz = spec->part[i].uz;
+		// Interpolate fields
+		interpolate_fld(param->E, param->B, param->nrow, ix[k], iy[k] - param->offset_y, x[k], y[k],
+				&Ep, &Bp);
 
-		// interpolate fields
-		interpolate_fld(emf->E, emf->B, emf->nrow, &spec->part[i], &Ep, &Bp);
-
-		// advance u using Boris scheme
+		// Advance u using Boris scheme
 		Ep.x *= tem;
 		Ep.y *= tem;
 		Ep.z *= tem;
 
-		utx = ux + Ep.x;
-		uty = uy + Ep.y;
-		utz = uz + Ep.z;
+		utx = ux[k] + Ep.x;
+		uty = uy[k] + Ep.y;
+		utz = uz[k] + Ep.z;
 
-        // Get time centered energy
-        utsq = utx*utx + uty*uty + utz*utz;
-        gamma = sqrtf( 1.0f + utsq );
-        spec -> energy += utsq / (gamma + 1);
+		// Get time centered energy
+		utsq = utx * utx + uty * uty + utz * utz;
+		gamma = sqrtf(1.0f + utsq);
+		energy += utsq / (gamma + 1);
 
 		// Perform first half of the rotation
-		gtem = tem / sqrtf(1.0f + utx * utx + uty * uty + utz * utz);
+		gtem = tem / gamma;
 
 		Bp.x *= gtem;
 		Bp.y *= gtem;
@@ -650,60 +654,497 @@ void spec_advance(t_species *spec, t_emf *emf, t_current *current)
 
 		otsq = 2.0f / (1.0f + Bp.x * Bp.x + Bp.y * Bp.y + Bp.z * Bp.z);
 
-		ux = utx + uty * Bp.z - utz * Bp.y;
-		uy = uty + utz * Bp.x - utx * Bp.z;
-		uz = utz + utx * Bp.y - uty * Bp.x;
+		u1 = utx + uty * Bp.z - utz * Bp.y;
+		u2 = uty + utz * Bp.x - utx * Bp.z;
+		u3 = utz + utx * Bp.y - uty * Bp.x;
 
 		// Perform second half of the rotation
-
 		Bp.x *= otsq;
 		Bp.y *= otsq;
 		Bp.z *= otsq;
 
-		utx += uy * Bp.z - uz * Bp.y;
-		uty += uz * Bp.x - ux * Bp.z;
-		utz += ux * Bp.y - uy * Bp.x;
+		utx += u2 * Bp.z - u3 * Bp.y;
+		uty += u3 * Bp.x - u1 * Bp.z;
+		utz += u1 * Bp.y - u2 * Bp.x;
+
+		// Perform second half of electric field acceleration
+		u1 = utx + Ep.x;
+		u2 = uty + Ep.y;
+		u3 = utz + Ep.z;
+
+		// Store new momenta
+		ux[k] = u1;
+		uy[k] = u2;
+		uz[k] = u3;
+
+		// Particle displacement
+		rg = 1.0f / sqrtf(1.0f + u1 * u1 + u2 * u2 + u3 * u3);
+
+		dx[k] = param->dt_dx * rg * u1;
+		dy[k] = param->dt_dy * rg * u2;
+		qvz[k] = param->q * u3 * rg;
+	}
+
+	return energy;
+}
+
+#ifdef SIMD_X86
+
+// Interpolate a field component in 8 particles. idx is the index (in floats) of the lower left
+// corner, nrow3 the size of a grid row (in floats) and (wx, wy) the interpolation weights
+__attribute__((target("avx2")))
+static inline __m256 interp_avx2(const float *restrict f, const __m256i idx, const __m256i nrow3,
+		const __m256 wx, const __m256 wy)
+{
+	const __m256i three = _mm256_set1_epi32(3);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256i idx_up = _mm256_add_epi32(idx, nrow3);
+
+	const __m256 f00 = _mm256_i32gather_ps(f, idx, 4);
+	const __m256 f10 = _mm256_i32gather_ps(f, _mm256_add_epi32(idx, three), 4);
+	const __m256 f01 = _mm256_i32gather_ps(f, idx_up, 4);
+	const __m256 f11 = _mm256_i32gather_ps(f, _mm256_add_epi32(idx_up, three), 4);
+
+	const __m256 wx0 = _mm256_sub_ps(one, wx);
+	const __m256 wy0 = _mm256_sub_ps(one, wy);
+
+	const __m256 low = _mm256_add_ps(_mm256_mul_ps(f00, wx0), _mm256_mul_ps(f10, wx));
+	const __m256 up = _mm256_add_ps(_mm256_mul_ps(f01, wx0), _mm256_mul_ps(f11, wx));
+
+	return _mm256_add_ps(_mm256_mul_ps(low, wy0), _mm256_mul_ps(up, wy));
+}
+
+// Index (in floats) of the t_vfld cell (i, j)
+__attribute__((target("avx2")))
+static inline __m256i cell_idx_avx2(const __m256i i, const __m256i j, const __m256i nrow)
+{
+	const __m256i cell = _mm256_add_epi32(i, _mm256_mullo_epi32(j, nrow));
+	return _mm256_add_epi32(cell, _mm256_add_epi32(cell, cell));
+}
+
+// Component of the cross product (a x b)
+#define CROSS_X(ay, az, by, bz) _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by))
+
+__attribute__((target("avx2")))
+static double push_boris_avx2(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz)
+{
+	const int nv = np - np % 8;
+
+	const float *restrict const E = (const float*) param->E;
+	const float *restrict const B = (const float*) param->B;
+
+	const __m256i nrow = _mm256_set1_epi32(param->nrow);
+	const __m256i nrow3 = _mm256_set1_epi32(3 * param->nrow);
+	const __m256i offset_y = _mm256_set1_epi32(param->offset_y);
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 minus_half = _mm256_set1_ps(-0.5f);
+	const __m256 tem = _mm256_set1_ps(param->tem);
+	const __m256 dt_dx = _mm256_set1_ps(param->dt_dx);
+	const __m256 dt_dy = _mm256_set1_ps(param->dt_dy);
+	const __m256 q = _mm256_set1_ps(param->q);
+
+	__m256d energy_lo = _mm256_setzero_pd();
+	__m256d energy_hi = _mm256_setzero_pd();
+
+	for (int k = 0; k < nv; k += 8)
+	{
+		const __m256i i = _mm256_loadu_si256((const __m256i*) (ix + k));
+		const __m256i j = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (iy + k)), offset_y);
+		const __m256 w1 = _mm256_loadu_ps(x + k);
+		const __m256 w2 = _mm256_loadu_ps(y + k);
+
+		// Indexes and weights of the staggered grid points (the mask is -1 when w < 0.5)
+		const __m256 mask1 = _mm256_cmp_ps(w1, half, _CMP_LT_OQ);
+		const __m256 mask2 = _mm256_cmp_ps(w2, half, _CMP_LT_OQ);
+
+		const __m256i ih = _mm256_add_epi32(i, _mm256_castps_si256(mask1));
+		const __m256i jh = _mm256_add_epi32(j, _mm256_castps_si256(mask2));
+
+		const __m256 w1h = _mm256_add_ps(w1, _mm256_blendv_ps(minus_half, half, mask1));
+		const __m256 w2h = _mm256_add_ps(w2, _mm256_blendv_ps(minus_half, half, mask2));
+
+		// Interpolate fields
+		const __m256i idx_ih_j = cell_idx_avx2(ih, j, nrow);
+		const __m256i idx_i_jh = cell_idx_avx2(i, jh, nrow);
+		const __m256i idx_i_j = cell_idx_avx2(i, j, nrow);
+		const __m256i idx_ih_jh = cell_idx_avx2(ih, jh, nrow);
+
+		__m256 Epx = interp_avx2(E, idx_ih_j, nrow3, w1h, w2);
+		__m256 Epy = interp_avx2(E + 1, idx_i_jh, nrow3, w1, w2h);
+		__m256 Epz = interp_avx2(E + 2, idx_i_j, nrow3, w1, w2);
+
+		__m256 Bpx = interp_avx2(B, idx_i_jh, nrow3, w1, w2h);
+		__m256 Bpy = interp_avx2(B + 1, idx_ih_j, nrow3, w1h, w2);
+		__m256 Bpz = interp_avx2(B + 2, idx_ih_jh, nrow3, w1h, w2h);
+
+		// Advance u using Boris scheme
+		Epx = _mm256_mul_ps(Epx, tem);
+		Epy = _mm256_mul_ps(Epy, tem);
+		Epz = _mm256_mul_ps(Epz, tem);
+
+		__m256 utx = _mm256_add_ps(_mm256_loadu_ps(ux + k), Epx);
+		__m256 uty = _mm256_add_ps(_mm256_loadu_ps(uy + k), Epy);
+		__m256 utz = _mm256_add_ps(_mm256_loadu_ps(uz + k), Epz);
+
+		// Get time centered energy
+		const __m256 utsq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(utx, utx),
+				_mm256_mul_ps(uty, uty)), _mm256_mul_ps(utz, utz));
+		const __m256 gamma = _mm256_sqrt_ps(_mm256_add_ps(one, utsq));
+		const __m256 energy = _mm256_div_ps(utsq, _mm256_add_ps(gamma, one));
+
+		energy_lo = _mm256_add_pd(energy_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(energy)));
+		energy_hi = _mm256_add_pd(energy_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(energy, 1)));
+
+		// Perform first half of the rotation
+		const __m256 gtem = _mm256_div_ps(tem, gamma);
+
+		Bpx = _mm256_mul_ps(Bpx, gtem);
+		Bpy = _mm256_mul_ps(Bpy, gtem);
+		Bpz = _mm256_mul_ps(Bpz, gtem);
+
+		const __m256 den = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(one, _mm256_mul_ps(Bpx, Bpx)),
+				_mm256_mul_ps(Bpy, Bpy)), _mm256_mul_ps(Bpz, Bpz));
+		const __m256 otsq = _mm256_div_ps(two, den);
+
+		__m256 u1 = _mm256_sub_ps(_mm256_add_ps(utx, _mm256_mul_ps(uty, Bpz)), _mm256_mul_ps(utz, Bpy));
+		__m256 u2 = _mm256_sub_ps(_mm256_add_ps(uty, _mm256_mul_ps(utz, Bpx)), _mm256_mul_ps(utx, Bpz));
+		__m256 u3 = _mm256_sub_ps(_mm256_add_ps(utz, _mm256_mul_ps(utx, Bpy)), _mm256_mul_ps(uty, Bpx));
+
+		// Perform second half of the rotation
+		Bpx = _mm256_mul_ps(Bpx, otsq);
+		Bpy = _mm256_mul_ps(Bpy, otsq);
+		Bpz = _mm256_mul_ps(Bpz, otsq);
+
+		utx = _mm256_add_ps(utx, CROSS_X(u2, u3, Bpy, Bpz));
+		uty = _mm256_add_ps(uty, CROSS_X(u3, u1, Bpz, Bpx));
+		utz = _mm256_add_ps(utz, CROSS_X(u1, u2, Bpx, Bpy));
+
+		// Perform second half of electric field acceleration
+		u1 = _mm256_add_ps(utx, Epx);
+		u2 = _mm256_add_ps(uty, Epy);
+		u3 = _mm256_add_ps(utz, Epz);
+
+		// Store new momenta
+		_mm256_storeu_ps(ux + k, u1);
+		_mm256_storeu_ps(uy + k, u2);
+		_mm256_storeu_ps(uz + k, u3);
+
+		// Particle displacement
+		const __m256 usq = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(one, _mm256_mul_ps(u1, u1)),
+				_mm256_mul_ps(u2, u2)), _mm256_mul_ps(u3, u3));
+		const __m256 rg = _mm256_div_ps(one, _mm256_sqrt_ps(usq));
+
+		_mm256_storeu_ps(dx + k, _mm256_mul_ps(_mm256_mul_ps(dt_dx, rg), u1));
+		_mm256_storeu_ps(dy + k, _mm256_mul_ps(_mm256_mul_ps(dt_dy, rg), u2));
+		_mm256_storeu_ps(qvz + k, _mm256_mul_ps(_mm256_mul_ps(q, u3), rg));
+	}
+
+	double buf[4];
+	_mm256_storeu_pd(buf, _mm256_add_pd(energy_lo, energy_hi));
+
+	// Remaining particles
+	return buf[0] + buf[1] + buf[2] + buf[3]
+			+ push_boris_scalar(param, np - nv, ix + nv, iy + nv, x + nv, y + nv, ux + nv, uy + nv,
+					uz + nv, dx + nv, dy + nv, qvz + nv);
+}
+
+#undef CROSS_X
+
+// AVX-512 version (16 particles per iteration)
+__attribute__((target("avx512f")))
+static inline __m512 interp_avx512(const float *restrict f, const __m512i idx, const __m512i nrow3,
+		const __m512 wx, const __m512 wy)
+{
+	const __m512i three = _mm512_set1_epi32(3);
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512i idx_up = _mm512_add_epi32(idx, nrow3);
+
+	const __m512 f00 = _mm512_i32gather_ps(idx, f, 4);
+	const __m512 f10 = _mm512_i32gather_ps(_mm512_add_epi32(idx, three), f, 4);
+	const __m512 f01 = _mm512_i32gather_ps(idx_up, f, 4);
+	const __m512 f11 = _mm512_i32gather_ps(_mm512_add_epi32(idx_up, three), f, 4);
+
+	const __m512 wx0 = _mm512_sub_ps(one, wx);
+	const __m512 wy0 = _mm512_sub_ps(one, wy);
+
+	const __m512 low = _mm512_add_ps(_mm512_mul_ps(f00, wx0), _mm512_mul_ps(f10, wx));
+	const __m512 up = _mm512_add_ps(_mm512_mul_ps(f01, wx0), _mm512_mul_ps(f11, wx));
+
+	return _mm512_add_ps(_mm512_mul_ps(low, wy0), _mm512_mul_ps(up, wy));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i cell_idx_avx512(const __m512i i, const __m512i j, const __m512i nrow)
+{
+	const __m512i cell = _mm512_add_epi32(i, _mm512_mullo_epi32(j, nrow));
+	return _mm512_add_epi32(cell, _mm512_add_epi32(cell, cell));
+}
+
+#define CROSS_X(ay, az, by, bz) _mm512_sub_ps(_mm512_mul_ps(ay, bz), _mm512_mul_ps(az, by))
+
+__attribute__((target("avx512f")))
+static double push_boris_avx512(const t_push_param *param, const int np, const int *restrict ix,
+		const int *restrict iy, const t_part_data *restrict x, const t_part_data *restrict y,
+		t_part_data *restrict ux, t_part_data *restrict uy, t_part_data *restrict uz,
+		t_part_data *restrict dx, t_part_data *restrict dy, t_part_data *restrict qvz)
+{
+	const int nv = np - np % 16;
+
+	const float *restrict const E = (const float*) param->E;
+	const float *restrict const B = (const float*) param->B;
+
+	const __m512i nrow = _mm512_set1_epi32(param->nrow);
+	const __m512i nrow3 = _mm512_set1_epi32(3 * param->nrow);
+	const __m512i offset_y = _mm512_set1_epi32(param->offset_y);
+	const __m512i one_i = _mm512_set1_epi32(1);
+
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 two = _mm512_set1_ps(2.0f);
+	const __m512 half = _mm512_set1_ps(0.5f);
+	const __m512 minus_half = _mm512_set1_ps(-0.5f);
+	const __m512 tem = _mm512_set1_ps(param->tem);
+	const __m512 dt_dx = _mm512_set1_ps(param->dt_dx);
+	const __m512 dt_dy = _mm512_set1_ps(param->dt_dy);
+	const __m512 q = _mm512_set1_ps(param->q);
+
+	__m512d energy_lo = _mm512_setzero_pd();
+	__m512d energy_hi = _mm512_setzero_pd();
+
+	for (int k = 0; k < nv; k += 16)
+	{
+		const __m512i i = _mm512_loadu_si512(ix + k);
+		const __m512i j = _mm512_sub_epi32(_mm512_loadu_si512(iy + k), offset_y);
+		const __m512 w1 = _mm512_loadu_ps(x + k);
+		const __m512 w2 = _mm512_loadu_ps(y + k);
+
+		// Indexes and weights of the staggered grid points
+		const __mmask16 mask1 = _mm512_cmp_ps_mask(w1, half, _CMP_LT_OQ);
+		const __mmask16 mask2 = _mm512_cmp_ps_mask(w2, half, _CMP_LT_OQ);
+
+		const __m512i ih = _mm512_mask_sub_epi32(i, mask1, i, one_i);
+		const __m512i jh = _mm512_mask_sub_epi32(j, mask2, j, one_i);
+
+		const __m512 w1h = _mm512_add_ps(w1, _mm512_mask_blend_ps(mask1, minus_half, half));
+		const __m512 w2h = _mm512_add_ps(w2, _mm512_mask_blend_ps(mask2, minus_half, half));
+
+		// Interpolate fields
+		const __m512i idx_ih_j = cell_idx_avx512(ih, j, nrow);
+		const __m512i idx_i_jh = cell_idx_avx512(i, jh, nrow);
+		const __m512i idx_i_j = cell_idx_avx512(i, j, nrow);
+		const __m512i idx_ih_jh = cell_idx_avx512(ih, jh, nrow);
+
+		__m512 Epx = interp_avx512(E, idx_ih_j, nrow3, w1h, w2);
+		__m512 Epy = interp_avx512(E + 1, idx_i_jh, nrow3, w1, w2h);
+		__m512 Epz = interp_avx512(E + 2, idx_i_j, nrow3, w1, w2);
+
+		__m512 Bpx = interp_avx512(B, idx_i_jh, nrow3, w1, w2h);
+		__m512 Bpy = interp_avx512(B + 1, idx_ih_j, nrow3, w1h, w2);
+		__m512 Bpz = interp_avx512(B + 2, idx_ih_jh, nrow3, w1h, w2h);
+
+		// Advance u using Boris scheme
+		Epx = _mm512_mul_ps(Epx, tem);
+		Epy = _mm512_mul_ps(Epy, tem);
+		Epz = _mm512_mul_ps(Epz, tem);
+
+		__m512 utx = _mm512_add_ps(_mm512_loadu_ps(ux + k), Epx);
+		__m512 uty = _mm512_add_ps(_mm512_loadu_ps(uy + k), Epy);
+		__m512 utz = _mm512_add_ps(_mm512_loadu_ps(uz + k), Epz);
+
+		// Get time centered energy
+		const __m512 utsq = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(utx, utx),
+				_mm512_mul_ps(uty, uty)), _mm512_mul_ps(utz, utz));
+		const __m512 gamma = _mm512_sqrt_ps(_mm512_add_ps(one, utsq));
+		const __m512 energy = _mm512_div_ps(utsq, _mm512_add_ps(gamma, one));
+
+		energy_lo = _mm512_add_pd(energy_lo, _mm512_cvtps_pd(_mm512_castps512_ps256(energy)));
+		energy_hi = _mm512_add_pd(energy_hi, _mm512_cvtps_pd(_mm256_castpd_ps(
+				_mm512_extractf64x4_pd(_mm512_castps_pd(energy), 1))));
+
+		// Perform first half of the rotation
+		const __m512 gtem = _mm512_div_ps(tem, gamma);
+
+		Bpx = _mm512_mul_ps(Bpx, gtem);
+		Bpy = _mm512_mul_ps(Bpy, gtem);
+		Bpz = _mm512_mul_ps(Bpz, gtem);
+
+		const __m512 den = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(one, _mm512_mul_ps(Bpx, Bpx)),
+				_mm512_mul_ps(Bpy, Bpy)), _mm512_mul_ps(Bpz, Bpz));
+		const __m512 otsq = _mm512_div_ps(two, den);
+
+		__m512 u1 = _mm512_sub_ps(_mm512_add_ps(utx, _mm512_mul_ps(uty, Bpz)), _mm512_mul_ps(utz, Bpy));
+		__m512 u2 = _mm512_sub_ps(_mm512_add_ps(uty, _mm512_mul_ps(utz, Bpx)), _mm512_mul_ps(utx, Bpz));
+		__m512 u3 = _mm512_sub_ps(_mm512_add_ps(utz, _mm512_mul_ps(utx, Bpy)), _mm512_mul_ps(uty, Bpx));
+
+		// Perform second half of the rotation
+		Bpx = _mm512_mul_ps(Bpx, otsq);
+		Bpy = _mm512_mul_ps(Bpy, otsq);
+		Bpz = _mm512_mul_ps(Bpz, otsq);
+
+		utx = _mm512_add_ps(utx, CROSS_X(u2, u3, Bpy, Bpz));
+		uty = _mm512_add_ps(uty, CROSS_X(u3, u1, Bpz, Bpx));
+		utz = _mm512_add_ps(utz, CROSS_X(u1, u2, Bpx, Bpy));
 
 		// Perform second half of electric field acceleration
-		ux = utx + Ep.x;
-		uy = uty + Ep.y;
-		uz = utz + Ep.z;
+		u1 = _mm512_add_ps(utx, Epx);
+		u2 = _mm512_add_ps(uty, Epy);
+		u3 = _mm512_add_ps(utz, Epz);
 
 		// Store new momenta
-		spec->part[i].ux = ux;
-		spec->part[i].uy = uy;
-		spec->part[i].uz = uz;
+		_mm512_storeu_ps(ux + k, u1);
+		_mm512_storeu_ps(uy + k, u2);
+		_mm512_storeu_ps(uz + k, u3);
+
+		// Particle displacement
+		const __m512 usq = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(one, _mm512_mul_ps(u1, u1)),
+				_mm512_mul_ps(u2, u2)), _mm512_mul_ps(u3, u3));
+		const __m512 rg = _mm512_div_ps(one, _mm512_sqrt_ps(usq));
+
+		_mm512_storeu_ps(dx + k, _mm512_mul_ps(_mm512_mul_ps(dt_dx, rg), u1));
+		_mm512_storeu_ps(dy + k, _mm512_mul_ps(_mm512_mul_ps(dt_dy, rg), u2));
+		_mm512_storeu_ps(qvz + k, _mm512_mul_ps(_mm512_mul_ps(q, u3), rg));
+	}
 
-		// push particle
-		rg = 1.0f / sqrtf(1.0f + ux * ux + uy * uy + uz * uz);
+	// Remaining particles
+	return _mm512_reduce_add_pd(_mm512_add_pd(energy_lo, energy_hi))
+			+ push_boris_scalar(param, np - nv, ix + nv, iy + nv, x + nv, y + nv, ux + nv, uy + nv,
+					uz + nv, dx + nv, dy + nv, qvz + nv);
+}
 
-		dx = dt_dx * rg * ux;
-		dy = dt_dy * rg * uy;
+#undef CROSS_X
 
-		x1 = spec->part[i].x + dx;
-		y1 = spec->part[i].y + dy;
+#endif
 
-		di = ltrim(x1);
-		dj = ltrim(y1);
+static t_push_kernel push_kernel = push_boris_scalar;
+static const char *push_kernel_name = "scalar";
+
+// Select the push kernel for the current CPU (can be overridden with ZPIC_SIMD=scalar|avx2|avx512)
+void spec_select_push_kernel(void)
+{
+	push_kernel = push_boris_scalar;
+	push_kernel_name = "scalar";
 
-		x1 -= di;
-		y1 -= dj;
+#ifdef SIMD_X86
+	const char *isa = getenv("ZPIC_SIMD");
+	__builtin_cpu_init();
 
-		qvz = spec->q * uz * rg;
+	if (isa && !strcmp(isa, "scalar")) return;
 
-		// deposit current using Eskirepov method
-//		dep_current_esk(spec->part[i].ix, spec->part[i].iy, di, dj, spec->part[i].x, spec->part[i].y, x1, y1, qnx, qny,
-//				qvz, current);
+	if ((!isa || !strcmp(isa, "avx512")) && __builtin_cpu_supports("avx512f"))
+	{
+		push_kernel = push_boris_avx512;
+		push_kernel_name = "AVX-512 (16 particles/iteration)";
+	} else if (__builtin_cpu_supports("avx2"))
+	{
+		push_kernel = push_boris_avx2;
+		push_kernel_name = "AVX2 (8 particles/iteration)";
+	}
+#endif
+}
 
-		dep_current_zamb(spec->part[i].ix, spec->part[i].iy, di, dj, spec->part[i].x, spec->part[i].y, dx, dy, qnx, qny,
-				qvz, current);
+// Name of the particle push kernel in use
+const char* spec_push_kernel_name(void)
+{
+	return push_kernel_name;
+}
 
-		// Store results
-		spec->part[i].x = x1;
-		spec->part[i].y = y1;
-		spec->part[i].ix += di;
-		spec->part[i].iy += dj;
+int ltrim(t_part_data x)
+{
+	return (x >= 1.0f) - (x < 0.0f);
+}
 
+void spec_advance(t_species *spec, t_emf *emf, t_current *current)
+{
+	int i;
+	t_part_data qnx, qny;
+
+	uint64_t t0;
+	t0 = timer_ticks();
+
+	const t_part_data tem = 0.5 * spec->dt / spec->m_q;
+	const t_part_data dt_dx = spec->dt / spec->dx[0];
+	const t_part_data dt_dy = spec->dt / spec->dx[1];
+
+	// Auxiliary values for current deposition
+	qnx = spec->q * spec->dx[0] / spec->dt;
+	qny = spec->q * spec->dx[1] / spec->dt;
+
+	const int nx0 = spec->nx[0];
+	const int nx1 = spec->nx[1];
+
+	// Advance internal iteration number
+	spec->iter += 1;
+
+	spec->energy = 0;
+
+	const t_push_param param = {.E = emf->E, .B = emf->B, .nrow = emf->nrow, .offset_y = 0,
+								.tem = tem, .dt_dx = dt_dx, .dt_dy = dt_dy, .q = spec->q};
+
+	// Advance particles
+	for (int k = 0; k < spec->np; k += PUSH_BATCH)
+	{
+		const int np = (k + PUSH_BATCH > spec->np) ? spec->np - k : PUSH_BATCH;
+
+		int ix[PUSH_BATCH], iy[PUSH_BATCH];
+		t_part_data x[PUSH_BATCH], y[PUSH_BATCH];
+		t_part_data ux[PUSH_BATCH], uy[PUSH_BATCH], uz[PUSH_BATCH];
+		t_part_data dx[PUSH_BATCH], dy[PUSH_BATCH], qvz[PUSH_BATCH];
+
+		// Load the particles into SoA buffers
+		for (i = 0; i < np; i++)
+		{
+			ix[i] = spec->part[k + i].ix;
+			iy[i] = spec->part[k + i].iy;
+			x[i] = spec->part[k + i].x;
+			y[i] = spec->part[k + i].y;
+			ux[i] = spec->part[k + i].ux;
+			uy[i] = spec->part[k + i].uy;
+			uz[i] = spec->part[k + i].uz;
+		}
+
+		// Advance the momentum and calculate the displacement of the particles (vectorized)
+		spec->energy += push_kernel(&param, np, ix, iy, x, y, ux, uy, uz, dx, dy, qvz);
+
+		for (i = 0; i < np; i++)
+		{
+			t_part_data x1, y1;
+			int di, dj;
+
+			// Store new momenta
+			spec->part[k + i].ux = ux[i];
+			spec->part[k + i].uy = uy[i];
+			spec->part[k + i].uz = uz[i];
+
+			x1 = x[i] + dx[i];
+			y1 = y[i] + dy[i];
+
+			di = ltrim(x1);
+			dj = ltrim(y1);
+
+			x1 -= di;
+			y1 -= dj;
+
+			// deposit current using Eskirepov method
+//			dep_current_esk(ix[i], iy[i], di, dj, x[i], y[i], x1, y1, qnx, qny, qvz[i], current);
+
+			dep_current_zamb(ix[i], iy[i], di, dj, x[i], y[i], dx[i], dy[i], qnx, qny, qvz[i], current);
+
+			// Store results
+			spec->part[k + i].x = x1;
+			spec->part[k + i].y = y1;
+			spec->part[k + i].ix += di;
+			spec->part[k + i].iy += dj;
+		}
+	}
+
+	// Boundary conditions
+	for (i = 0; i < spec->np; i++)
+	{
 		// First shift particle left (if applicable), then check for particles leaving the box
 		if(spec->moving_window)
 		{
@@ -85,10 +85,12 @@ void spec_new(t_species *spec, char name[], const t_part_data m_q, const int ppc
 		const float dt, t_density *density);
 
 void spec_delete(t_species *spec);
+void spec_select_push_kernel(void);
 void spec_advance(t_species *spec, t_emf *emf, t_current *current);
 
 double spec_time(void);
 double spec_perf(void);
+const char* spec_push_kernel_name(void);
 
 /*********************************************************************************************
  Diagnostics
@@ -202,6 +202,7 @@ void sim_timings(t_simulation *sim, uint64_t t0, uint64_t t1)
 		double perf = spec_perf();
 		fprintf(stderr, "Particle advance [nsec/part] = %f \n", 1.e9 * perf);
 		fprintf(stderr, "Particle advance [Mpart/sec] = %f \n", 1.e-6 / perf);
+		fprintf(stderr, "Particle push: %s\n", spec_push_kernel_name());
 	}
 }
 